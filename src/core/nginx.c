@@ -30,6 +30,21 @@ static ngx_conf_enum_t  ngx_debug_points[] = {
 };
 
 
+static ngx_conf_enum_t  ngx_shm_numa[] = {
+    { ngx_string("default"), NGX_SHM_NUMA_DEFAULT },
+    { ngx_string("interleave"), NGX_SHM_NUMA_INTERLEAVE },
+    { ngx_null_string, 0 }
+};
+
+
+static ngx_conf_enum_t  ngx_huge_pages[] = {
+    { ngx_string("off"), NGX_HUGE_PAGES_OFF },
+    { ngx_string("try"), NGX_HUGE_PAGES_TRY },
+    { ngx_string("on"), NGX_HUGE_PAGES_ON },
+    { ngx_null_string, 0 }
+};
+
+
 static ngx_command_t  ngx_core_commands[] = {
 
     { ngx_string("daemon"),
@@ -102,6 +117,20 @@ static ngx_command_t  ngx_core_commands[] = {
       0,
       NULL },
 
+    { ngx_string("shared_memory_numa"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      0,
+      offsetof(ngx_core_conf_t, shm_numa),
+      &ngx_shm_numa },
+
+    { ngx_string("huge_pages"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      0,
+      offsetof(ngx_core_conf_t, huge_pages),
+      &ngx_huge_pages },
+
     { ngx_string("worker_rlimit_nofile"),
       NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_num_slot,
@@ -952,6 +981,7 @@ ngx_core_module_create_conf(ngx_cycle_t *cycle)
      *     ccf->pid = NULL;
      *     ccf->oldpid = NULL;
      *     ccf->priority = 0;
+     *     ccf->cpu_affinity_auto = 0;
      *     ccf->cpu_affinity_n = 0;
      *     ccf->cpu_affinity = NULL;
      */
@@ -962,6 +992,8 @@ ngx_core_module_create_conf(ngx_cycle_t *cycle)
 
     ccf->worker_processes = NGX_CONF_UNSET;
     ccf->debug_points = NGX_CONF_UNSET;
+    ccf->shm_numa = NGX_CONF_UNSET_UINT;
+    ccf->huge_pages = NGX_CONF_UNSET_UINT;
 
     ccf->rlimit_nofile = NGX_CONF_UNSET;
     ccf->rlimit_core = NGX_CONF_UNSET;
@@ -996,6 +1028,8 @@ ngx_core_module_init_conf(ngx_cycle_t *cycle, void *conf)
 
     ngx_conf_init_value(ccf->worker_processes, 1);
     ngx_conf_init_value(ccf->debug_points, 0);
+    ngx_conf_init_uint_value(ccf->shm_numa, NGX_SHM_NUMA_DEFAULT);
+    ngx_conf_init_uint_value(ccf->huge_pages, NGX_HUGE_PAGES_OFF);
 
 #if (NGX_HAVE_SCHED_SETAFFINITY)
 
@@ -1256,19 +1290,19 @@ ngx_set_priority(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 static char *
 ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
-#if (NGX_HAVE_SCHED_SETAFFINITY)
+#if (NGX_HAVE_CPU_AFFINITY)
     ngx_core_conf_t  *ccf = conf;
 
-    u_char            ch;
-    u_long           *mask;
+    u_char            ch, *p;
     ngx_str_t        *value;
     ngx_uint_t        i, n;
+    ngx_cpuset_t     *mask;
 
     if (ccf->cpu_affinity) {
         return "is duplicate";
     }
 
-    mask = ngx_palloc(cf->pool, (cf->args->nelts - 1) * sizeof(long));
+    mask = ngx_palloc(cf->pool, (cf->args->nelts - 1) * sizeof(ngx_cpuset_t));
     if (mask == NULL) {
         return NGX_CONF_ERROR;
     }
@@ -1278,32 +1312,58 @@ ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     value = cf->args->elts;
 
-    for (n = 1; n < cf->args->nelts; n++) {
+    if (ngx_strcmp(value[1].data, "auto") == 0) {
 
-        if (value[n].len > 32) {
+        if (cf->args->nelts > 3) {
             ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                         "\"worker_cpu_affinity\" supports up to 32 CPU only");
+                               "invalid number of arguments in "
+                               "\"worker_cpu_affinity\" directive");
             return NGX_CONF_ERROR;
         }
 
-        mask[n - 1] = 0;
+        ccf->cpu_affinity_auto = 1;
+
+        CPU_ZERO(&mask[0]);
+        for (i = 0; i < (ngx_uint_t) ngx_min(ngx_ncpu, CPU_SETSIZE); i++) {
+            CPU_SET(i, &mask[0]);
+        }
+
+        n = 2;
 
-        for (i = 0; i < value[n].len; i++) {
+    } else {
+        n = 1;
+    }
+
+    for ( /* void */ ; n < cf->args->nelts; n++) {
+
+        if (value[n].len > CPU_SETSIZE) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                         "\"worker_cpu_affinity\" supports up to %d CPUs only",
+                         CPU_SETSIZE);
+            return NGX_CONF_ERROR;
+        }
 
-            ch = value[n].data[i];
+        i = 0;
+        CPU_ZERO(&mask[n - 1]);
+
+        for (p = value[n].data + value[n].len - 1;
+             p >= value[n].data;
+             p--)
+        {
+            ch = *p;
 
             if (ch == ' ') {
                 continue;
             }
 
-            mask[n - 1] <<= 1;
+            i++;
 
             if (ch == '0') {
                 continue;
             }
 
             if (ch == '1') {
-                mask[n - 1] |= 1;
+                CPU_SET(i - 1, &mask[n - 1]);
                 continue;
             }
 
@@ -1314,6 +1374,11 @@ ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         }
     }
 
+    if (ccf->cpu_affinity_auto) {
+        ccf->cpu_affinity = &mask[cf->args->nelts - 2];
+        ccf->cpu_affinity_n = 1;
+    }
+
 #else
 
     ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
@@ -1325,21 +1390,106 @@ ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
-u_long
+ngx_cpuset_t *
 ngx_get_cpu_affinity(ngx_uint_t n)
 {
-    ngx_core_conf_t  *ccf;
+#if (NGX_HAVE_CPU_AFFINITY)
+    ngx_int_t            k;
+    ngx_uint_t           j;
+    ngx_cpuset_t        *mask, cpus;
+    ngx_core_conf_t     *ccf;
+    static ngx_cpuset_t  result;
+#if (NGX_HAVE_NUMA)
+    ngx_uint_t           i, nodes;
+#endif
 
     ccf = (ngx_core_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
                                            ngx_core_module);
 
     if (ccf->cpu_affinity == NULL) {
-        return 0;
+        return NULL;
     }
 
-    if (ccf->cpu_affinity_n > n) {
-        return ccf->cpu_affinity[n];
+    if (!ccf->cpu_affinity_auto) {
+
+        if (ccf->cpu_affinity_n > n) {
+            return &ccf->cpu_affinity[n];
+        }
+
+        return &ccf->cpu_affinity[ccf->cpu_affinity_n - 1];
     }
 
-    return ccf->cpu_affinity[ccf->cpu_affinity_n - 1];
+    /*
+     * "auto": each worker is bound to a single CPU from the mask,
+     * on NUMA systems the workers are spread over the nodes
+     * in round robin order, so that all nodes are loaded evenly
+     */
+
+    mask = &ccf->cpu_affinity[0];
+    cpus = *mask;
+
+#if (NGX_HAVE_NUMA)
+
+    if (ngx_numa_init(ngx_cycle->log) == NGX_OK && ngx_numa_n > 1) {
+
+        nodes = 0;
+
+        for (i = 0; i < NGX_NUMA_MAX_NODES; i++) {
+            if (ngx_numa_nodes & ((uint64_t) 1 << i)) {
+                CPU_AND(&cpus, mask, &ngx_numa_cpus[i]);
+                nodes += (CPU_COUNT(&cpus) != 0);
+            }
+        }
+
+        if (nodes > 1) {
+
+            /* the (n % nodes)-th node that has CPUs from the mask */
+
+            k = n % nodes;
+
+            for (i = 0; i < NGX_NUMA_MAX_NODES; i++) {
+                if (!(ngx_numa_nodes & ((uint64_t) 1 << i))) {
+                    continue;
+                }
+
+                CPU_AND(&cpus, mask, &ngx_numa_cpus[i]);
+
+                if (CPU_COUNT(&cpus) && k-- == 0) {
+                    break;
+                }
+            }
+
+            n /= nodes;
+
+        } else {
+            cpus = *mask;
+        }
+    }
+
+#endif
+
+    if (CPU_COUNT(&cpus) == 0) {
+        return NULL;
+    }
+
+    /* the (n % count)-th CPU of the selected set */
+
+    k = n % CPU_COUNT(&cpus);
+
+    for (j = 0; j < CPU_SETSIZE; j++) {
+        if (CPU_ISSET(j, &cpus) && k-- == 0) {
+            break;
+        }
+    }
+
+    CPU_ZERO(&result);
+    CPU_SET(j, &result);
+
+    return &result;
+
+#else
+
+    return NULL;
+
+#endif
 }
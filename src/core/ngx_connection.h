@@ -46,6 +46,8 @@ struct ngx_listening_s {
 											post_accept_timeout秒后仍然没有收到的用户数据，则内核直接丢弃连接
 											*/
 
+    ngx_uint_t          worker; /* 开启reuseport时该套接字所属的worker进程序号 */
+
     ngx_listening_t    *previous; /*组成单链表*/
     ngx_connection_t   *connection; /*当前监听句柄对应着的ngx_connection_t结构体*/
 
@@ -73,6 +75,10 @@ struct ngx_listening_s {
 #if (NGX_HAVE_INET6 && defined IPV6_V6ONLY)
     unsigned            ipv6only:2;
 #endif
+#if (NGX_HAVE_REUSEPORT)
+    unsigned            reuseport:1; /*每个worker进程拥有各自的SO_REUSEPORT监听套接字*/
+    unsigned            add_reuseport:1;
+#endif
 
 #if (NGX_HAVE_DEFERRED_ACCEPT)
     unsigned            deferred_accept:1;
@@ -211,6 +217,7 @@ struct ngx_connection_s {
 
 ngx_listening_t *ngx_create_listening(ngx_conf_t *cf, void *sockaddr,
     socklen_t socklen);
+ngx_int_t ngx_clone_listening(ngx_cycle_t *cycle, ngx_listening_t *ls);
 ngx_int_t ngx_set_inherited_sockets(ngx_cycle_t *cycle);
 ngx_int_t ngx_open_listening_sockets(ngx_cycle_t *cycle);
 void ngx_configure_listening_sockets(ngx_cycle_t *cycle);
@@ -50,21 +50,22 @@ function: 负责初始化ngx_cycle_t 中数据结构体、解析配置文件、
 ngx_cycle_t *
 ngx_init_cycle(ngx_cycle_t *old_cycle)
 {
-    void                *rv;
-    char               **senv, **env;
-    ngx_uint_t           i, n;
-    ngx_log_t           *log;
-    ngx_time_t          *tp;
-    ngx_conf_t           conf;
-    ngx_pool_t          *pool;
-    ngx_cycle_t         *cycle, **old;
-    ngx_shm_zone_t      *shm_zone, *oshm_zone;
-    ngx_list_part_t     *part, *opart;
-    ngx_open_file_t     *file;
-    ngx_listening_t     *ls, *nls;
-    ngx_core_conf_t     *ccf, *old_ccf;
-    ngx_core_module_t   *module;
-    char                 hostname[NGX_MAXHOSTNAMELEN];
+    void                 *rv;
+    char                **senv, **env;
+    ngx_uint_t            i, n;
+    ngx_log_t            *log;
+    ngx_time_t           *tp;
+    ngx_conf_t            conf;
+    ngx_pool_t           *pool;
+    ngx_cycle_t          *cycle, **old;
+    ngx_shm_zone_t       *shm_zone, *oshm_zone;
+    ngx_list_part_t      *part, *opart;
+    ngx_open_file_t      *file;
+    ngx_listening_t      *ls, *nls;
+    ngx_core_conf_t      *ccf, *old_ccf;
+    ngx_core_module_t    *module;
+    ngx_stat_counter_t   *counter;
+    char                  hostname[NGX_MAXHOSTNAMELEN];
 
     ngx_timezone_update();
 
@@ -176,6 +177,29 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
         return NULL;
     }
 
+    /* the statistics counters keep their indexes over reconfigurations */
+
+    n = old_cycle->stat_counters.nelts;
+
+    if (ngx_array_init(&cycle->stat_counters, pool, n ? n : 16,
+                       sizeof(ngx_stat_counter_t))
+        != NGX_OK)
+    {
+        ngx_destroy_pool(pool);
+        return NULL;
+    }
+
+    counter = old_cycle->stat_counters.elts;
+
+    for (i = 0; i < n; i++) {
+        if (ngx_stat_counter_index(cycle, &counter[i].name, counter[i].gauge)
+            == NGX_ERROR)
+        {
+            ngx_destroy_pool(pool);
+            return NULL;
+        }
+    }
+
     n = old_cycle->listening.nelts ? old_cycle->listening.nelts : 10;
 
     cycle->listening.elts = ngx_pcalloc(pool, n * sizeof(ngx_listening_t));
@@ -431,6 +455,7 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
         }
 
         shm_zone[i].shm.log = cycle->log;
+        shm_zone[i].shm.huge_pages = ccf->huge_pages;
 
         opart = &old_cycle->shared_memory.part;
         oshm_zone = opart->elts;
@@ -458,8 +483,11 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
                 continue;
             }
 
-            if (shm_zone[i].shm.size == oshm_zone[n].shm.size) {
+            if (shm_zone[i].shm.size == oshm_zone[n].shm.size
+                && !shm_zone[i].noreuse)
+            {
                 shm_zone[i].shm.addr = oshm_zone[n].shm.addr;
+                shm_zone[i].shm.huge = oshm_zone[n].shm.huge;
 
                 if (shm_zone[i].init(&shm_zone[i], oshm_zone[n].data)
                     != NGX_OK)
@@ -470,7 +498,7 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
                 goto shm_zone_found;
             }
 
-            ngx_shm_free(&oshm_zone[n].shm);
+            /* the old zone is freed with the old cycle */
 
             break;
         }
@@ -479,6 +507,20 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
             goto failed;
         }
 
+#if (NGX_HAVE_NUMA)
+
+        /* the policy applies to the pages that are not yet touched */
+
+        if (ccf->shm_numa == NGX_SHM_NUMA_INTERLEAVE
+            && ngx_numa_init(log) == NGX_OK
+            && ngx_numa_n > 1)
+        {
+            ngx_numa_interleave(shm_zone[i].shm.addr, shm_zone[i].shm.size,
+                                log);
+        }
+
+#endif
+
         if (ngx_init_zone_pool(cycle, &shm_zone[i]) != NGX_OK) {
             goto failed;
         }
@@ -509,6 +551,10 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
                     continue;
                 }
 
+                if (ls[i].remain) {
+                    continue;
+                }
+
                 if (ngx_cmp_sockaddr(nls[n].sockaddr, ls[i].sockaddr) == NGX_OK)
                 {
                     nls[n].fd = ls[i].fd;
@@ -519,6 +565,18 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
                         nls[n].listen = 1;
                     }
 
+#if (NGX_HAVE_REUSEPORT)
+
+                    /*
+                     * the clones of a reuseport socket are matched
+                     * one by one, so every worker keeps its own queue
+                     */
+
+                    if (nls[n].reuseport && !ls[i].reuseport) {
+                        nls[n].add_reuseport = 1;
+                    }
+#endif
+
 #if (NGX_HAVE_DEFERRED_ACCEPT && defined SO_ACCEPTFILTER)
 
                     /*
@@ -643,7 +701,10 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
                 n = 0;
             }
 
+            /* a resized or a noreuse zone is mapped anew */
+
             if (oshm_zone[i].shm.name.len == shm_zone[n].shm.name.len
+                && oshm_zone[i].shm.addr == shm_zone[n].shm.addr
                 && ngx_strncmp(oshm_zone[i].shm.name.data,
                                shm_zone[n].shm.name.data,
                                oshm_zone[i].shm.name.len)
@@ -964,7 +1025,7 @@ ngx_init_zone_pool(ngx_cycle_t *cycle, ngx_shm_zone_t *zn)
 
 #endif
 
-    if (ngx_shmtx_create(&sp->mutex, (void *) &sp->lock, file) != NGX_OK) {
+    if (ngx_shmtx_create(&sp->mutex, &sp->lock, file) != NGX_OK) {
         return NGX_ERROR;
     }
 
@@ -1328,6 +1389,7 @@ ngx_shared_memory_add(ngx_conf_t *cf, ngx_str_t *name, size_t size, void *tag)
     shm_zone->shm.exists = 0;
     shm_zone->init = NULL;
     shm_zone->tag = tag;
+    shm_zone->noreuse = 0;
 
     return shm_zone;
 }
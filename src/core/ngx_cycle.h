@@ -22,6 +22,10 @@
 #define NGX_DEBUG_POINTS_ABORT  2
 
 
+#define NGX_SHM_NUMA_DEFAULT     0
+#define NGX_SHM_NUMA_INTERLEAVE  1
+
+
 typedef struct ngx_shm_zone_s  ngx_shm_zone_t;
 
 typedef ngx_int_t (*ngx_shm_zone_init_pt) (ngx_shm_zone_t *zone, void *data);
@@ -31,6 +35,7 @@ struct ngx_shm_zone_s {
     ngx_shm_t                 shm;
     ngx_shm_zone_init_pt      init;
     void                     *tag;
+    ngx_uint_t                noreuse;  /* unsigned  noreuse:1; */
 };
 
 
@@ -72,6 +77,7 @@ struct ngx_cycle_s {
     ngx_list_t                open_files;	/*单链表容器，元素类型是ngx_open_file_t结构体，它表示Nginx已经打开的所有文件。事实上，Nginx框架不会向open_files链表中添加文件，
 											而是由对此感兴趣的模块向其中添加文件路径名，Nginx框架会在ngx_init_cycle方法中打开这些文件*/
     ngx_list_t                shared_memory; /*单链表容器，元素的类型是ngx_shm_zone_t结构体，每个元素表示一块共享内存*/
+    ngx_array_t               stat_counters; /*动态数组，元素类型是ngx_stat_counter_t，保存已注册的统计计数器，下标就是计数器的下标*/
 
     ngx_uint_t                connection_n;
     ngx_uint_t                files_n;			/*上面files数组元素总数*/
@@ -108,8 +114,12 @@ typedef struct {
 
      int                      priority;
 
+     ngx_uint_t               cpu_affinity_auto;
      ngx_uint_t               cpu_affinity_n;
-     u_long                  *cpu_affinity;
+     ngx_cpuset_t            *cpu_affinity;
+
+     ngx_uint_t               shm_numa;
+     ngx_uint_t               huge_pages;
 
      char                    *username;
      ngx_uid_t                user;
@@ -147,7 +157,7 @@ ngx_int_t ngx_signal_process(ngx_cycle_t *cycle, char *sig);
 void ngx_reopen_files(ngx_cycle_t *cycle, ngx_uid_t user);
 char **ngx_set_environment(ngx_cycle_t *cycle, ngx_uint_t *last);
 ngx_pid_t ngx_exec_new_binary(ngx_cycle_t *cycle, char *const *argv);
-u_long ngx_get_cpu_affinity(ngx_uint_t n);
+ngx_cpuset_t *ngx_get_cpu_affinity(ngx_uint_t n);
 ngx_shm_zone_t *ngx_shared_memory_add(ngx_conf_t *cf, ngx_str_t *name,
     size_t size, void *tag);
 
@@ -27,6 +27,13 @@ struct ngx_file_s {
     ngx_event_aio_t           *aio;
 #endif
 
+#if (NGX_THREAD_POOL)
+    /*把文件读取任务交给线程池的方法，以及它的上下文，由调用者设置*/
+    ngx_int_t                (*thread_handler)(ngx_thread_task_t *task,
+                                               ngx_file_t *file);
+    void                      *thread_ctx;
+#endif
+
     unsigned                   valid_info:1;
     unsigned                   directio:1;
 };
@@ -37,6 +44,7 @@ struct ngx_file_s {
 
 typedef time_t (*ngx_path_manager_pt) (void *data);
 typedef void (*ngx_path_loader_pt) (void *data);
+typedef void (*ngx_path_saver_pt) (void *data, ngx_uint_t clean);
 
 
 typedef struct {
@@ -46,6 +54,7 @@ typedef struct {
 
     ngx_path_manager_pt        manager;
     ngx_path_loader_pt         loader;
+    ngx_path_saver_pt          saver;
     void                      *data;
 
     u_char                    *conf_file;
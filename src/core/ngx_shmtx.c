@@ -9,13 +9,203 @@
 #include <ngx_core.h>
 
 
-#if (NGX_HAVE_ATOMIC_OPS)
+#if (NGX_HAVE_ATOMIC_OPS && NGX_HAVE_FUTEX)
+
+/*
+ * the lock word is 0 when the mutex is free, 1 when it is held,
+ * and 2 when it is held and there may be processes sleeping on it;
+ * futex() operates on 32-bit words, so the low half of the word is used
+ */
+
+#if (NGX_HAVE_LITTLE_ENDIAN)
+#define ngx_shmtx_futex_addr(lock)  ((uint32_t *) (lock))
+#else
+#define ngx_shmtx_futex_addr(lock)                                            \
+    ((uint32_t *) (lock) + sizeof(ngx_atomic_t) / sizeof(uint32_t) - 1)
+#endif
+
+
+static void ngx_shmtx_wait(ngx_shmtx_t *mtx);
+static void ngx_shmtx_wakeup(ngx_shmtx_t *mtx);
 
 
 ngx_int_t
-ngx_shmtx_create(ngx_shmtx_t *mtx, void *addr, u_char *name)
+ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
+{
+    mtx->sh = addr;
+    mtx->lock = &addr->lock;
+
+    if (mtx->spin == (ngx_uint_t) -1) {
+        return NGX_OK;
+    }
+
+    mtx->spin = 2048;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_shmtx_destory(ngx_shmtx_t *mtx)
+{
+}
+
+
+ngx_uint_t
+ngx_shmtx_trylock(ngx_shmtx_t *mtx)
+{
+    if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, 1)) {
+        mtx->sh->acquired++;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+void
+ngx_shmtx_lock(ngx_shmtx_t *mtx)
 {
-    mtx->lock = addr;
+    ngx_uint_t         i, n, spins, sleeps;
+    ngx_atomic_uint_t  val, own;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0, "shmtx lock");
+
+    /*
+     * a process that has slept once takes the lock as contended,
+     * otherwise other sleeping processes might never be woken up
+     */
+
+    own = 1;
+    spins = 0;
+    sleeps = 0;
+
+    for ( ;; ) {
+
+        if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, own)) {
+            break;
+        }
+
+        if (ngx_ncpu > 1) {
+
+            /*
+             * the spin is adaptive: the holder is usually running on
+             * another CPU and releases the lock soon, so the lock is polled
+             * with exponentially growing pauses before going to sleep
+             */
+
+            for (n = 1; n < mtx->spin; n <<= 1) {
+
+                for (i = 0; i < n; i++) {
+                    ngx_cpu_pause();
+                }
+
+                spins++;
+
+                if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, own)) {
+                    goto locked;
+                }
+            }
+        }
+
+        val = *mtx->lock;
+
+        if (val == 0) {
+            continue;
+        }
+
+        if (val == 1 && !ngx_atomic_cmp_set(mtx->lock, 1, 2)) {
+            continue;
+        }
+
+        sleeps++;
+        own = 2;
+
+        ngx_shmtx_wait(mtx);
+    }
+
+locked:
+
+    mtx->sh->acquired++;
+    mtx->sh->spins += spins;
+    mtx->sh->sleeps += sleeps;
+}
+
+
+void
+ngx_shmtx_unlock(ngx_shmtx_t *mtx)
+{
+    ngx_atomic_uint_t  old;
+
+    if (mtx->spin != (ngx_uint_t) -1) {
+        ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0, "shmtx unlock");
+    }
+
+    for ( ;; ) {
+        old = *mtx->lock;
+
+        if (ngx_atomic_cmp_set(mtx->lock, old, 0)) {
+            break;
+        }
+    }
+
+    if (old == 2) {
+        ngx_shmtx_wakeup(mtx);
+    }
+}
+
+
+static void
+ngx_shmtx_wait(ngx_shmtx_t *mtx)
+{
+    ngx_err_t  err;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0, "shmtx wait");
+
+    /* the shared mutex is used by different processes, so no FUTEX_PRIVATE */
+
+    if (syscall(SYS_futex, ngx_shmtx_futex_addr(mtx->lock), FUTEX_WAIT, 2,
+                NULL, NULL, 0)
+        == -1)
+    {
+        err = ngx_errno;
+
+        if (err != NGX_EAGAIN && err != NGX_EINTR) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, err,
+                          "futex(FUTEX_WAIT) failed while waiting on shmtx");
+            ngx_sched_yield();
+        }
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0, "shmtx awoke");
+}
+
+
+static void
+ngx_shmtx_wakeup(ngx_shmtx_t *mtx)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0, "shmtx wake");
+
+    /* only one waiter is woken up to avoid a thundering herd */
+
+    if (syscall(SYS_futex, ngx_shmtx_futex_addr(mtx->lock), FUTEX_WAKE, 1,
+                NULL, NULL, 0)
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "futex(FUTEX_WAKE) failed while wake shmtx");
+    }
+}
+
+
+#elif (NGX_HAVE_ATOMIC_OPS)
+
+
+ngx_int_t
+ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
+{
+    mtx->sh = addr;
+    mtx->lock = &addr->lock;
 
 	/*注意，当spin值为-1时，表示不能使用信号量，这时直接返回成功*/
     if (mtx->spin == (ngx_uint_t) -1) {
@@ -64,8 +254,14 @@ ngx_shmtx_trylock(ngx_shmtx_t *mtx)
 	/*取出lock锁的值，通过判断它是否为非负数来确定锁状态*/
     val = *mtx->lock;
 	/*如果val为0或者正数，则说明没有进程持有锁，这时调用ngx_atomic_cmp_set方法将lock锁改为负数，表示当前进程持有了互斥锁*/
-    return ((val & 0x80000000) == 0
-            && ngx_atomic_cmp_set(mtx->lock, val, val | 0x80000000));
+    if ((val & 0x80000000) == 0
+        && ngx_atomic_cmp_set(mtx->lock, val, val | 0x80000000))
+    {
+        mtx->sh->acquired++;
+        return 1;
+    }
+
+    return 0;
 }
 
 
@@ -75,9 +271,12 @@ ngx_shmtx_trylock(ngx_shmtx_t *mtx)
 void
 ngx_shmtx_lock(ngx_shmtx_t *mtx)
 {
-    ngx_uint_t         i, n;
+    ngx_uint_t         i, n, spins, sleeps;
     ngx_atomic_uint_t  val;
 
+    spins = 0;
+    sleeps = 0;
+
     ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0, "shmtx lock");
 	//没有拿到锁之前是不会跳出循环的
     for ( ;; ) {
@@ -89,7 +288,7 @@ ngx_shmtx_lock(ngx_shmtx_t *mtx)
             && ngx_atomic_cmp_set(mtx->lock, val, val | 0x80000000))
         {
         	/*在成功地将lock值由原先的val改为非负数后，表示成功地持有了锁，ngx_shmtx_lock方法结束*/
-            return;
+            goto locked;
         }
 		/*仅在多处理器状态下spin值才有意义，否则PAUSE指令是不会执行的*/
         if (ngx_ncpu > 1) {
@@ -100,12 +299,14 @@ ngx_shmtx_lock(ngx_shmtx_t *mtx)
                     ngx_cpu_pause();	// 对于多处理器系统，执行ngx_cpu_pause可以降低功耗
                 }
 
+                spins++;
+
                 val = *mtx->lock;
 
                 if ((val & 0x80000000) == 0
                     && ngx_atomic_cmp_set(mtx->lock, val, val | 0x80000000))
                 {
-                    return;
+                    goto locked;
                 }
             }
         }
@@ -130,6 +331,8 @@ ngx_shmtx_lock(ngx_shmtx_t *mtx)
                 ngx_log_debug1(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
                                "shmtx wait %XA", val);
 
+                sleeps++;
+
                 while (sem_wait(&mtx->sem) == -1) {
                     ngx_err_t  err;
 
@@ -153,6 +356,12 @@ ngx_shmtx_lock(ngx_shmtx_t *mtx)
 
         ngx_sched_yield();
     }
+
+locked:
+
+    mtx->sh->acquired++;
+    mtx->sh->spins += spins;
+    mtx->sh->sleeps += sleeps;
 }
 
 
@@ -199,8 +408,10 @@ ngx_shmtx_unlock(ngx_shmtx_t *mtx)
 
 /*ngx_shmtx_create方法需要确保ngx_shmtx_t结构体中的fd是可用的，它的成功执行是使用互斥锁的先决条件*/
 ngx_int_t
-ngx_shmtx_create(ngx_shmtx_t *mtx, void *addr, u_char *name)
+ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
 {
+    mtx->sh = addr;
+
     if (mtx->name) {
 
         if (ngx_strcmp(name, mtx->name) == 0) {
@@ -250,6 +461,7 @@ ngx_shmtx_trylock(ngx_shmtx_t *mtx)
     err = ngx_trylock_fd(mtx->fd);
 
     if (err == 0) {
+        mtx->sh->acquired++;
         return 1;
     }
 
@@ -279,6 +491,7 @@ ngx_shmtx_lock(ngx_shmtx_t *mtx)
     err = ngx_lock_fd(mtx->fd);
 
     if (err == 0) {
+        mtx->sh->acquired++;
         return;
     }
 
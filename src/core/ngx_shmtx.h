@@ -13,10 +13,19 @@
 #include <ngx_core.h>
 
 
+/*放在共享内存中的锁变量以及竞争统计，统计值只在持有锁时更新，所以不需要原子操作*/
+typedef struct {
+    ngx_atomic_t   lock;	//原子变量锁
+    ngx_atomic_t   acquired;	//成功获取锁的次数
+    ngx_atomic_t   spins;	//获取锁时自旋检查的次数
+    ngx_atomic_t   sleeps;	//获取锁时进入睡眠的次数
+} ngx_shmtx_sh_t;
+
+
 typedef struct {
 #if (NGX_HAVE_ATOMIC_OPS)
     ngx_atomic_t  *lock;	//原子变量锁
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_POSIX_SEM && !NGX_HAVE_FUTEX)
     ngx_uint_t     semaphore; //semaphore为1时表示获取锁将可能使用到的信号量
     sem_t          sem;	//sem就是信号量锁
 #endif
@@ -24,6 +33,7 @@ typedef struct {
     ngx_fd_t       fd;	//使用文件锁时fd表示使用的文件句柄
     u_char        *name;	//name表示文件名
 #endif
+    ngx_shmtx_sh_t *sh;	//指向共享内存中的锁变量和统计
     ngx_uint_t     spin;	//自旋次数，表示在自旋状态下等待其他处理器执行结果中释放锁的时间。由文件锁实现时，spin没有任何意义
 } ngx_shmtx_t;
 
@@ -32,10 +42,11 @@ typedef struct {
 
 /*通过封装文件锁和原子操作实现的5个高层次的互斥锁操作方法--------lgf6.8*/
 
-ngx_int_t ngx_shmtx_create(ngx_shmtx_t *mtx, void *addr, u_char *name);
+ngx_int_t ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr,
+    u_char *name);
 /*初始化互斥锁：
-  参数mtx 表示要操作的ngx_shmtx_t 类型的互斥锁; 但互斥锁由原子变量实现时参数addr表示要操作的
-  原子变量锁，当互斥锁由文件实现时参数addr没有任何意义。参数name仅当互斥锁由文件实现时才有意义
+  参数mtx 表示要操作的ngx_shmtx_t 类型的互斥锁; 参数addr指向共享内存中的锁变量和竞争统计，
+  当互斥锁由文件实现时只使用其中的统计。参数name仅当互斥锁由文件实现时才有意义
   它表示文件所在路径和文件名
 */
 
@@ -0,0 +1,153 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+ngx_atomic_t      *ngx_stat_counters;
+
+static ngx_shm_t   ngx_stat_shm;
+static ngx_uint_t  ngx_stat_columns;
+static size_t      ngx_stat_row_size;
+
+
+ngx_int_t
+ngx_stat_counter_index(ngx_cycle_t *cycle, ngx_str_t *name, ngx_uint_t gauge)
+{
+    ngx_uint_t           i;
+    ngx_stat_counter_t  *counter;
+
+    counter = cycle->stat_counters.elts;
+
+    for (i = 0; i < cycle->stat_counters.nelts; i++) {
+        if (name->len == counter[i].name.len
+            && ngx_strncmp(name->data, counter[i].name.data, name->len) == 0)
+        {
+            return i;
+        }
+    }
+
+    counter = ngx_array_push(&cycle->stat_counters);
+    if (counter == NULL) {
+        return NGX_ERROR;
+    }
+
+    counter->name.len = name->len;
+    counter->name.data = ngx_pstrdup(cycle->pool, name);
+    if (counter->name.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    counter->gauge = gauge;
+
+    return i;
+}
+
+
+ngx_int_t
+ngx_stat_init(ngx_cycle_t *cycle)
+{
+    size_t               cl, row;
+    ngx_uint_t           n, s, i;
+    ngx_shm_t            shm;
+    ngx_atomic_t        *from, *to;
+    ngx_stat_counter_t  *counter;
+
+    n = cycle->stat_counters.nelts;
+
+    /*
+     * the counters keep their indexes over reconfigurations,
+     * so the zone is reallocated only if new counters were added
+     */
+
+    if (n <= ngx_stat_columns) {
+        return NGX_OK;
+    }
+
+    /* cl should be equal or bigger than cache line size */
+
+    cl = 128;
+
+    row = ngx_align(n * sizeof(ngx_atomic_t), cl);
+
+    shm.size = row * NGX_MAX_PROCESSES;
+    shm.name.len = sizeof("nginx_stat_zone");
+    shm.name.data = (u_char *) "nginx_stat_zone";
+    shm.log = cycle->log;
+    shm.huge_pages = NGX_HUGE_PAGES_OFF;
+
+    if (ngx_shm_alloc(&shm) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * old worker processes continue to update the previous zone,
+     * their updates made after this point are lost; so only the counters
+     * are copied, while the gauges start from zero, as the old processes
+     * would never decrement them in the new zone
+     */
+
+    if (ngx_stat_shm.addr) {
+        counter = cycle->stat_counters.elts;
+
+        for (s = 0; s < NGX_MAX_PROCESSES; s++) {
+            from = (ngx_atomic_t *) (ngx_stat_shm.addr + s * ngx_stat_row_size);
+            to = (ngx_atomic_t *) (shm.addr + s * row);
+
+            for (i = 0; i < ngx_stat_columns; i++) {
+                if (!counter[i].gauge) {
+                    to[i] = from[i];
+                }
+            }
+        }
+
+        ngx_shm_free(&ngx_stat_shm);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, cycle->log, 0,
+                   "stat zone: %ui counters, row size %uz", n, row);
+
+    ngx_stat_shm = shm;
+    ngx_stat_columns = n;
+    ngx_stat_row_size = row;
+
+    ngx_stat_counters = (ngx_atomic_t *) shm.addr;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_stat_init_process(void)
+{
+    if (ngx_stat_shm.addr == NULL) {
+        return;
+    }
+
+    ngx_stat_counters = (ngx_atomic_t *)
+                        (ngx_stat_shm.addr + ngx_process_slot * ngx_stat_row_size);
+}
+
+
+ngx_atomic_int_t
+ngx_stat_value(ngx_uint_t index)
+{
+    u_char            *p;
+    ngx_uint_t         s;
+    ngx_atomic_int_t   value;
+
+    value = 0;
+    p = ngx_stat_shm.addr;
+
+    for (s = 0; s < NGX_MAX_PROCESSES; s++) {
+        value += ((ngx_atomic_int_t *) p)[index];
+        p += ngx_stat_row_size;
+    }
+
+    return value;
+}
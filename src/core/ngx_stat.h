@@ -0,0 +1,48 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_STAT_H_INCLUDED_
+#define _NGX_STAT_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+/*
+ * 每个进程在共享内存中拥有一行按缓存行对齐的计数器，进程只修改自己那一行，
+ * 所以更新时既不需要原子操作，也不会在CPU之间来回迁移缓存行；读取时才把所有
+ * 进程的行加起来
+ */
+
+typedef struct {
+    ngx_str_t    name;
+    ngx_uint_t   gauge;  /*为1时是当前值（如活跃连接数），而不是累计值*/
+} ngx_stat_counter_t;
+
+
+ngx_int_t ngx_stat_counter_index(ngx_cycle_t *cycle, ngx_str_t *name,
+    ngx_uint_t gauge);
+/*在解析配置时注册一个名为name的计数器，返回它的下标，同名的计数器只注册一次*/
+
+ngx_int_t ngx_stat_init(ngx_cycle_t *cycle);
+/*由master进程在所有计数器注册完毕后调用，分配存放计数器的共享内存*/
+
+void ngx_stat_init_process(void);
+/*工作进程启动时调用，根据ngx_process_slot选择当前进程使用的那一行*/
+
+ngx_atomic_int_t ngx_stat_value(ngx_uint_t index);
+/*汇总所有进程中下标为index的计数器*/
+
+
+#define ngx_stat_add(index, n)  ngx_stat_counters[index] += (n)
+
+
+extern ngx_atomic_t  *ngx_stat_counters;
+
+
+#endif /* _NGX_STAT_H_INCLUDED_ */
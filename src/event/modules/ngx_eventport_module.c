@@ -141,6 +141,7 @@ ngx_event_module_t  ngx_eventport_module_ctx = {
         ngx_eventport_del_event,           /* disable an event */
         NULL,                              /* add an connection */
         NULL,                              /* delete an connection */
+        NULL,                              /* trigger a notify */
         NULL,                              /* process the changes */
         ngx_eventport_process_events,      /* process the events */
         ngx_eventport_init,                /* init the events */
@@ -518,7 +519,7 @@ ngx_eventport_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
                     ngx_locked_post_event(rev, queue);
 
                 } else {
-                    rev->handler(rev);
+                    ngx_event_call_handler(rev);
 
                     if (ev->closed) {
                         continue;
@@ -555,7 +556,7 @@ ngx_eventport_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
                     ngx_locked_post_event(wev, &ngx_posted_events);
 
                 } else {
-                    wev->handler(wev);
+                    ngx_event_call_handler(wev);
                 }
             }
 
@@ -0,0 +1,914 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * The module uses multishot IORING_OP_POLL_ADD requests, one per connection
+ * direction, so it has the same edge-triggered semantics as epoll and needs
+ * no changes in the i/o handlers.  All poll changes and the file AIO reads
+ * are only queued in the submission ring and are passed to the kernel
+ * together with waiting for completions by a single io_uring_enter()
+ * in every event loop iteration.
+ *
+ * The completion user data is the connection pointer with the instance
+ * bit, the write direction bit, and the poll generation in the high bits.
+ * The generation of the armed poll is kept in the event index, so
+ * the completions of the already removed polls are easily skipped.
+ * The AIO completions have the event pointer with the AIO bit.
+ */
+
+#define NGX_IOURING_WRITE       2
+#define NGX_IOURING_AIO         4
+#define NGX_IOURING_PTR_MASK    0x0000fffffffffff8ULL
+#define NGX_IOURING_GEN_SHIFT   48
+#define NGX_IOURING_GEN_MASK    0xffff
+
+
+#define NGX_IOURING_FEATURES                                                  \
+    (IORING_FEAT_SINGLE_MMAP|IORING_FEAT_NODROP|IORING_FEAT_EXT_ARG           \
+     |IORING_FEAT_RSRC_TAGS)
+
+
+typedef struct {
+    ngx_uint_t  entries;
+} ngx_iouring_conf_t;
+
+
+static ngx_int_t ngx_iouring_init(ngx_cycle_t *cycle, ngx_msec_t timer);
+static ngx_int_t ngx_iouring_setup_rings(ngx_cycle_t *cycle,
+    ngx_iouring_conf_t *iocf);
+static void ngx_iouring_done(ngx_cycle_t *cycle);
+static ngx_int_t ngx_iouring_add_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_iouring_del_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_iouring_add_connection(ngx_connection_t *c);
+static ngx_int_t ngx_iouring_del_connection(ngx_connection_t *c,
+    ngx_uint_t flags);
+static ngx_int_t ngx_iouring_process_events(ngx_cycle_t *cycle,
+    ngx_msec_t timer, ngx_uint_t flags);
+
+#if (NGX_THREAD_POOL)
+static ngx_int_t ngx_iouring_notify_init(ngx_log_t *log);
+static void ngx_iouring_notify_handler(ngx_event_t *ev);
+static ngx_int_t ngx_iouring_notify(ngx_event_handler_pt handler);
+#endif
+
+static ngx_int_t ngx_iouring_poll_add(ngx_event_t *ev, ngx_uint_t write);
+static ngx_int_t ngx_iouring_poll_remove(ngx_event_t *ev, ngx_uint_t write);
+static struct io_uring_sqe *ngx_iouring_get_sqe(ngx_log_t *log);
+static ngx_int_t ngx_iouring_submit(ngx_log_t *log);
+
+static void *ngx_iouring_create_conf(ngx_cycle_t *cycle);
+static char *ngx_iouring_init_conf(ngx_cycle_t *cycle, void *conf);
+
+
+static int                     ring = -1;
+
+static void                   *ring_ptr;
+static size_t                  ring_size;
+static struct io_uring_sqe    *sqes;
+static size_t                  sqes_size;
+
+static volatile unsigned      *sq_head;
+static volatile unsigned      *sq_tail;
+static unsigned                sq_mask;
+static unsigned                sq_entries;
+static unsigned                sq_pending;
+
+static volatile unsigned      *cq_head;
+static volatile unsigned      *cq_tail;
+static unsigned                cq_mask;
+static struct io_uring_cqe    *cqes;
+
+static ngx_uint_t              poll_generation;
+
+#if (NGX_THREAD_POOL)
+static int                     notify_fd = -1;
+static ngx_event_t             notify_event;
+static ngx_connection_t        notify_conn;
+static ngx_event_handler_pt    notify_handler;
+#endif
+
+
+static ngx_str_t      iouring_name = ngx_string("io_uring");
+
+static ngx_command_t  ngx_iouring_commands[] = {
+
+    { ngx_string("io_uring_entries"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_iouring_conf_t, entries),
+      NULL },
+
+      ngx_null_command
+};
+
+
+ngx_event_module_t  ngx_iouring_module_ctx = {
+    &iouring_name,
+    ngx_iouring_create_conf,             /* create configuration */
+    ngx_iouring_init_conf,               /* init configuration */
+
+    {
+        ngx_iouring_add_event,           /* add an event */
+        ngx_iouring_del_event,           /* delete an event */
+        ngx_iouring_add_event,           /* enable an event */
+        ngx_iouring_del_event,           /* disable an event */
+        ngx_iouring_add_connection,      /* add an connection */
+        ngx_iouring_del_connection,      /* delete an connection */
+#if (NGX_THREAD_POOL)
+        ngx_iouring_notify,              /* trigger a notify */
+#else
+        NULL,                            /* trigger a notify */
+#endif
+        NULL,                            /* process the changes */
+        ngx_iouring_process_events,      /* process the events */
+        ngx_iouring_init,                /* init the events */
+        ngx_iouring_done,                /* done the events */
+    }
+};
+
+ngx_module_t  ngx_iouring_module = {
+    NGX_MODULE_V1,
+    &ngx_iouring_module_ctx,             /* module context */
+    ngx_iouring_commands,                /* module directives */
+    NGX_EVENT_MODULE,                    /* module type */
+    NULL,                                /* init master */
+    NULL,                                /* init module */
+    NULL,                                /* init process */
+    NULL,                                /* init thread */
+    NULL,                                /* exit thread */
+    NULL,                                /* exit process */
+    NULL,                                /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+/*
+ * We call io_uring_setup() and io_uring_enter() directly as syscalls
+ * to not depend on liburing.
+ */
+
+static int
+io_uring_setup(u_int entries, struct io_uring_params *p)
+{
+    return syscall(SYS_io_uring_setup, entries, p);
+}
+
+
+static int
+io_uring_enter(int fd, u_int to_submit, u_int min_complete, u_int flags,
+    void *arg, size_t argsz)
+{
+    return syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags,
+                   arg, argsz);
+}
+
+
+static ngx_int_t
+ngx_iouring_init(ngx_cycle_t *cycle, ngx_msec_t timer)
+{
+    ngx_iouring_conf_t  *iocf;
+
+    iocf = ngx_event_get_conf(cycle->conf_ctx, ngx_iouring_module);
+
+    if (ring == -1) {
+        if (ngx_iouring_setup_rings(cycle, iocf) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+#if (NGX_THREAD_POOL)
+        if (ngx_iouring_notify_init(cycle->log) != NGX_OK) {
+            ngx_iouring_done(cycle);
+            return NGX_ERROR;
+        }
+#endif
+    }
+
+    ngx_io = ngx_os_io;
+
+    ngx_event_actions = ngx_iouring_module_ctx.actions;
+
+    ngx_event_flags = NGX_USE_CLEAR_EVENT
+                      |NGX_USE_GREEDY_EVENT
+                      |NGX_USE_EPOLL_EVENT
+                      |NGX_USE_IOURING_EVENT;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_setup_rings(ngx_cycle_t *cycle, ngx_iouring_conf_t *iocf)
+{
+    u_char                  *p;
+    size_t                   size;
+    unsigned                *array, i;
+    struct io_uring_params   params;
+
+    ngx_memzero(&params, sizeof(struct io_uring_params));
+
+    ring = io_uring_setup(iocf->entries, &params);
+
+    if (ring == -1) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "io_uring_setup(%ui) failed", iocf->entries);
+        return NGX_ERROR;
+    }
+
+    if ((params.features & NGX_IOURING_FEATURES) != NGX_IOURING_FEATURES) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "io_uring features 0x%xD are not sufficient, "
+                      "at least Linux 5.13 is required", params.features);
+        goto failed;
+    }
+
+    ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size = params.cq_off.cqes
+           + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (ring_size < size) {
+        ring_size = size;
+    }
+
+    ring_ptr = mmap(NULL, ring_size, PROT_READ|PROT_WRITE,
+                    MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+
+    if (ring_ptr == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQ_RING) failed");
+        ring_ptr = NULL;
+        goto failed;
+    }
+
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    sqes = mmap(NULL, sqes_size, PROT_READ|PROT_WRITE,
+                MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQES);
+
+    if (sqes == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQES) failed");
+        sqes = NULL;
+        goto failed;
+    }
+
+    p = ring_ptr;
+
+    sq_head = (unsigned *) (p + params.sq_off.head);
+    sq_tail = (unsigned *) (p + params.sq_off.tail);
+    sq_mask = *(unsigned *) (p + params.sq_off.ring_mask);
+    sq_entries = *(unsigned *) (p + params.sq_off.ring_entries);
+    sq_pending = 0;
+
+    /* the submission queue entries are always used in order */
+
+    array = (unsigned *) (p + params.sq_off.array);
+
+    for (i = 0; i < sq_entries; i++) {
+        array[i] = i;
+    }
+
+    cq_head = (unsigned *) (p + params.cq_off.head);
+    cq_tail = (unsigned *) (p + params.cq_off.tail);
+    cq_mask = *(unsigned *) (p + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *) (p + params.cq_off.cqes);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring: fd:%d sq:%ud cq:%ud",
+                   ring, params.sq_entries, params.cq_entries);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_iouring_done(cycle);
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_iouring_done(ngx_cycle_t *cycle)
+{
+    if (sqes) {
+        if (munmap(sqes, sqes_size) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "munmap(IORING_OFF_SQES) failed");
+        }
+
+        sqes = NULL;
+    }
+
+    if (ring_ptr) {
+        if (munmap(ring_ptr, ring_size) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "munmap(IORING_OFF_SQ_RING) failed");
+        }
+
+        ring_ptr = NULL;
+    }
+
+    if (close(ring) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ring = -1;
+    sq_pending = 0;
+
+#if (NGX_THREAD_POOL)
+
+    if (notify_fd != -1) {
+        if (close(notify_fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "eventfd close() failed");
+        }
+
+        notify_fd = -1;
+    }
+
+#endif
+}
+
+
+#if (NGX_THREAD_POOL)
+
+static ngx_int_t
+ngx_iouring_notify_init(ngx_log_t *log)
+{
+    notify_fd = syscall(SYS_eventfd, 0);
+
+    if (notify_fd == -1) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno, "eventfd() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "notify eventfd: %d", notify_fd);
+
+    notify_event.data = &notify_conn;
+    notify_event.handler = ngx_iouring_notify_handler;
+    notify_event.log = log;
+
+    notify_conn.fd = notify_fd;
+    notify_conn.read = &notify_event;
+    notify_conn.log = log;
+
+    return ngx_iouring_add_event(&notify_event, NGX_READ_EVENT, 0);
+}
+
+
+static void
+ngx_iouring_notify_handler(ngx_event_t *ev)
+{
+    ssize_t    n;
+    uint64_t   count;
+    ngx_err_t  err;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0, "notify event");
+
+    /* the poll reports every write, so the counter is read rarely */
+
+    if (++notify_conn.number == NGX_MAX_UINT32_VALUE) {
+        notify_conn.number = 0;
+
+        n = read(notify_fd, &count, sizeof(uint64_t));
+
+        err = ngx_errno;
+
+        if ((size_t) n != sizeof(uint64_t)) {
+            ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                          "read() eventfd %d failed", notify_fd);
+        }
+    }
+
+    notify_handler(ev);
+}
+
+
+static ngx_int_t
+ngx_iouring_notify(ngx_event_handler_pt handler)
+{
+    static uint64_t inc = 1;
+
+    notify_handler = handler;
+
+    if ((size_t) write(notify_fd, &inc, sizeof(uint64_t)) != sizeof(uint64_t))
+    {
+        ngx_log_error(NGX_LOG_ALERT, notify_event.log, ngx_errno,
+                      "write() to eventfd %d failed", notify_fd);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_iouring_add_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    if (ev->active) {
+        return NGX_OK;
+    }
+
+    /*
+     * a multishot poll reports only the readiness changes, so it is used
+     * for the edge-triggered events only; the level-triggered events,
+     * e.g. of the listening sockets, use a one-shot poll that is rearmed
+     * after every completion
+     */
+
+    ev->oneshot = (flags & NGX_CLEAR_EVENT) ? 0 : 1;
+
+    if (ngx_iouring_poll_add(ev, event != NGX_READ_EVENT) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ev->active = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_del_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    /*
+     * the poll request holds a reference to the file, so unlike epoll
+     * it must be removed explicitly even if the descriptor is being closed
+     */
+
+    if (!ev->active) {
+        return NGX_OK;
+    }
+
+    ev->active = 0;
+
+    return ngx_iouring_poll_remove(ev, event != NGX_READ_EVENT);
+}
+
+
+static ngx_int_t
+ngx_iouring_add_connection(ngx_connection_t *c)
+{
+    if (ngx_iouring_add_event(c->read, NGX_READ_EVENT, NGX_CLEAR_EVENT)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    return ngx_iouring_add_event(c->write, NGX_WRITE_EVENT, NGX_CLEAR_EVENT);
+}
+
+
+static ngx_int_t
+ngx_iouring_del_connection(ngx_connection_t *c, ngx_uint_t flags)
+{
+    if (ngx_iouring_del_event(c->read, NGX_READ_EVENT, flags) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return ngx_iouring_del_event(c->write, NGX_WRITE_EVENT, flags);
+}
+
+
+static ngx_int_t
+ngx_iouring_poll_add(ngx_event_t *ev, ngx_uint_t write)
+{
+    uint32_t              events;
+    ngx_connection_t     *c;
+    struct io_uring_sqe  *sqe;
+
+    c = ev->data;
+
+    sqe = ngx_iouring_get_sqe(ev->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    poll_generation = (poll_generation + 1) & NGX_IOURING_GEN_MASK;
+    ev->index = poll_generation;
+
+    events = write ? POLLOUT : POLLIN;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = c->fd;
+    sqe->len = ev->oneshot ? 0 : IORING_POLL_ADD_MULTI;
+
+#if (NGX_HAVE_LITTLE_ENDIAN)
+    sqe->poll32_events = events;
+#else
+    sqe->poll32_events = (events << 16) | (events >> 16);
+#endif
+
+    sqe->user_data = (uint64_t) (uintptr_t) c
+                     | ev->instance
+                     | (write ? NGX_IOURING_WRITE : 0)
+                     | ((uint64_t) ev->index << NGX_IOURING_GEN_SHIFT);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring poll add: fd:%d ev:%04XD gen:%ui",
+                   c->fd, events, ev->index);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_poll_remove(ngx_event_t *ev, ngx_uint_t write)
+{
+    ngx_connection_t     *c;
+    struct io_uring_sqe  *sqe;
+
+    c = ev->data;
+
+    sqe = ngx_iouring_get_sqe(ev->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t) (uintptr_t) c
+                | ev->instance
+                | (write ? NGX_IOURING_WRITE : 0)
+                | ((uint64_t) ev->index << NGX_IOURING_GEN_SHIFT);
+
+    /* the completion of the removal itself is ignored */
+
+    sqe->user_data = 0;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring poll remove: fd:%d w:%ui gen:%ui",
+                   c->fd, write, ev->index);
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HAVE_FILE_AIO)
+
+ngx_int_t
+ngx_iouring_aio_read(ngx_event_t *ev, ngx_fd_t fd, u_char *buf, size_t size,
+    off_t offset)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe(ev->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = (uint64_t) (uintptr_t) ev | NGX_IOURING_AIO;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring read: fd:%d @%O:%uz", fd, offset, size);
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static struct io_uring_sqe *
+ngx_iouring_get_sqe(ngx_log_t *log)
+{
+    unsigned              tail;
+    struct io_uring_sqe  *sqe;
+
+    if (ring == -1) {
+        return NULL;
+    }
+
+    if (sq_pending == sq_entries) {
+
+        /* the submission ring is full, pass the queued entries right now */
+
+        if (ngx_iouring_submit(log) != NGX_OK) {
+            return NULL;
+        }
+    }
+
+    tail = *sq_tail + sq_pending;
+
+    sqe = &sqes[tail & sq_mask];
+    ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+    sq_pending++;
+
+    return sqe;
+}
+
+
+static void
+ngx_iouring_commit_sqes(void)
+{
+    if (sq_pending == 0) {
+        return;
+    }
+
+    /* the entries must be visible to kernel before the tail update */
+
+    ngx_memory_barrier();
+
+    *sq_tail += sq_pending;
+    sq_pending = 0;
+
+    ngx_memory_barrier();
+}
+
+
+static ngx_int_t
+ngx_iouring_submit(ngx_log_t *log)
+{
+    int        n;
+    unsigned   queued;
+    ngx_err_t  err;
+
+    ngx_iouring_commit_sqes();
+
+    queued = *sq_tail - *sq_head;
+
+    while (queued) {
+
+        n = io_uring_enter(ring, queued, 0, 0, NULL, 0);
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            ngx_log_error(NGX_LOG_ALERT, log, err, "io_uring_enter() failed");
+            return NGX_ERROR;
+        }
+
+        queued = *sq_tail - *sq_head;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
+    ngx_uint_t flags)
+{
+    int                             n;
+    unsigned                        head, tail, submit, wait;
+    uint32_t                        revents;
+    uint64_t                        data;
+    ngx_int_t                       instance, write;
+    ngx_uint_t                      level, events;
+    ngx_err_t                       err;
+    ngx_event_t                    *ev, **queue;
+    ngx_connection_t               *c;
+    struct __kernel_timespec        ts;
+    struct io_uring_cqe            *cqe;
+    struct io_uring_getevents_arg   arg;
+
+#if (NGX_HAVE_FILE_AIO)
+    ngx_event_aio_t                *aio;
+#endif
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring timer: %M", timer);
+
+    ngx_iouring_commit_sqes();
+
+    submit = *sq_tail - *sq_head;
+
+    ngx_memzero(&arg, sizeof(struct io_uring_getevents_arg));
+
+    if (timer != NGX_TIMER_INFINITE) {
+        ts.tv_sec = timer / 1000;
+        ts.tv_nsec = (timer % 1000) * 1000000;
+        arg.ts = (uint64_t) (uintptr_t) &ts;
+    }
+
+    wait = (timer == 0) ? 0 : 1;
+
+    n = io_uring_enter(ring, submit, wait,
+                       IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG,
+                       &arg, sizeof(struct io_uring_getevents_arg));
+
+    err = (n == -1) ? ngx_errno : 0;
+
+    if (flags & NGX_UPDATE_TIME || ngx_event_timer_alarm) {
+        ngx_time_update();
+    }
+
+    if (err && err != ETIME && err != NGX_EBUSY && err != NGX_EAGAIN) {
+        if (err == NGX_EINTR) {
+
+            if (ngx_event_timer_alarm) {
+                ngx_event_timer_alarm = 0;
+                return NGX_OK;
+            }
+
+            level = NGX_LOG_INFO;
+
+        } else {
+            level = NGX_LOG_ALERT;
+        }
+
+        ngx_log_error(level, cycle->log, err, "io_uring_enter() failed");
+        return NGX_ERROR;
+    }
+
+    head = *cq_head;
+
+    ngx_memory_barrier();
+
+    tail = *cq_tail;
+
+    if (head == tail) {
+        if (timer != NGX_TIMER_INFINITE) {
+            return NGX_OK;
+        }
+
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                      "io_uring_enter() returned no events without timeout");
+        return NGX_ERROR;
+    }
+
+    events = 0;
+
+    ngx_mutex_lock(ngx_posted_events_mutex);
+
+    for ( /* void */ ; head != tail; head++) {
+
+        cqe = &cqes[head & cq_mask];
+        data = cqe->user_data;
+
+        events++;
+
+        if (data == 0) {
+
+            /* the completion of a poll removal */
+
+            if (cqe->res < 0 && cqe->res != -ENOENT && cqe->res != -EALREADY)
+            {
+                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, -cqe->res,
+                               "io_uring poll remove failed: %d", cqe->res);
+            }
+
+            continue;
+        }
+
+#if (NGX_HAVE_FILE_AIO)
+
+        if (data & NGX_IOURING_AIO) {
+            ev = (ngx_event_t *) (uintptr_t) (data & ~(uint64_t) 7);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring read complete: %p %d", ev, cqe->res);
+
+            ev->complete = 1;
+            ev->active = 0;
+            ev->ready = 1;
+
+            aio = ev->data;
+            aio->res = cqe->res;
+
+            ngx_locked_post_event(ev, &ngx_posted_events);
+
+            continue;
+        }
+
+#endif
+
+        instance = data & 1;
+        write = data & NGX_IOURING_WRITE;
+
+        c = (ngx_connection_t *) (uintptr_t) (data & NGX_IOURING_PTR_MASK);
+
+        ev = write ? c->write : c->read;
+
+        if (c->fd == -1
+            || ev->instance != instance
+            || !ev->active
+            || ev->index != (data >> NGX_IOURING_GEN_SHIFT))
+        {
+            /*
+             * the stale event from a file descriptor that was
+             * just closed in this iteration or from a removed poll
+             */
+
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring: stale event %p", c);
+            continue;
+        }
+
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+
+            /*
+             * the one-shot poll has completed, or the multishot poll
+             * was terminated by kernel, rearm it
+             */
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring poll terminated: fd:%d res:%d",
+                           c->fd, cqe->res);
+
+            if (ngx_iouring_poll_add(ev, write) != NGX_OK) {
+                ngx_mutex_unlock(ngx_posted_events_mutex);
+                return NGX_ERROR;
+            }
+
+            if (cqe->res == -ECANCELED) {
+                continue;
+            }
+        }
+
+        revents = (cqe->res < 0) ? POLLERR : (uint32_t) cqe->res;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: fd:%d ev:%04XD d:%p", c->fd, revents, c);
+
+        if (revents & (POLLERR|POLLHUP)) {
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring poll error on fd:%d ev:%04XD",
+                           c->fd, revents);
+        }
+
+        if ((flags & NGX_POST_THREAD_EVENTS) && !(ev->accept || write)) {
+            ev->posted_ready = 1;
+
+        } else if ((flags & NGX_POST_THREAD_EVENTS) && write) {
+            ev->posted_ready = 1;
+
+        } else {
+            ev->ready = 1;
+        }
+
+        if (flags & NGX_POST_EVENTS) {
+            queue = (ngx_event_t **) (ev->accept ?
+                           &ngx_posted_accept_events : &ngx_posted_events);
+
+            ngx_locked_post_event(ev, queue);
+
+        } else {
+            ngx_event_call_handler(ev);
+        }
+    }
+
+    ngx_mutex_unlock(ngx_posted_events_mutex);
+
+    /* release the consumed completions to kernel */
+
+    ngx_memory_barrier();
+
+    *cq_head = tail;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring completions: %ui", events);
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_iouring_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_iouring_conf_t  *iocf;
+
+    iocf = ngx_palloc(cycle->pool, sizeof(ngx_iouring_conf_t));
+    if (iocf == NULL) {
+        return NULL;
+    }
+
+    iocf->entries = NGX_CONF_UNSET;
+
+    return iocf;
+}
+
+
+static char *
+ngx_iouring_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_iouring_conf_t *iocf = conf;
+
+    ngx_conf_init_uint_value(iocf->entries, 512);
+
+    return NGX_CONF_OK;
+}
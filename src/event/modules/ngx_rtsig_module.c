@@ -118,6 +118,7 @@ ngx_event_module_t  ngx_rtsig_module_ctx = {
         NULL,                            /* disable an event */
         ngx_rtsig_add_connection,        /* add an connection */
         ngx_rtsig_del_connection,        /* delete an connection */
+        NULL,                            /* trigger a notify */
         NULL,                            /* process the changes */
         ngx_rtsig_process_events,        /* process the events */
         ngx_rtsig_init,                  /* init the events */
@@ -398,7 +399,7 @@ ngx_rtsig_process_events(ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags)
                 ngx_locked_post_event(rev, queue);
 
             } else {
-                rev->handler(rev);
+                ngx_event_call_handler(rev);
             }
         }
 
@@ -412,7 +413,7 @@ ngx_rtsig_process_events(ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags)
                 ngx_locked_post_event(wev, &ngx_posted_events);
 
             } else {
-                wev->handler(wev);
+                ngx_event_call_handler(wev);
             }
         }
 
@@ -575,7 +576,7 @@ ngx_rtsig_process_overflow(ngx_cycle_t *cycle, ngx_msec_t timer,
                     ngx_locked_post_event(rev, queue);
 
                 } else {
-                    rev->handler(rev);
+                    ngx_event_call_handler(rev);
                 }
             }
 
@@ -600,7 +601,7 @@ ngx_rtsig_process_overflow(ngx_cycle_t *cycle, ngx_msec_t timer,
                     ngx_locked_post_event(wev, &ngx_posted_events);
 
                 } else {
-                    wev->handler(wev);
+                    ngx_event_call_handler(wev);
                 }
             }
         }
@@ -24,6 +24,7 @@ extern ngx_module_t ngx_select_module;
 static ngx_int_t ngx_event_module_init(ngx_cycle_t *cycle);
 static ngx_int_t ngx_event_process_init(ngx_cycle_t *cycle);
 static char *ngx_events_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_event_init_conf(ngx_cycle_t *cycle, void *conf);
 
 static char *ngx_event_connections(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -31,8 +32,8 @@ static char *ngx_event_use(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_event_debug_connection(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 
-static void *ngx_event_create_conf(ngx_cycle_t *cycle);
-static char *ngx_event_init_conf(ngx_cycle_t *cycle, void *conf);
+static void *ngx_event_core_create_conf(ngx_cycle_t *cycle);
+static char *ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf);
 
 
 static ngx_uint_t     ngx_timer_resolution;
@@ -60,18 +61,30 @@ ngx_file_t            ngx_accept_mutex_lock_file;
 
 #if (NGX_STAT_STUB)
 
-ngx_atomic_t   ngx_stat_accepted0;
-ngx_atomic_t  *ngx_stat_accepted = &ngx_stat_accepted0;
-ngx_atomic_t   ngx_stat_handled0;
-ngx_atomic_t  *ngx_stat_handled = &ngx_stat_handled0;
-ngx_atomic_t   ngx_stat_requests0;
-ngx_atomic_t  *ngx_stat_requests = &ngx_stat_requests0;
-ngx_atomic_t   ngx_stat_active0;
-ngx_atomic_t  *ngx_stat_active = &ngx_stat_active0;
-ngx_atomic_t   ngx_stat_reading0;
-ngx_atomic_t  *ngx_stat_reading = &ngx_stat_reading0;
-ngx_atomic_t   ngx_stat_writing0;
-ngx_atomic_t  *ngx_stat_writing = &ngx_stat_writing0;
+ngx_uint_t    ngx_stat_accepted;
+ngx_uint_t    ngx_stat_handled;
+ngx_uint_t    ngx_stat_requests;
+ngx_uint_t    ngx_stat_active;
+ngx_uint_t    ngx_stat_reading;
+ngx_uint_t    ngx_stat_writing;
+
+
+typedef struct {
+    ngx_str_t     name;
+    ngx_uint_t   *index;
+    ngx_uint_t    gauge;
+} ngx_event_stat_t;
+
+
+static ngx_event_stat_t  ngx_event_stats[] = {
+    { ngx_string("accepted"), &ngx_stat_accepted, 0 },
+    { ngx_string("handled"), &ngx_stat_handled, 0 },
+    { ngx_string("requests"), &ngx_stat_requests, 0 },
+    { ngx_string("active"), &ngx_stat_active, 1 },
+    { ngx_string("reading"), &ngx_stat_reading, 1 },
+    { ngx_string("writing"), &ngx_stat_writing, 1 },
+    { ngx_null_string, NULL, 0 }
+};
 
 #endif
 
@@ -93,7 +106,7 @@ static ngx_command_t  ngx_events_commands[] = {
 static ngx_core_module_t  ngx_events_module_ctx = {
     ngx_string("events"),
     NULL,
-    NULL
+    ngx_event_init_conf
 };
 
 
@@ -116,6 +129,14 @@ ngx_module_t  ngx_events_module = {
 static ngx_str_t  event_core_name = ngx_string("event_core");
 
 
+static ngx_conf_enum_t  ngx_multi_accept[] = {
+    { ngx_string("off"), NGX_MULTI_ACCEPT_OFF },
+    { ngx_string("on"), NGX_MULTI_ACCEPT_ON },
+    { ngx_string("auto"), NGX_MULTI_ACCEPT_AUTO },
+    { ngx_null_string, 0 }
+};
+
+
 static ngx_command_t  ngx_event_core_commands[] = {
 
     { ngx_string("worker_connections"),
@@ -142,11 +163,11 @@ static ngx_command_t  ngx_event_core_commands[] = {
     /*确定选择哪一个事件模块作为事件驱动机制*/
 
     { ngx_string("multi_accept"),
-      NGX_EVENT_CONF|NGX_CONF_FLAG,
-      ngx_conf_set_flag_slot,
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
       0,
       offsetof(ngx_event_conf_t, multi_accept),
-      NULL },
+      &ngx_multi_accept },
       /*对应于事件结构体的available字段。对于epoll事件驱动模式来说，意味着在接收到一个新连接事件时，调用
 		accept以尽可能多地接收连接*/
 
@@ -165,6 +186,38 @@ static ngx_command_t  ngx_event_core_commands[] = {
       offsetof(ngx_event_conf_t, accept_mutex_delay),
       NULL },
 	/*启用accept_mutex负载均衡锁后，延迟accept_mutex_delay毫秒后再试图处理新连接事件*/
+    { ngx_string("timer_wheel"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_event_conf_t, timer_wheel),
+      NULL },
+    /*用分层时间轮代替红黑树管理定时器，插入和删除都是O(1)*/
+
+    { ngx_string("timer_wheel_resolution"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      0,
+      offsetof(ngx_event_conf_t, timer_wheel_resolution),
+      NULL },
+    /*时间轮每一格的时间精度，定时器最多会延迟这么长时间触发*/
+
+    { ngx_string("loop_stats"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_event_conf_t, loop_stats),
+      NULL },
+    /*统计每轮事件循环的耗时、事件个数和处理post事件队列的耗时*/
+
+    { ngx_string("slow_handler_log"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      0,
+      offsetof(ngx_event_conf_t, slow_handler_log),
+      NULL },
+    /*记录耗时超过该值的事件回调方法，0表示不记录*/
+
     { ngx_string("debug_connection"),
       NGX_EVENT_CONF|NGX_CONF_TAKE1,
       ngx_event_debug_connection,
@@ -179,10 +232,10 @@ static ngx_command_t  ngx_event_core_commands[] = {
 
 ngx_event_module_t  ngx_event_core_module_ctx = {
     &event_core_name,
-    ngx_event_create_conf,                 /* create configuration */
-    ngx_event_init_conf,                   /* init configuration */
+    ngx_event_core_create_conf,            /* create configuration */
+    ngx_event_core_init_conf,              /* init configuration */
 
-    { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL }
+    { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
 
@@ -291,6 +344,10 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)
             ngx_event_process_posted(cycle, &ngx_posted_events);
         }
     }
+
+    if (ngx_event_timing) {
+        ngx_event_loop_account();
+    }
 }
 
 /*	将读事件添加到事件驱动模块中
@@ -504,6 +561,9 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     }
 #endif /* !(NGX_WIN32) */
 
+    if (ngx_stat_init(cycle) != NGX_OK) {
+        return NGX_ERROR;
+    }
 
     if (ccf->master == 0) {
         return NGX_OK;
@@ -528,17 +588,6 @@ ngx_event_module_init(ngx_cycle_t *cycle)
            + cl          /* ngx_connection_counter */
            + cl;         /* ngx_temp_number */
 
-#if (NGX_STAT_STUB)
-
-    size += cl           /* ngx_stat_accepted */
-           + cl          /* ngx_stat_handled */
-           + cl          /* ngx_stat_requests */
-           + cl          /* ngx_stat_active */
-           + cl          /* ngx_stat_reading */
-           + cl;         /* ngx_stat_writing */
-
-#endif
-
 
 
 
@@ -546,6 +595,7 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     shm.name.len = sizeof("nginx_shared_zone");
     shm.name.data = (u_char *) "nginx_shared_zone";
     shm.log = cycle->log;
+    shm.huge_pages = NGX_HUGE_PAGES_OFF;
 
     if (ngx_shm_alloc(&shm) != NGX_OK) {
         return NGX_ERROR;
@@ -556,7 +606,8 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     ngx_accept_mutex_ptr = (ngx_atomic_t *) shared;
     ngx_accept_mutex.spin = (ngx_uint_t) -1;
 
-    if (ngx_shmtx_create(&ngx_accept_mutex, shared, cycle->lock_file.data)
+    if (ngx_shmtx_create(&ngx_accept_mutex, (ngx_shmtx_sh_t *) shared,
+                         cycle->lock_file.data)
         != NGX_OK)
     {
         return NGX_ERROR;
@@ -576,17 +627,6 @@ ngx_event_module_init(ngx_cycle_t *cycle)
 
     ngx_random_number = (tp->msec << 16) + ngx_pid;
 
-#if (NGX_STAT_STUB)
-
-    ngx_stat_accepted = (ngx_atomic_t *) (shared + 3 * cl);
-    ngx_stat_handled = (ngx_atomic_t *) (shared + 4 * cl);
-    ngx_stat_requests = (ngx_atomic_t *) (shared + 5 * cl);
-    ngx_stat_active = (ngx_atomic_t *) (shared + 6 * cl);
-    ngx_stat_reading = (ngx_atomic_t *) (shared + 7 * cl);
-    ngx_stat_writing = (ngx_atomic_t *) (shared + 8 * cl);
-
-#endif
-
     return NGX_OK;
 }
 
@@ -633,13 +673,38 @@ ngx_event_process_init(ngx_cycle_t *cycle)
         ngx_use_accept_mutex = 0;
     }
 
+#if (NGX_HAVE_REUSEPORT)
+
+    /* the accept mutex is useless if every socket has its own worker */
+
+    if (ngx_use_accept_mutex) {
+        ls = cycle->listening.elts;
+        for (i = 0; i < cycle->listening.nelts; i++) {
+            if (!ls[i].reuseport) {
+                break;
+            }
+        }
+
+        if (i == cycle->listening.nelts) {
+            ngx_use_accept_mutex = 0;
+        }
+    }
+
+#endif
+
+    ngx_stat_init_process();
+
+    ngx_event_loop_init_process(cycle, ecf);
+
 #if (NGX_THREADS)
     ngx_posted_events_mutex = ngx_mutex_init(cycle->log, 0);
     if (ngx_posted_events_mutex == NULL) {
         return NGX_ERROR;
     }
 #endif
-	/*初始化红黑树实现的定时器*/
+	/*初始化红黑树或者时间轮实现的定时器*/
+    ngx_event_timer_wheel = ecf->timer_wheel ? ecf->timer_wheel_resolution : 0;
+
     if (ngx_event_timer_init(cycle->log) == NGX_ERROR) {
         return NGX_ERROR;
     }
@@ -721,15 +786,17 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 #endif
 	// 预分配连接池
     cycle->connections =
-        ngx_alloc(sizeof(ngx_connection_t) * cycle->connection_n, cycle->log);
+        ngx_huge_alloc(sizeof(ngx_connection_t) * cycle->connection_n,
+                       ccf->huge_pages, cycle->log);
     if (cycle->connections == NULL) {
         return NGX_ERROR;
     }
 
     c = cycle->connections;
 	//预分配ngx_event_t事件数组作为读事件池
-    cycle->read_events = ngx_alloc(sizeof(ngx_event_t) * cycle->connection_n,
-                                   cycle->log);
+    cycle->read_events = ngx_huge_alloc(sizeof(ngx_event_t)
+                                      * cycle->connection_n,
+                                      ccf->huge_pages, cycle->log);
     if (cycle->read_events == NULL) {
         return NGX_ERROR;
     }
@@ -744,8 +811,9 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 #endif
     }
 	//预分配ngx_event_t事件数组作为写事件池
-    cycle->write_events = ngx_alloc(sizeof(ngx_event_t) * cycle->connection_n,
-                                    cycle->log);
+    cycle->write_events = ngx_huge_alloc(sizeof(ngx_event_t)
+                                       * cycle->connection_n,
+                                       ccf->huge_pages, cycle->log);
     if (cycle->write_events == NULL) {
         return NGX_ERROR;
     }
@@ -787,6 +855,12 @@ ngx_event_process_init(ngx_cycle_t *cycle)
     ls = cycle->listening.elts;
     for (i = 0; i < cycle->listening.nelts; i++) {
 
+#if (NGX_HAVE_REUSEPORT)
+        if (ls[i].reuseport && ls[i].worker != ngx_worker) {
+            continue;
+        }
+#endif
+
         c = ngx_get_connection(ls[i].fd, cycle->log);
 
         if (c == NULL) {
@@ -867,9 +941,15 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 
         rev->handler = ngx_event_accept;
 
+#if (NGX_HAVE_REUSEPORT)
+        if (ngx_use_accept_mutex && !ls[i].reuseport) {
+            continue;
+        }
+#else
         if (ngx_use_accept_mutex) {
             continue;
         }
+#endif
 
         if (ngx_event_flags & NGX_USE_RTSIG_EVENT) {
             if (ngx_add_conn(c) == NGX_ERROR) {
@@ -1003,6 +1083,44 @@ ngx_events_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_event_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+#if (NGX_HAVE_REUSEPORT)
+    ngx_uint_t        i;
+    ngx_listening_t  *ls;
+#endif
+
+    if (ngx_get_conf(cycle->conf_ctx, ngx_events_module) == NULL) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "no \"events\" section in configuration");
+        return NGX_CONF_ERROR;
+    }
+
+#if (NGX_HAVE_REUSEPORT)
+
+    ls = cycle->listening.elts;
+    for (i = 0; i < cycle->listening.nelts; i++) {
+
+        if (!ls[i].reuseport || ls[i].worker != 0) {
+            continue;
+        }
+
+        if (ngx_clone_listening(cycle, &ls[i]) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+
+        /* cloning may change cycle->listening.elts */
+
+        ls = cycle->listening.elts;
+    }
+
+#endif
+
+    return NGX_CONF_OK;
+}
+
+
 static char *
 ngx_event_connections(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -1165,7 +1283,7 @@ ngx_event_debug_connection(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
 
 static void *
-ngx_event_create_conf(ngx_cycle_t *cycle)
+ngx_event_core_create_conf(ngx_cycle_t *cycle)
 {
     ngx_event_conf_t  *ecf;
 
@@ -1176,9 +1294,13 @@ ngx_event_create_conf(ngx_cycle_t *cycle)
 
     ecf->connections = NGX_CONF_UNSET_UINT;
     ecf->use = NGX_CONF_UNSET_UINT;
-    ecf->multi_accept = NGX_CONF_UNSET;
+    ecf->multi_accept = NGX_CONF_UNSET_UINT;
     ecf->accept_mutex = NGX_CONF_UNSET;
     ecf->accept_mutex_delay = NGX_CONF_UNSET_MSEC;
+    ecf->timer_wheel = NGX_CONF_UNSET;
+    ecf->timer_wheel_resolution = NGX_CONF_UNSET_MSEC;
+    ecf->loop_stats = NGX_CONF_UNSET;
+    ecf->slow_handler_log = NGX_CONF_UNSET_MSEC;
     ecf->name = (void *) NGX_CONF_UNSET;
 
 #if (NGX_DEBUG)
@@ -1196,7 +1318,7 @@ ngx_event_create_conf(ngx_cycle_t *cycle)
 
 
 static char *
-ngx_event_init_conf(ngx_cycle_t *cycle, void *conf)
+ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf)
 {
     ngx_event_conf_t  *ecf = conf;
 
@@ -1291,9 +1413,58 @@ ngx_event_init_conf(ngx_cycle_t *cycle, void *conf)
     event_module = module->ctx;
     ngx_conf_init_ptr_value(ecf->name, event_module->name->data);
 
-    ngx_conf_init_value(ecf->multi_accept, 0);
+    ngx_conf_init_uint_value(ecf->multi_accept, NGX_MULTI_ACCEPT_OFF);
     ngx_conf_init_value(ecf->accept_mutex, 1);
     ngx_conf_init_msec_value(ecf->accept_mutex_delay, 500);
+    ngx_conf_init_value(ecf->timer_wheel, 0);
+    ngx_conf_init_msec_value(ecf->timer_wheel_resolution, 10);
+
+    if (ecf->timer_wheel_resolution == 0) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "\"timer_wheel_resolution\" must be greater than 0");
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_conf_init_value(ecf->loop_stats, 0);
+    ngx_conf_init_msec_value(ecf->slow_handler_log, 0);
+
+    if (ngx_event_loop_init_conf(cycle, ecf) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+#if (NGX_HAVE_TCP_INFO)
+
+    if (ecf->multi_accept == NGX_MULTI_ACCEPT_AUTO) {
+        ngx_int_t  index;
+        ngx_str_t  name;
+
+        ngx_str_set(&name, "accept_queue_full");
+
+        index = ngx_stat_counter_index(cycle, &name, 0);
+        if (index == NGX_ERROR) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_stat_accept_queue_full = index;
+    }
+
+#endif
+
+#if (NGX_STAT_STUB)
+    {
+    ngx_int_t          index;
+    ngx_event_stat_t  *st;
+
+    for (st = ngx_event_stats; st->name.len; st++) {
+        index = ngx_stat_counter_index(cycle, &st->name, st->gauge);
+        if (index == NGX_ERROR) {
+            return NGX_CONF_ERROR;
+        }
+
+        *st->index = index;
+    }
+    }
+#endif
 
 
 #if (NGX_HAVE_RTSIG)
@@ -246,6 +246,11 @@ struct ngx_event_aio_s {
     ngx_event_t                event;
 };
 
+#if (NGX_HAVE_IOURING)
+ngx_int_t ngx_iouring_aio_read(ngx_event_t *ev, ngx_fd_t fd, u_char *buf,
+    size_t size, off_t offset);
+#endif
+
 #endif
 
 
@@ -272,6 +277,9 @@ typedef struct {
     ngx_int_t  (*del_conn)(ngx_connection_t *c, ngx_uint_t flags);
 	/*从除事件机制中移除一个连接的读写事件*/
 
+    ngx_int_t  (*notify)(ngx_event_handler_pt handler);
+	/*从其他线程中唤醒事件循环，事件循环中会调用handler方法，目前用于线程池*/
+
     ngx_int_t  (*process_changes)(ngx_cycle_t *cycle, ngx_uint_t nowait);
 	/*目前未用到*/
     ngx_int_t  (*process_events)(ngx_cycle_t *cycle, ngx_msec_t timer,
@@ -325,7 +333,7 @@ extern ngx_event_actions_t   ngx_event_actions;
 #define NGX_USE_GREEDY_EVENT     0x00000020
 
 /*
- * The event filter is epoll.
+ * The event filter is epoll or behaves like epoll: io_uring.
  */
 #define NGX_USE_EPOLL_EVENT      0x00000040
 
@@ -369,6 +377,11 @@ extern ngx_event_actions_t   ngx_event_actions;
  */
 #define NGX_USE_VNODE_EVENT      0x00002000
 
+/*
+ * The event filter is io_uring, it also completes the file AIO reads.
+ */
+#define NGX_USE_IOURING_EVENT    0x00004000
+
 
 /*
  * The event filter is deleted just before the closing file.
@@ -494,6 +507,8 @@ extern ngx_event_actions_t   ngx_event_actions;
 #define ngx_add_conn         ngx_event_actions.add_conn
 #define ngx_del_conn         ngx_event_actions.del_conn
 
+#define ngx_notify           ngx_event_actions.notify
+
 #define ngx_add_timer        ngx_event_add_timer
 #define ngx_del_timer        ngx_event_del_timer
 
@@ -511,20 +526,35 @@ extern ngx_os_io_t  ngx_io;
 #define NGX_EVENT_CONF        0x02000000
 
 
+#define NGX_MULTI_ACCEPT_OFF   0
+#define NGX_MULTI_ACCEPT_ON    1
+#define NGX_MULTI_ACCEPT_AUTO  2
+
+
 typedef struct {
     ngx_uint_t    connections;
 	/*连接池大小*/
     ngx_uint_t    use;
 	/*选用的事件模块在所有事件模块中序号也就是ngx_module_t 中的ctx_index 成员*/
 
-    ngx_flag_t    multi_accept;
-	/*标志位，如果为1，则表示在接收到一个新连接事件时，一次性建立尽可能多的连接*/
+    ngx_uint_t    multi_accept;
+	/*为1时表示在接收到一个新连接事件时，一次性建立尽可能多的连接；为
+	  NGX_MULTI_ACCEPT_AUTO时根据accept队列的长度和空闲连接数决定一次建立多少连接*/
     ngx_flag_t    accept_mutex;
 	/*标志位为1时表示启用负载均衡*/
 
     ngx_msec_t    accept_mutex_delay;
 	/*负载均衡锁会使有些worker进程在拿不到锁时延迟建立新连接，accept_mutex_delay就是这段延迟时间的长度*/
 
+    ngx_flag_t    timer_wheel;
+    ngx_msec_t    timer_wheel_resolution;
+	/*为1时使用时间轮管理定时器，timer_wheel_resolution是时间轮每一格的精度*/
+
+    ngx_flag_t    loop_stats;
+    ngx_msec_t    slow_handler_log;
+	/*loop_stats为1时统计每轮事件循环的耗时分布，slow_handler_log不为0时记录
+	  耗时超过该值的事件回调方法*/
+
     u_char       *name;
 	/*所选用事件模块的名字，它与use成员是匹配的*/
 
@@ -558,13 +588,17 @@ extern ngx_int_t              ngx_accept_disabled;
 
 #if (NGX_STAT_STUB)
 
-extern ngx_atomic_t  *ngx_stat_accepted;
-extern ngx_atomic_t  *ngx_stat_handled;
-extern ngx_atomic_t  *ngx_stat_requests;
-extern ngx_atomic_t  *ngx_stat_active;
-extern ngx_atomic_t  *ngx_stat_reading;
-extern ngx_atomic_t  *ngx_stat_writing;
+extern ngx_uint_t  ngx_stat_accepted;
+extern ngx_uint_t  ngx_stat_handled;
+extern ngx_uint_t  ngx_stat_requests;
+extern ngx_uint_t  ngx_stat_active;
+extern ngx_uint_t  ngx_stat_reading;
+extern ngx_uint_t  ngx_stat_writing;
+
+#endif
 
+#if (NGX_HAVE_TCP_INFO)
+extern ngx_uint_t  ngx_stat_accept_queue_full;
 #endif
 
 
@@ -610,6 +644,7 @@ ngx_int_t ngx_send_lowat(ngx_connection_t *c, size_t lowat);
 
 #include <ngx_event_timer.h>
 #include <ngx_event_posted.h>
+#include <ngx_event_loop.h>
 #include <ngx_event_busy_lock.h>
 
 #if (NGX_WIN32)
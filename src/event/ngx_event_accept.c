@@ -13,6 +13,12 @@
 static ngx_int_t ngx_enable_accept_events(ngx_cycle_t *cycle);
 static ngx_int_t ngx_disable_accept_events(ngx_cycle_t *cycle);
 static void ngx_close_accepted_connection(ngx_connection_t *c);
+static ngx_uint_t ngx_event_accept_batch(ngx_connection_t *lc);
+
+
+#if (NGX_HAVE_TCP_INFO)
+ngx_uint_t  ngx_stat_accept_queue_full;
+#endif
 
 
 void
@@ -25,6 +31,7 @@ ngx_event_accept(ngx_event_t *ev)
     ngx_event_t       *rev, *wev;//读写事件
     ngx_listening_t   *ls;
     ngx_connection_t  *c, *lc;
+    ngx_uint_t         batch;
     ngx_event_conf_t  *ecf;
     u_char             sa[NGX_SOCKADDRLEN];
 #if (NGX_HAVE_ACCEPT4)
@@ -33,16 +40,25 @@ ngx_event_accept(ngx_event_t *ev)
 
     ecf = ngx_event_get_conf(ngx_cycle->conf_ctx, ngx_event_core_module);
 
+    lc = ev->data;
+    ls = lc->listening;
+    ev->ready = 0;
+
+    batch = 0;
+
     if (ngx_event_flags & NGX_USE_RTSIG_EVENT) {
         ev->available = 1;
 
     } else if (!(ngx_event_flags & NGX_USE_KQUEUE_EVENT)) {
-        ev->available = ecf->multi_accept;
-    }
 
-    lc = ev->data;
-    ls = lc->listening;
-    ev->ready = 0;
+        if (ecf->multi_accept == NGX_MULTI_ACCEPT_AUTO) {
+            batch = ngx_event_accept_batch(lc);
+            ev->available = 1;
+
+        } else {
+            ev->available = ecf->multi_accept;
+        }
+    }
 
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
                    "accept on %V, ready: %d", &ls->addr_text, ev->available);
@@ -53,7 +69,7 @@ ngx_event_accept(ngx_event_t *ev)
 #if (NGX_HAVE_ACCEPT4)
         if (use_accept4) {
             s = accept4(lc->fd, (struct sockaddr *) sa, &socklen,
-                        SOCK_NONBLOCK);
+                        SOCK_NONBLOCK|SOCK_CLOEXEC);
         } else {
             s = accept(lc->fd, (struct sockaddr *) sa, &socklen);
         }
@@ -101,7 +117,7 @@ ngx_event_accept(ngx_event_t *ev)
         }
 
 #if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
+        ngx_stat_add(ngx_stat_accepted, 1);
 #endif
 
         ngx_accept_disabled = ngx_cycle->connection_n / 8
@@ -119,7 +135,7 @@ ngx_event_accept(ngx_event_t *ev)
         }
 
 #if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_active, 1);
+        ngx_stat_add(ngx_stat_active, 1);
 #endif
 
         c->pool = ngx_create_pool(ls->pool_size, ev->log);//为连接创建内存池
@@ -224,7 +240,7 @@ ngx_event_accept(ngx_event_t *ev)
         c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
 
 #if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_handled, 1);
+        ngx_stat_add(ngx_stat_handled, 1);
 #endif
 
 #if (NGX_THREADS)
@@ -288,10 +304,54 @@ ngx_event_accept(ngx_event_t *ev)
             ev->available--;
         }
 
+        if (batch) {
+            ev->available = (--batch != 0);
+        }
+
     } while (ev->available);
 }
 
 
+/*
+ * the number of connections to accept at once is limited by the length
+ * of the accept queue and by the free connections; the listening sockets
+ * are level-triggered, so the connections left in the queue are reported
+ * again by the next call of process_events()
+ */
+
+static ngx_uint_t
+ngx_event_accept_batch(ngx_connection_t *lc)
+{
+    ngx_uint_t  n;
+#if (NGX_HAVE_TCP_INFO)
+    ngx_uint_t  queue, backlog;
+#endif
+
+    n = ngx_cycle->free_connection_n;
+
+#if (NGX_HAVE_TCP_INFO)
+
+    if (ngx_tcp_accept_queue(lc->fd, &queue, &backlog) == NGX_OK) {
+
+        if (queue > backlog) {
+            ngx_stat_add(ngx_stat_accept_queue_full, 1);
+        }
+
+        n = ngx_min(n, queue);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
+                       "accept queue: %ui of %ui, batch: %ui",
+                       queue, backlog, n);
+    }
+
+#endif
+
+    /* the single accept() reports the "worker_connections" shortage */
+
+    return n ? n : 1;
+}
+
+
 ngx_int_t
 ngx_trylock_accept_mutex(ngx_cycle_t *cycle)
 {
@@ -355,6 +415,10 @@ ngx_enable_accept_events(ngx_cycle_t *cycle)
 
         c = ls[i].connection;
 
+        if (c == NULL || c->read->active) {
+            continue;
+        }
+
         if (ngx_event_flags & NGX_USE_RTSIG_EVENT) {
 
             if (ngx_add_conn(c) == NGX_ERROR) {
@@ -384,10 +448,20 @@ ngx_disable_accept_events(ngx_cycle_t *cycle)
 
         c = ls[i].connection;
 
-        if (!c->read->active) {
+        if (c == NULL || !c->read->active) {
+            continue;
+        }
+
+#if (NGX_HAVE_REUSEPORT)
+
+        /* to preserve socket on its own worker */
+
+        if (ls[i].reuseport) {
             continue;
         }
 
+#endif
+
         if (ngx_event_flags & NGX_USE_RTSIG_EVENT) {
             if (ngx_del_conn(c, NGX_DISABLE_EVENT) == NGX_ERROR) {
                 return NGX_ERROR;
@@ -426,7 +500,7 @@ ngx_close_accepted_connection(ngx_connection_t *c)
     }
 
 #if (NGX_STAT_STUB)
-    (void) ngx_atomic_fetch_add(ngx_stat_active, -1);
+    ngx_stat_add(ngx_stat_active, -1);
 #endif
 }
 
@@ -0,0 +1,318 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+#define NGX_EVENT_LOOP_TIME_BUCKETS    10
+#define NGX_EVENT_LOOP_EVENT_BUCKETS   12
+
+
+typedef struct {
+    ngx_uint_t   bound;
+    ngx_str_t    name;
+} ngx_event_loop_bucket_t;
+
+
+static ngx_int_t ngx_event_loop_register(ngx_cycle_t *cycle, char *prefix,
+    ngx_event_loop_bucket_t *buckets, ngx_uint_t n, ngx_uint_t *index);
+static void ngx_event_loop_histogram(ngx_event_loop_bucket_t *buckets,
+    ngx_uint_t n, ngx_uint_t *index, ngx_uint_t value);
+static u_char *ngx_event_loop_handler_name(u_char *buf, size_t len,
+    ngx_event_handler_pt handler);
+
+
+ngx_uint_t  ngx_event_timing;
+uint64_t    ngx_event_loop_posted;
+
+static uint64_t    ngx_event_loop_busy;
+static ngx_uint_t  ngx_event_loop_events;
+static uint64_t    ngx_event_loop_slow;
+
+
+/* the last bucket is unbounded */
+
+static ngx_event_loop_bucket_t  ngx_event_loop_time[] = {
+    { 100, ngx_string("100us") },
+    { 500, ngx_string("500us") },
+    { 1000, ngx_string("1ms") },
+    { 5000, ngx_string("5ms") },
+    { 10000, ngx_string("10ms") },
+    { 50000, ngx_string("50ms") },
+    { 100000, ngx_string("100ms") },
+    { 500000, ngx_string("500ms") },
+    { 1000000, ngx_string("1s") },
+    { 0, ngx_string("inf") }
+};
+
+
+static ngx_event_loop_bucket_t  ngx_event_loop_nevents[] = {
+    { 0, ngx_string("0") },
+    { 1, ngx_string("1") },
+    { 2, ngx_string("2") },
+    { 4, ngx_string("4") },
+    { 8, ngx_string("8") },
+    { 16, ngx_string("16") },
+    { 32, ngx_string("32") },
+    { 64, ngx_string("64") },
+    { 128, ngx_string("128") },
+    { 256, ngx_string("256") },
+    { 512, ngx_string("512") },
+    { 0, ngx_string("inf") }
+};
+
+
+static ngx_uint_t  ngx_stat_loop_busy[NGX_EVENT_LOOP_TIME_BUCKETS];
+static ngx_uint_t  ngx_stat_loop_posted[NGX_EVENT_LOOP_TIME_BUCKETS];
+static ngx_uint_t  ngx_stat_loop_events[NGX_EVENT_LOOP_EVENT_BUCKETS];
+
+static ngx_uint_t  ngx_stat_loop_iterations;
+static ngx_uint_t  ngx_stat_loop_busy_usec;
+static ngx_uint_t  ngx_stat_loop_posted_usec;
+static ngx_uint_t  ngx_stat_loop_slow_handlers;
+
+
+ngx_int_t
+ngx_event_loop_init_conf(ngx_cycle_t *cycle, ngx_event_conf_t *ecf)
+{
+    ngx_int_t    index;
+    ngx_uint_t   i;
+    ngx_str_t    name;
+
+    static struct {
+        char        *name;
+        ngx_uint_t  *index;
+    } counters[] = {
+        { "loop_iterations", &ngx_stat_loop_iterations },
+        { "loop_busy_usec", &ngx_stat_loop_busy_usec },
+        { "loop_posted_usec", &ngx_stat_loop_posted_usec },
+        { "loop_slow_handlers", &ngx_stat_loop_slow_handlers }
+    };
+
+    if (!ecf->loop_stats && ecf->slow_handler_log == 0) {
+        return NGX_OK;
+    }
+
+    for (i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        name.len = ngx_strlen(counters[i].name);
+        name.data = (u_char *) counters[i].name;
+
+        index = ngx_stat_counter_index(cycle, &name, 0);
+        if (index == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        *counters[i].index = index;
+    }
+
+    if (ngx_event_loop_register(cycle, "loop_busy_le_", ngx_event_loop_time,
+                                NGX_EVENT_LOOP_TIME_BUCKETS,
+                                ngx_stat_loop_busy)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_event_loop_register(cycle, "loop_posted_le_", ngx_event_loop_time,
+                                NGX_EVENT_LOOP_TIME_BUCKETS,
+                                ngx_stat_loop_posted)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    return ngx_event_loop_register(cycle, "loop_events_le_",
+                                   ngx_event_loop_nevents,
+                                   NGX_EVENT_LOOP_EVENT_BUCKETS,
+                                   ngx_stat_loop_events);
+}
+
+
+static ngx_int_t
+ngx_event_loop_register(ngx_cycle_t *cycle, char *prefix,
+    ngx_event_loop_bucket_t *buckets, ngx_uint_t n, ngx_uint_t *index)
+{
+    ngx_int_t   rc;
+    ngx_uint_t  i;
+    ngx_str_t   name;
+    u_char      buf[64];
+
+    for (i = 0; i < n; i++) {
+        name.data = buf;
+        name.len = ngx_sprintf(buf, "%s%V", prefix, &buckets[i].name) - buf;
+
+        rc = ngx_stat_counter_index(cycle, &name, 0);
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        index[i] = rc;
+    }
+
+    return NGX_OK;
+}
+
+
+void
+ngx_event_loop_init_process(ngx_cycle_t *cycle, ngx_event_conf_t *ecf)
+{
+    ngx_event_timing = (ecf->loop_stats || ecf->slow_handler_log) ? 1 : 0;
+    ngx_event_loop_slow = (uint64_t) ecf->slow_handler_log * 1000;
+
+    ngx_event_loop_busy = 0;
+    ngx_event_loop_posted = 0;
+    ngx_event_loop_events = 0;
+}
+
+
+void
+ngx_event_timed_handler(ngx_event_t *ev)
+{
+    u_char                *last;
+    uint64_t               start, t;
+    ngx_log_t             *log;
+    ngx_uint_t             write;
+    ngx_atomic_uint_t      number;
+    ngx_connection_t      *c;
+    ngx_event_handler_pt   handler;
+    u_char                 name[NGX_MAX_PATH + 32];
+
+    /*
+     * ev->data is not always a connection, so the connection is found
+     * by the event address; the connection may be closed by the handler
+     */
+
+    c = NULL;
+    write = 0;
+    number = 0;
+
+    if (ev >= ngx_cycle->read_events
+        && ev < ngx_cycle->read_events + ngx_cycle->connection_n)
+    {
+        c = &ngx_cycle->connections[ev - ngx_cycle->read_events];
+
+    } else if (ev >= ngx_cycle->write_events
+               && ev < ngx_cycle->write_events + ngx_cycle->connection_n)
+    {
+        c = &ngx_cycle->connections[ev - ngx_cycle->write_events];
+        write = 1;
+    }
+
+    if (c) {
+        number = c->number;
+    }
+
+    handler = ev->handler;
+
+    start = ngx_event_loop_usec();
+
+    handler(ev);
+
+    t = ngx_event_loop_usec() - start;
+
+    ngx_event_loop_busy += t;
+    ngx_event_loop_events++;
+
+    if (ngx_event_loop_slow == 0 || t < ngx_event_loop_slow) {
+        return;
+    }
+
+    ngx_stat_add(ngx_stat_loop_slow_handlers, 1);
+
+    last = ngx_event_loop_handler_name(name, sizeof(name), handler);
+
+    if (c == NULL) {
+        ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                      "slow event handler %*s took %uL.%03uLms, data:%p",
+                      (size_t) (last - name), name, t / 1000, t % 1000, ev->data);
+        return;
+    }
+
+    /* the connection log also shows the client and the request */
+
+    log = (c->fd != (ngx_socket_t) -1 && c->number == number) ? c->log
+                                                              : ngx_cycle->log;
+
+    ngx_log_error(NGX_LOG_WARN, log, 0,
+                  "slow %s event handler %*s took %uL.%03uLms, "
+                  "connection: *%uA",
+                  write ? "write" : "read", (size_t) (last - name), name,
+                  t / 1000, t % 1000, number);
+}
+
+
+void
+ngx_event_loop_account(void)
+{
+    ngx_stat_add(ngx_stat_loop_iterations, 1);
+    ngx_stat_add(ngx_stat_loop_busy_usec, ngx_event_loop_busy);
+    ngx_stat_add(ngx_stat_loop_posted_usec, ngx_event_loop_posted);
+
+    ngx_event_loop_histogram(ngx_event_loop_time, NGX_EVENT_LOOP_TIME_BUCKETS,
+                             ngx_stat_loop_busy,
+                             (ngx_uint_t) ngx_event_loop_busy);
+
+    ngx_event_loop_histogram(ngx_event_loop_time, NGX_EVENT_LOOP_TIME_BUCKETS,
+                             ngx_stat_loop_posted,
+                             (ngx_uint_t) ngx_event_loop_posted);
+
+    ngx_event_loop_histogram(ngx_event_loop_nevents,
+                             NGX_EVENT_LOOP_EVENT_BUCKETS,
+                             ngx_stat_loop_events, ngx_event_loop_events);
+
+    ngx_event_loop_busy = 0;
+    ngx_event_loop_posted = 0;
+    ngx_event_loop_events = 0;
+}
+
+
+static void
+ngx_event_loop_histogram(ngx_event_loop_bucket_t *buckets, ngx_uint_t n,
+    ngx_uint_t *index, ngx_uint_t value)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < n - 1; i++) {
+        if (value <= buckets[i].bound) {
+            break;
+        }
+    }
+
+    ngx_stat_add(index[i], 1);
+}
+
+
+/*
+ * the handler is logged as an offset in the binary or a shared object,
+ * "addr2line -f -e <binary> <offset>" gives the function and its source file
+ */
+
+static u_char *
+ngx_event_loop_handler_name(u_char *buf, size_t len,
+    ngx_event_handler_pt handler)
+{
+#if (NGX_HAVE_DLADDR)
+    char     *file;
+    Dl_info   info;
+
+    if (dladdr((void *) handler, &info) && info.dli_fname) {
+
+        /* the binary name in argv[0] is overwritten by ngx_setproctitle() */
+
+        file = (info.dli_fname == ngx_os_argv[0]) ? ngx_argv[0]
+                                                  : (char *) info.dli_fname;
+
+        return ngx_snprintf(buf, len, "%s+0x%xL", file,
+                            (uint64_t) ((u_char *) handler
+                                        - (u_char *) info.dli_fbase));
+    }
+#endif
+
+    return ngx_snprintf(buf, len, "%p", handler);
+}
@@ -0,0 +1,66 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_EVENT_LOOP_H_INCLUDED_
+#define _NGX_EVENT_LOOP_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * 事件循环的统计：开启loop_stats或slow_handler_log后，所有事件回调方法都经过
+ * ngx_event_timed_handler调用，累计每轮循环中回调方法的耗时、事件个数以及处理
+ * post事件队列的耗时，每轮结束时计入直方图。直方图保存在ngx_stat计数器中，
+ * 每个worker进程只修改自己的那一行，由stub_status汇总输出
+ */
+
+
+/*调用事件的回调方法，需要统计时记录它的耗时*/
+#define ngx_event_call_handler(ev)                                            \
+    do {                                                                      \
+        if (ngx_event_timing) {                                               \
+            ngx_event_timed_handler(ev);                                      \
+                                                                              \
+        } else {                                                              \
+            (ev)->handler(ev);                                                \
+        }                                                                     \
+    } while (0)
+
+
+ngx_int_t ngx_event_loop_init_conf(ngx_cycle_t *cycle, ngx_event_conf_t *ecf);
+void ngx_event_loop_init_process(ngx_cycle_t *cycle, ngx_event_conf_t *ecf);
+void ngx_event_timed_handler(ngx_event_t *ev);
+void ngx_event_loop_account(void);
+
+
+static ngx_inline uint64_t
+ngx_event_loop_usec(void)
+{
+#if (NGX_HAVE_CLOCK_MONOTONIC)
+    struct timespec  ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    struct timeval   tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+
+extern ngx_uint_t  ngx_event_timing;
+extern uint64_t    ngx_event_loop_posted;
+
+
+#endif /* _NGX_EVENT_LOOP_H_INCLUDED_ */
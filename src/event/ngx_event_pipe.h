@@ -112,6 +112,10 @@ struct ngx_event_pipe_s {
 	/*设置busy缓冲区中待发送的响应长度触发值，当达到busy_size长度时，必须等待
 	busy缓冲区发送了足够的内容，才能继续发送out和in缓冲区中的内容*/
     off_t              read_length;
+    off_t              length;
+	/*input_filter方法设置的还需要从上游读取的最少字节数，-1表示未知。
+	当free_raw_bufs中未填满的缓冲区已包含这么多数据时也交给input_filter处理，
+	减为0时表示响应已经读完，不必等到上游关闭连接（keepalive）*/
 	/*已经接收到的上游响应包体长度*/
 
     off_t              max_temp_file_size;
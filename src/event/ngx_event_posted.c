@@ -22,8 +22,11 @@ void
 ngx_event_process_posted(ngx_cycle_t *cycle,
     ngx_thread_volatile ngx_event_t **posted)
 {
+    uint64_t      start;
     ngx_event_t  *ev;
 
+    start = ngx_event_timing ? ngx_event_loop_usec() : 0;
+
     for ( ;; ) {
 
         ev = (ngx_event_t *) *posted;
@@ -32,12 +35,16 @@ ngx_event_process_posted(ngx_cycle_t *cycle,
                       "posted event %p", ev);
 
         if (ev == NULL) {
-            return;
+            break;
         }
 
         ngx_delete_posted_event(ev);
 
-        ev->handler(ev);
+        ngx_event_call_handler(ev);
+    }
+
+    if (ngx_event_timing) {
+        ngx_event_loop_posted += ngx_event_loop_usec() - start;
     }
 }
 
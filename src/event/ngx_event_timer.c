@@ -15,9 +15,61 @@ ngx_mutex_t  *ngx_event_timer_mutex;
 #endif
 
 
+/*
+ * The hierarchical timer wheel: the root level has 256 slots of
+ * the wheel resolution, each of the next four levels has 64 slots and every
+ * slot covers the whole previous level.  The timers are linked in the slot
+ * lists through the "left" and "right" fields of the event timer node,
+ * and the "data" field keeps the level of the timer.  When the root level
+ * wraps around, the timers of the next level slot are redistributed
+ * to the lower levels.
+ */
+
+#define NGX_TIMER_WHEEL_LEVELS     5
+#define NGX_TIMER_WHEEL_ROOT_BITS  8
+#define NGX_TIMER_WHEEL_BITS       6
+
+#define NGX_TIMER_WHEEL_ROOT_SIZE  (1 << NGX_TIMER_WHEEL_ROOT_BITS)
+#define NGX_TIMER_WHEEL_ROOT_MASK  (NGX_TIMER_WHEEL_ROOT_SIZE - 1)
+#define NGX_TIMER_WHEEL_SIZE       (1 << NGX_TIMER_WHEEL_BITS)
+#define NGX_TIMER_WHEEL_MASK       (NGX_TIMER_WHEEL_SIZE - 1)
+
+#define NGX_TIMER_WHEEL_SLOTS                                                 \
+    (NGX_TIMER_WHEEL_ROOT_SIZE                                                \
+     + (NGX_TIMER_WHEEL_LEVELS - 1) * NGX_TIMER_WHEEL_SIZE)
+
+#define ngx_event_timer_wheel_shift(level)                                    \
+    ((level) ? NGX_TIMER_WHEEL_ROOT_BITS + ((level) - 1) * NGX_TIMER_WHEEL_BITS \
+             : 0)
+
+#define ngx_event_timer_wheel_slot(level, tick)                               \
+    ((level) ? &ngx_event_timer_wheel_slots[NGX_TIMER_WHEEL_ROOT_SIZE         \
+                   + ((level) - 1) * NGX_TIMER_WHEEL_SIZE                     \
+                   + (((tick) >> ngx_event_timer_wheel_shift(level))          \
+                      & NGX_TIMER_WHEEL_MASK)]                                \
+             : &ngx_event_timer_wheel_slots[(tick) & NGX_TIMER_WHEEL_ROOT_MASK])
+
+
+static void ngx_event_timer_wheel_link(ngx_rbtree_node_t *node);
+static void ngx_event_timer_wheel_advance(ngx_uint_t ticks);
+static void ngx_event_timer_wheel_cascade(void);
+static ngx_msec_t ngx_event_find_wheel_timer(void);
+static void ngx_event_expire_wheel_timers(void);
+
+
 ngx_thread_volatile ngx_rbtree_t  ngx_event_timer_rbtree;/*事件超时时间的大小组成了二叉排序树*/
 static ngx_rbtree_node_t          ngx_event_timer_sentinel;/*红黑树哨兵节点*/
 
+ngx_msec_t                        ngx_event_timer_wheel;
+
+static ngx_rbtree_node_t   ngx_event_timer_wheel_slots[NGX_TIMER_WHEEL_SLOTS];
+/*下一个需要处理的格子的序号，以及这一格对应的时间*/
+static ngx_uint_t          ngx_event_timer_wheel_tick;
+static ngx_msec_t          ngx_event_timer_wheel_msec;
+/*每一层中定时器的个数*/
+static ngx_uint_t          ngx_event_timer_wheel_timers[NGX_TIMER_WHEEL_LEVELS];
+static ngx_uint_t          ngx_event_timer_wheel_total;
+
 /*
  * the event timer rbtree may contain the duplicate keys, however,
  * it should not be a problem, because we use the rbtree to find
@@ -27,9 +79,26 @@ static ngx_rbtree_node_t          ngx_event_timer_sentinel;/*红黑树哨兵节
 ngx_int_t
 ngx_event_timer_init(ngx_log_t *log)
 {
+    ngx_uint_t          i;
+    ngx_rbtree_node_t  *slot;
+
     ngx_rbtree_init(&ngx_event_timer_rbtree, &ngx_event_timer_sentinel,
                     ngx_rbtree_insert_timer_value);
 
+    for (i = 0; i < NGX_TIMER_WHEEL_SLOTS; i++) {
+        slot = &ngx_event_timer_wheel_slots[i];
+        slot->left = slot;
+        slot->right = slot;
+    }
+
+    for (i = 0; i < NGX_TIMER_WHEEL_LEVELS; i++) {
+        ngx_event_timer_wheel_timers[i] = 0;
+    }
+
+    ngx_event_timer_wheel_total = 0;
+    ngx_event_timer_wheel_tick = 0;
+    ngx_event_timer_wheel_msec = ngx_current_msec;
+
 #if (NGX_THREADS)
 
     if (ngx_event_timer_mutex) {
@@ -54,6 +123,10 @@ ngx_event_find_timer(void)
     ngx_msec_int_t      timer;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+        return ngx_event_find_wheel_timer();
+    }
+
     if (ngx_event_timer_rbtree.root == &ngx_event_timer_sentinel) {
         return NGX_TIMER_INFINITE;
     }
@@ -79,6 +152,11 @@ ngx_event_expire_timers(void)
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+        ngx_event_expire_wheel_timers();
+        return;
+    }
+
     sentinel = ngx_event_timer_rbtree.sentinel;
 
     for ( ;; ) {
@@ -147,7 +225,7 @@ ngx_event_expire_timers(void)
 
             ev->timedout = 1;
 
-            ev->handler(ev);
+            ngx_event_call_handler(ev);
 
             continue;
         }
@@ -157,3 +235,290 @@ ngx_event_expire_timers(void)
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 }
+
+
+ngx_uint_t
+ngx_event_timer_empty(void)
+{
+    if (ngx_event_timer_wheel) {
+        return ngx_event_timer_wheel_total == 0;
+    }
+
+    return ngx_event_timer_rbtree.root == ngx_event_timer_rbtree.sentinel;
+}
+
+
+void
+ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node)
+{
+    if (ngx_event_timer_wheel_total == 0) {
+
+        /* the wheel is empty, so there is no need to walk the passed slots */
+
+        ngx_event_timer_wheel_msec = ngx_current_msec;
+    }
+
+    ngx_event_timer_wheel_link(node);
+
+    ngx_event_timer_wheel_total++;
+}
+
+
+void
+ngx_event_timer_wheel_delete(ngx_rbtree_node_t *node)
+{
+    node->left->right = node->right;
+    node->right->left = node->left;
+
+    ngx_event_timer_wheel_timers[node->data]--;
+    ngx_event_timer_wheel_total--;
+}
+
+
+static void
+ngx_event_timer_wheel_link(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t          level, ticks;
+    ngx_msec_int_t      diff;
+    ngx_rbtree_node_t  *slot;
+
+    diff = (ngx_msec_int_t) (node->key - ngx_event_timer_wheel_msec);
+
+    if (diff > 0) {
+        ticks = (diff + ngx_event_timer_wheel - 1) / ngx_event_timer_wheel;
+
+    } else {
+        ticks = 0;
+    }
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS - 1; level++) {
+        if (ticks < (ngx_uint_t) 1 << ngx_event_timer_wheel_shift(level + 1))
+        {
+            break;
+        }
+    }
+
+    if (level == NGX_TIMER_WHEEL_LEVELS - 1
+        && ticks >> ngx_event_timer_wheel_shift(level) > NGX_TIMER_WHEEL_MASK)
+    {
+        /*
+         * the timer is too far: it is placed to the last slot of the wheel
+         * and will be placed again when the slot will be redistributed
+         */
+
+        ticks = (ngx_uint_t) NGX_TIMER_WHEEL_MASK
+                << ngx_event_timer_wheel_shift(level);
+    }
+
+    slot = ngx_event_timer_wheel_slot(level,
+                                      ngx_event_timer_wheel_tick + ticks);
+
+    node->data = (u_char) level;
+
+    node->right = slot;
+    node->left = slot->left;
+    slot->left->right = node;
+    slot->left = node;
+
+    ngx_event_timer_wheel_timers[level]++;
+}
+
+
+static void
+ngx_event_timer_wheel_advance(ngx_uint_t ticks)
+{
+    ngx_event_timer_wheel_tick += ticks;
+    ngx_event_timer_wheel_msec += ticks * ngx_event_timer_wheel;
+
+    if ((ngx_event_timer_wheel_tick & NGX_TIMER_WHEEL_ROOT_MASK) == 0) {
+        ngx_event_timer_wheel_cascade();
+    }
+}
+
+
+static void
+ngx_event_timer_wheel_cascade(void)
+{
+    ngx_uint_t          level;
+    ngx_rbtree_node_t  *slot, *node, list;
+
+    for (level = 1; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+
+        slot = ngx_event_timer_wheel_slot(level, ngx_event_timer_wheel_tick);
+
+        if (slot->right != slot) {
+
+            list.right = slot->right;
+            list.left = slot->left;
+            list.right->left = &list;
+            list.left->right = &list;
+
+            slot->left = slot;
+            slot->right = slot;
+
+            while (list.right != &list) {
+                node = list.right;
+
+                list.right = node->right;
+                node->right->left = &list;
+
+                ngx_event_timer_wheel_timers[level]--;
+
+                ngx_event_timer_wheel_link(node);
+            }
+        }
+
+        if ((ngx_event_timer_wheel_tick >> ngx_event_timer_wheel_shift(level))
+            & NGX_TIMER_WHEEL_MASK)
+        {
+            break;
+        }
+    }
+}
+
+
+static ngx_msec_t
+ngx_event_find_wheel_timer(void)
+{
+    ngx_uint_t          i, ticks, index;
+    ngx_msec_int_t      timer;
+    ngx_rbtree_node_t  *slot;
+
+    if (ngx_event_timer_wheel_total == 0) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    index = ngx_event_timer_wheel_tick & NGX_TIMER_WHEEL_ROOT_MASK;
+
+    /* the upper levels are redistributed when the root level wraps around */
+
+    ticks = NGX_TIMER_WHEEL_ROOT_SIZE - index;
+
+    if (ngx_event_timer_wheel_timers[0]) {
+
+        ngx_mutex_lock(ngx_event_timer_mutex);
+
+        for (i = 0; i < NGX_TIMER_WHEEL_ROOT_SIZE; i++) {
+            slot = ngx_event_timer_wheel_slot(0, ngx_event_timer_wheel_tick + i);
+
+            if (slot->right != slot) {
+                break;
+            }
+        }
+
+        ngx_mutex_unlock(ngx_event_timer_mutex);
+
+        if (i < ticks
+            || ngx_event_timer_wheel_total == ngx_event_timer_wheel_timers[0])
+        {
+            ticks = i;
+        }
+    }
+
+    timer = (ngx_msec_int_t) (ngx_event_timer_wheel_msec
+                              + ticks * ngx_event_timer_wheel
+                              - ngx_current_msec);
+
+    return (ngx_msec_t) (timer > 0 ? timer : 0);
+}
+
+
+static void
+ngx_event_expire_wheel_timers(void)
+{
+    ngx_uint_t          ticks, index;
+    ngx_msec_int_t      diff;
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *slot, *node;
+
+    for ( ;; ) {
+
+        ngx_mutex_lock(ngx_event_timer_mutex);
+
+        diff = (ngx_msec_int_t) (ngx_current_msec
+                                 - ngx_event_timer_wheel_msec);
+
+        if (diff < 0 || ngx_event_timer_wheel_total == 0) {
+            break;
+        }
+
+        if (ngx_event_timer_wheel_timers[0] == 0) {
+
+            /* skip the empty root level up to its wrap around at once */
+
+            index = ngx_event_timer_wheel_tick & NGX_TIMER_WHEEL_ROOT_MASK;
+
+            ticks = diff / ngx_event_timer_wheel + 1;
+
+            if (ticks > NGX_TIMER_WHEEL_ROOT_SIZE - index) {
+                ticks = NGX_TIMER_WHEEL_ROOT_SIZE - index;
+            }
+
+            ngx_event_timer_wheel_advance(ticks);
+
+            ngx_mutex_unlock(ngx_event_timer_mutex);
+
+            continue;
+        }
+
+        slot = ngx_event_timer_wheel_slot(0, ngx_event_timer_wheel_tick);
+
+        if (slot->right == slot) {
+            ngx_event_timer_wheel_advance(1);
+
+            ngx_mutex_unlock(ngx_event_timer_mutex);
+
+            continue;
+        }
+
+        node = slot->right;
+
+        ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+#if (NGX_THREADS)
+
+        if (ngx_threaded && ngx_trylock(ev->lock) == 0) {
+
+            /* the event is being handled by another thread, see below */
+
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "event %p is busy in expire timers", ev);
+            break;
+        }
+#endif
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "event timer del: %d: %M",
+                       ngx_event_ident(ev->data), ev->timer.key);
+
+        ngx_event_timer_wheel_delete(node);
+
+        ngx_mutex_unlock(ngx_event_timer_mutex);
+
+#if (NGX_DEBUG)
+        ev->timer.left = NULL;
+        ev->timer.right = NULL;
+        ev->timer.parent = NULL;
+#endif
+
+        ev->timer_set = 0;
+
+#if (NGX_THREADS)
+        if (ngx_threaded) {
+            ev->posted_timedout = 1;
+
+            ngx_post_event(ev, &ngx_posted_events);
+
+            ngx_unlock(ev->lock);
+
+            continue;
+        }
+#endif
+
+        ev->timedout = 1;
+
+        ngx_event_call_handler(ev);
+    }
+
+    ngx_mutex_unlock(ngx_event_timer_mutex);
+}
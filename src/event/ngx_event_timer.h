@@ -26,6 +26,11 @@ ngx_int_t ngx_event_timer_init(ngx_log_t *log);
 ngx_msec_t ngx_event_find_timer(void);
 /*检查定时器中所有的事件，按照红黑树关键字由小到大的顺序依次调用已经满足超时条件需要被触发事件的handler回调方法*/
 void ngx_event_expire_timers(void);
+/*定时器中是否已经没有事件，worker进程优雅退出时需要等待所有定时器被处理完*/
+ngx_uint_t ngx_event_timer_empty(void);
+/*把定时器加入时间轮或者从时间轮中移走，两者的时间复杂度都是O(1)*/
+void ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node);
+void ngx_event_timer_wheel_delete(ngx_rbtree_node_t *node);
 
 
 #if (NGX_THREADS)
@@ -34,6 +39,8 @@ extern ngx_mutex_t  *ngx_event_timer_mutex;
 
 
 extern ngx_thread_volatile ngx_rbtree_t  ngx_event_timer_rbtree;
+/*时间轮每一格的精度，为0时使用红黑树*/
+extern ngx_msec_t                         ngx_event_timer_wheel;
 
 /*定时器中移走一个事件 ev 需要操作的事件*/
 static ngx_inline void
@@ -45,7 +52,12 @@ ngx_event_del_timer(ngx_event_t *ev)
 
     ngx_mutex_lock(ngx_event_timer_mutex);
 
-    ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+    if (ngx_event_timer_wheel) {
+        ngx_event_timer_wheel_delete(&ev->timer);
+
+    } else {
+        ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+    }
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 
@@ -62,7 +74,7 @@ ngx_event_del_timer(ngx_event_t *ev)
 static ngx_inline void
 ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer)
 {
-    ngx_msec_t      key;
+    ngx_msec_t      key, lazy;
     ngx_msec_int_t  diff;
 
     key = ngx_current_msec + timer;
@@ -73,11 +85,15 @@ ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer)
          * Use a previous timer value if difference between it and a new
          * value is less than NGX_TIMER_LAZY_DELAY milliseconds: this allows
          * to minimize the rbtree operations for fast connections.
+         * The timer wheel cannot distinguish the values closer than
+         * its resolution, so they are not moved too.
          */
 
+        lazy = ngx_max(ngx_event_timer_wheel, NGX_TIMER_LAZY_DELAY);
+
         diff = (ngx_msec_int_t) (key - ev->timer.key);
 
-        if (ngx_abs(diff) < NGX_TIMER_LAZY_DELAY) {
+        if ((ngx_msec_t) ngx_abs(diff) < lazy) {
             ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
                            "event timer: %d, old: %M, new: %M",
                             ngx_event_ident(ev->data), ev->timer.key, key);
@@ -95,7 +111,12 @@ ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer)
 
     ngx_mutex_lock(ngx_event_timer_mutex);
 
-    ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+    if (ngx_event_timer_wheel) {
+        ngx_event_timer_wheel_insert(&ev->timer);
+
+    } else {
+        ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+    }
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 
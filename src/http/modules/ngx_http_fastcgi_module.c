@@ -27,6 +27,8 @@ typedef struct {
     ngx_hash_t                     headers_hash;
     ngx_uint_t                     header_params;
 
+    ngx_flag_t                     keep_conn;
+
 #if (NGX_HTTP_CACHE)
     ngx_http_complex_value_t       cache_key;
 #endif
@@ -71,6 +73,9 @@ typedef struct {
 
     ngx_array_t                   *split_parts;
 
+    ngx_chain_t                   *free;
+    ngx_chain_t                   *busy;
+
     ngx_str_t                      script_name;
     ngx_str_t                      path_info;
 } ngx_http_fastcgi_ctx_t;
@@ -78,6 +83,8 @@ typedef struct {
 
 #define NGX_HTTP_FASTCGI_RESPONDER      1
 
+#define NGX_HTTP_FASTCGI_KEEP_CONN      1
+
 #define NGX_HTTP_FASTCGI_BEGIN_REQUEST  1
 #define NGX_HTTP_FASTCGI_ABORT_REQUEST  2
 #define NGX_HTTP_FASTCGI_END_REQUEST    3
@@ -129,8 +136,13 @@ static ngx_int_t ngx_http_fastcgi_eval(ngx_http_request_t *r,
 static ngx_int_t ngx_http_fastcgi_create_key(ngx_http_request_t *r);
 #endif
 static ngx_int_t ngx_http_fastcgi_create_request(ngx_http_request_t *r);
+static ngx_int_t ngx_http_fastcgi_body_output_filter(void *data,
+    ngx_chain_t *in);
+static ngx_chain_t *ngx_http_fastcgi_get_buf(ngx_http_request_t *r,
+    ngx_http_fastcgi_ctx_t *f);
 static ngx_int_t ngx_http_fastcgi_reinit_request(ngx_http_request_t *r);
 static ngx_int_t ngx_http_fastcgi_process_header(ngx_http_request_t *r);
+static ngx_int_t ngx_http_fastcgi_input_filter_init(void *data);
 static ngx_int_t ngx_http_fastcgi_input_filter(ngx_event_pipe_t *p,
     ngx_buf_t *buf);
 static ngx_int_t ngx_http_fastcgi_process_record(ngx_http_request_t *r,
@@ -283,6 +295,20 @@ static ngx_command_t  ngx_http_fastcgi_commands[] = {
       offsetof(ngx_http_fastcgi_loc_conf_t, upstream.pass_request_body),
       NULL },
 
+    { ngx_string("fastcgi_request_buffering"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_fastcgi_loc_conf_t, upstream.request_buffering),
+      NULL },
+
+    { ngx_string("fastcgi_keep_conn"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_fastcgi_loc_conf_t, keep_conn),
+      NULL },
+
     { ngx_string("fastcgi_intercept_errors"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
       ngx_conf_set_flag_slot,
@@ -376,6 +402,34 @@ static ngx_command_t  ngx_http_fastcgi_commands[] = {
       offsetof(ngx_http_fastcgi_loc_conf_t, upstream.cache_methods),
       &ngx_http_upstream_cache_method_mask },
 
+    { ngx_string("fastcgi_cache_lock"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_fastcgi_loc_conf_t, upstream.cache_lock),
+      NULL },
+
+    { ngx_string("fastcgi_cache_lock_timeout"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_fastcgi_loc_conf_t, upstream.cache_lock_timeout),
+      NULL },
+
+    { ngx_string("fastcgi_cache_background_update"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_fastcgi_loc_conf_t, upstream.cache_background_update),
+      NULL },
+
+    { ngx_string("fastcgi_cache_revalidate"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_fastcgi_loc_conf_t, upstream.cache_revalidate),
+      NULL },
+
 #endif
 
     { ngx_string("fastcgi_temp_path"),
@@ -604,6 +658,17 @@ ngx_http_fastcgi_handler(ngx_http_request_t *r)
     u->pipe->input_filter = ngx_http_fastcgi_input_filter;
     u->pipe->input_ctx = r;
 
+    u->input_filter_init = ngx_http_fastcgi_input_filter_init;
+
+    if (!flcf->upstream.request_buffering
+        && flcf->upstream.pass_request_body)
+    {
+        r->request_body_no_buffering = 1;
+
+        u->output.output_filter = ngx_http_fastcgi_body_output_filter;
+        u->output.filter_ctx = r;
+    }
+
     rc = ngx_http_read_client_request_body(r, ngx_http_upstream_init);
 
     if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
@@ -848,6 +913,11 @@ ngx_http_fastcgi_create_request(ngx_http_request_t *r)
     ngx_memcpy(b->pos, &ngx_http_fastcgi_request_start,
                sizeof(ngx_http_fastcgi_request_start_t));
 
+    if (flcf->keep_conn) {
+        ((ngx_http_fastcgi_request_start_t *) b->pos)->br.flags =
+                                                    NGX_HTTP_FASTCGI_KEEP_CONN;
+    }
+
     h = (ngx_http_fastcgi_header_t *)
              (b->pos + sizeof(ngx_http_fastcgi_header_t)
                      + sizeof(ngx_http_fastcgi_begin_request_t));
@@ -1109,6 +1179,16 @@ ngx_http_fastcgi_create_request(ngx_http_request_t *r)
         r->upstream->request_bufs = cl;
     }
 
+    if (r->request_body_no_buffering) {
+
+        /* the body is sent by ngx_http_fastcgi_body_output_filter() */
+
+        b->last -= sizeof(ngx_http_fastcgi_header_t);
+        cl->next = NULL;
+
+        return NGX_OK;
+    }
+
     h->version = 1;
     h->type = NGX_HTTP_FASTCGI_STDIN;
     h->request_id_hi = 0;
@@ -1124,6 +1204,150 @@ ngx_http_fastcgi_create_request(ngx_http_request_t *r)
 }
 
 
+static ngx_int_t
+ngx_http_fastcgi_body_output_filter(void *data, ngx_chain_t *in)
+{
+    ngx_http_request_t  *r = data;
+
+    u_char                     *pos;
+    size_t                      len;
+    ngx_int_t                   rc;
+    ngx_buf_t                  *b;
+    ngx_chain_t                *cl, *out, **ll;
+    ngx_http_fastcgi_ctx_t     *f;
+    ngx_http_fastcgi_header_t  *h;
+
+    if (!r->request_body_no_buffering) {
+
+        /*
+         * the body was already read or discarded, so it has been buffered
+         * and the request was made with the STDIN records as usual
+         */
+
+        return ngx_chain_writer(&r->upstream->writer, in);
+    }
+
+    f = ngx_http_get_module_ctx(r, ngx_http_fastcgi_module);
+
+    out = NULL;
+    ll = &out;
+
+    for ( /* void */ ; in; in = in->next) {
+
+        b = in->buf;
+
+        if (b->tag != (ngx_buf_tag_t) &ngx_http_fastcgi_module) {
+
+            /* the records made by ngx_http_fastcgi_create_request() */
+
+            cl = ngx_alloc_chain_link(r->pool);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            cl->buf = b;
+            *ll = cl;
+            ll = &cl->next;
+
+            continue;
+        }
+
+        /* a part of the unbuffered body, the last one ends with empty record */
+
+        for (pos = b->pos; pos < b->last || b->last_buf; pos += len) {
+
+            len = b->last - pos;
+
+            if (len > 32 * 1024) {
+                len = 32 * 1024;
+            }
+
+            cl = ngx_http_fastcgi_get_buf(r, f);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            h = (ngx_http_fastcgi_header_t *) cl->buf->last;
+            cl->buf->last += sizeof(ngx_http_fastcgi_header_t);
+
+            h->version = 1;
+            h->type = NGX_HTTP_FASTCGI_STDIN;
+            h->request_id_hi = 0;
+            h->request_id_lo = 1;
+            h->content_length_hi = (u_char) ((len >> 8) & 0xff);
+            h->content_length_lo = (u_char) (len & 0xff);
+            h->padding_length = 0;
+            h->reserved = 0;
+
+            *ll = cl;
+            ll = &cl->next;
+
+            if (len == 0) {
+                break;
+            }
+
+            cl = ngx_http_fastcgi_get_buf(r, f);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            cl->buf->pos = pos;
+            cl->buf->last = pos + len;
+
+            *ll = cl;
+            ll = &cl->next;
+        }
+
+        b->pos = b->last;
+    }
+
+    *ll = NULL;
+
+    rc = ngx_chain_writer(&r->upstream->writer, out);
+
+    ngx_chain_update_chains(&f->free, &f->busy, &out,
+                            (ngx_buf_tag_t) &ngx_http_fastcgi_module);
+
+    return rc;
+}
+
+
+static ngx_chain_t *
+ngx_http_fastcgi_get_buf(ngx_http_request_t *r, ngx_http_fastcgi_ctx_t *f)
+{
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    cl = ngx_chain_get_free_buf(r->pool, &f->free);
+    if (cl == NULL) {
+        return NULL;
+    }
+
+    b = cl->buf;
+
+    if (b->start == NULL) {
+
+        /*
+         * every buf has room for a record header, a buf that has pointed
+         * to the body data is reset to this room when it is freed
+         */
+
+        b->start = ngx_palloc(r->pool, sizeof(ngx_http_fastcgi_header_t));
+        if (b->start == NULL) {
+            return NULL;
+        }
+
+        b->pos = b->start;
+        b->last = b->start;
+        b->end = b->start + sizeof(ngx_http_fastcgi_header_t);
+        b->temporary = 1;
+        b->tag = (ngx_buf_tag_t) &ngx_http_fastcgi_module;
+    }
+
+    return cl;
+}
+
+
 static ngx_int_t
 ngx_http_fastcgi_reinit_request(ngx_http_request_t *r)
 {
@@ -1139,6 +1363,8 @@ ngx_http_fastcgi_reinit_request(ngx_http_request_t *r)
     f->fastcgi_stdout = 0;
     f->large_stderr = 0;
 
+    f->busy = NULL;
+
     return NGX_OK;
 }
 
@@ -1577,6 +1803,27 @@ ngx_http_fastcgi_process_header(ngx_http_request_t *r)
 }
 
 
+static ngx_int_t
+ngx_http_fastcgi_input_filter_init(void *data)
+{
+    ngx_http_request_t  *r = data;
+
+    ngx_http_fastcgi_loc_conf_t  *flcf;
+
+    flcf = ngx_http_get_module_loc_conf(r, ngx_http_fastcgi_module);
+
+    /*
+     * a kept connection is not closed by the FastCGI server,
+     * so the pipe reads until the end request record only
+     */
+
+    r->upstream->pipe->length = flcf->keep_conn ?
+                                (off_t) sizeof(ngx_http_fastcgi_header_t) : -1;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_fastcgi_input_filter(ngx_event_pipe_t *p, ngx_buf_t *buf)
 {
@@ -1584,8 +1831,9 @@ ngx_http_fastcgi_input_filter(ngx_event_pipe_t *p, ngx_buf_t *buf)
     ngx_int_t                rc;
     ngx_buf_t               *b, **prev;
     ngx_chain_t             *cl;
-    ngx_http_request_t      *r;
-    ngx_http_fastcgi_ctx_t  *f;
+    ngx_http_request_t           *r;
+    ngx_http_fastcgi_ctx_t       *f;
+    ngx_http_fastcgi_loc_conf_t  *flcf;
 
     if (buf->pos == buf->last) {
         return NGX_OK;
@@ -1593,6 +1841,7 @@ ngx_http_fastcgi_input_filter(ngx_event_pipe_t *p, ngx_buf_t *buf)
 
     r = p->input_ctx;
     f = ngx_http_get_module_ctx(r, ngx_http_fastcgi_module);
+    flcf = ngx_http_get_module_loc_conf(r, ngx_http_fastcgi_module);
 
     b = NULL;
     prev = &buf->shadow;
@@ -1614,22 +1863,36 @@ ngx_http_fastcgi_input_filter(ngx_event_pipe_t *p, ngx_buf_t *buf)
             }
 
             if (f->type == NGX_HTTP_FASTCGI_STDOUT && f->length == 0) {
-                f->state = ngx_http_fastcgi_st_version;
-                p->upstream_done = 1;
 
                 ngx_log_debug0(NGX_LOG_DEBUG_HTTP, p->log, 0,
                                "http fastcgi closed stdout");
 
+                if (flcf->keep_conn) {
+
+                    /* the end request record is still to be read */
+
+                    f->state = ngx_http_fastcgi_st_padding;
+                    continue;
+                }
+
+                f->state = ngx_http_fastcgi_st_version;
+                p->upstream_done = 1;
+
                 continue;
             }
 
             if (f->type == NGX_HTTP_FASTCGI_END_REQUEST) {
-                f->state = ngx_http_fastcgi_st_version;
-                p->upstream_done = 1;
 
                 ngx_log_debug0(NGX_LOG_DEBUG_HTTP, p->log, 0,
                                "http fastcgi sent end request");
 
+                if (flcf->keep_conn) {
+                    continue;
+                }
+
+                f->state = ngx_http_fastcgi_st_version;
+                p->upstream_done = 1;
+
                 break;
             }
         }
@@ -1637,6 +1900,31 @@ ngx_http_fastcgi_input_filter(ngx_event_pipe_t *p, ngx_buf_t *buf)
 
         if (f->state == ngx_http_fastcgi_st_padding) {
 
+            if (f->type == NGX_HTTP_FASTCGI_END_REQUEST) {
+
+                if (f->pos + f->padding < f->last) {
+
+                    /* the server has sent something after the request */
+
+                    f->state = ngx_http_fastcgi_st_version;
+                    p->upstream_done = 1;
+
+                    break;
+                }
+
+                if (f->pos + f->padding == f->last) {
+                    f->state = ngx_http_fastcgi_st_version;
+                    p->upstream_done = 1;
+                    r->upstream->keepalive = 1;
+
+                    break;
+                }
+
+                f->padding -= f->last - f->pos;
+
+                break;
+            }
+
             if (f->pos + f->padding < f->last) {
                 f->state = ngx_http_fastcgi_st_version;
                 f->pos += f->padding;
@@ -1658,6 +1946,20 @@ ngx_http_fastcgi_input_filter(ngx_event_pipe_t *p, ngx_buf_t *buf)
 
         /* f->state == ngx_http_fastcgi_st_data */
 
+        if (f->type == NGX_HTTP_FASTCGI_END_REQUEST) {
+
+            if (f->pos + f->length <= f->last) {
+                f->state = ngx_http_fastcgi_st_padding;
+                f->pos += f->length;
+
+                continue;
+            }
+
+            f->length -= f->last - f->pos;
+
+            break;
+        }
+
         if (f->type == NGX_HTTP_FASTCGI_STDERR) {
 
             if (f->length) {
@@ -1787,6 +2089,21 @@ ngx_http_fastcgi_input_filter(ngx_event_pipe_t *p, ngx_buf_t *buf)
 
     }
 
+    if (flcf->keep_conn) {
+
+        /* the least amount of data that is worth passing to the filter */
+
+        if (f->state == ngx_http_fastcgi_st_padding && f->padding) {
+            p->length = f->padding;
+
+        } else if (f->state == ngx_http_fastcgi_st_data && f->length) {
+            p->length = f->length;
+
+        } else {
+            p->length = 1;
+        }
+    }
+
     if (b) {
         b->shadow = buf;
         b->last_shadow = 1;
@@ -1998,10 +2315,15 @@ ngx_http_fastcgi_create_loc_conf(ngx_conf_t *cf)
 
     conf->upstream.pass_request_headers = NGX_CONF_UNSET;
     conf->upstream.pass_request_body = NGX_CONF_UNSET;
+    conf->upstream.request_buffering = NGX_CONF_UNSET;
 
 #if (NGX_HTTP_CACHE)
     conf->upstream.cache = NGX_CONF_UNSET_PTR;
     conf->upstream.cache_min_uses = NGX_CONF_UNSET_UINT;
+    conf->upstream.cache_lock = NGX_CONF_UNSET;
+    conf->upstream.cache_lock_timeout = NGX_CONF_UNSET_MSEC;
+    conf->upstream.cache_background_update = NGX_CONF_UNSET;
+    conf->upstream.cache_revalidate = NGX_CONF_UNSET;
     conf->upstream.cache_bypass = NGX_CONF_UNSET_PTR;
     conf->upstream.no_cache = NGX_CONF_UNSET_PTR;
     conf->upstream.cache_valid = NGX_CONF_UNSET_PTR;
@@ -2012,6 +2334,8 @@ ngx_http_fastcgi_create_loc_conf(ngx_conf_t *cf)
 
     conf->upstream.intercept_errors = NGX_CONF_UNSET;
 
+    conf->keep_conn = NGX_CONF_UNSET;
+
     /* "fastcgi_cyclic_temp_file" is disabled */
     conf->upstream.cyclic_temp_file = 0;
 
@@ -2225,6 +2549,18 @@ ngx_http_fastcgi_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
     conf->upstream.cache_methods |= NGX_HTTP_GET|NGX_HTTP_HEAD;
 
+    ngx_conf_merge_value(conf->upstream.cache_lock,
+                              prev->upstream.cache_lock, 0);
+
+    ngx_conf_merge_msec_value(conf->upstream.cache_lock_timeout,
+                              prev->upstream.cache_lock_timeout, 5000);
+
+    ngx_conf_merge_value(conf->upstream.cache_background_update,
+                              prev->upstream.cache_background_update, 0);
+
+    ngx_conf_merge_value(conf->upstream.cache_revalidate,
+                              prev->upstream.cache_revalidate, 0);
+
     ngx_conf_merge_ptr_value(conf->upstream.cache_bypass,
                              prev->upstream.cache_bypass, NULL);
 
@@ -2251,9 +2587,14 @@ ngx_http_fastcgi_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->upstream.pass_request_body,
                               prev->upstream.pass_request_body, 1);
 
+    ngx_conf_merge_value(conf->upstream.request_buffering,
+                              prev->upstream.request_buffering, 1);
+
     ngx_conf_merge_value(conf->upstream.intercept_errors,
                               prev->upstream.intercept_errors, 0);
 
+    ngx_conf_merge_value(conf->keep_conn, prev->keep_conn, 0);
+
     ngx_conf_merge_ptr_value(conf->catch_stderr, prev->catch_stderr, NULL);
 
 
@@ -13,6 +13,7 @@
 typedef struct {
     ngx_http_upstream_conf_t   upstream;
     ngx_int_t                  index;
+    ngx_uint_t                 protocol;
 } ngx_http_memcached_loc_conf_t;
 
 
@@ -24,10 +25,15 @@ typedef struct {
 
 
 static ngx_int_t ngx_http_memcached_create_request(ngx_http_request_t *r);
+static ngx_int_t ngx_http_memcached_create_binary_request(
+    ngx_http_request_t *r, ngx_http_variable_value_t *vv);
 static ngx_int_t ngx_http_memcached_reinit_request(ngx_http_request_t *r);
 static ngx_int_t ngx_http_memcached_process_header(ngx_http_request_t *r);
+static ngx_int_t ngx_http_memcached_process_binary_header(
+    ngx_http_request_t *r);
 static ngx_int_t ngx_http_memcached_filter_init(void *data);
 static ngx_int_t ngx_http_memcached_filter(void *data, ssize_t bytes);
+static ngx_int_t ngx_http_memcached_binary_filter(void *data, ssize_t bytes);
 static void ngx_http_memcached_abort_request(ngx_http_request_t *r);
 static void ngx_http_memcached_finalize_request(ngx_http_request_t *r,
     ngx_int_t rc);
@@ -50,6 +56,16 @@ static ngx_conf_bitmask_t  ngx_http_memcached_next_upstream_masks[] = {
 };
 
 
+#define NGX_HTTP_MEMCACHED_TEXT              0
+#define NGX_HTTP_MEMCACHED_BINARY            1
+
+static ngx_conf_enum_t  ngx_http_memcached_protocols[] = {
+    { ngx_string("text"), NGX_HTTP_MEMCACHED_TEXT },
+    { ngx_string("binary"), NGX_HTTP_MEMCACHED_BINARY },
+    { ngx_null_string, 0 }
+};
+
+
 static ngx_command_t  ngx_http_memcached_commands[] = {
 
     { ngx_string("memcached_pass"),
@@ -101,6 +117,13 @@ static ngx_command_t  ngx_http_memcached_commands[] = {
       offsetof(ngx_http_memcached_loc_conf_t, upstream.next_upstream),
       &ngx_http_memcached_next_upstream_masks },
 
+    { ngx_string("memcached_protocol"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_memcached_loc_conf_t, protocol),
+      &ngx_http_memcached_protocols },
+
       ngx_null_command
 };
 
@@ -143,6 +166,20 @@ static ngx_str_t  ngx_http_memcached_key = ngx_string("memcached_key");
 static u_char  ngx_http_memcached_end[] = CRLF "END" CRLF;
 
 
+/* the binary protocol, the header fields are in network byte order */
+
+#define NGX_HTTP_MEMCACHED_HEADER_LEN        24
+#define NGX_HTTP_MEMCACHED_MAX_KEY           250
+
+#define NGX_HTTP_MEMCACHED_MAGIC_REQUEST     0x80
+#define NGX_HTTP_MEMCACHED_MAGIC_RESPONSE    0x81
+
+#define NGX_HTTP_MEMCACHED_GETK              0x0c
+
+#define NGX_HTTP_MEMCACHED_STATUS_OK         0x0000
+#define NGX_HTTP_MEMCACHED_STATUS_NOT_FOUND  0x0001
+
+
 static ngx_int_t
 ngx_http_memcached_handler(ngx_http_request_t *r)
 {
@@ -180,7 +217,14 @@ ngx_http_memcached_handler(ngx_http_request_t *r)
 
     u->create_request = ngx_http_memcached_create_request;
     u->reinit_request = ngx_http_memcached_reinit_request;
-    u->process_header = ngx_http_memcached_process_header;
+
+    if (mlcf->protocol == NGX_HTTP_MEMCACHED_BINARY) {
+        u->process_header = ngx_http_memcached_process_binary_header;
+
+    } else {
+        u->process_header = ngx_http_memcached_process_header;
+    }
+
     u->abort_request = ngx_http_memcached_abort_request;
     u->finalize_request = ngx_http_memcached_finalize_request;
 
@@ -195,7 +239,14 @@ ngx_http_memcached_handler(ngx_http_request_t *r)
     ngx_http_set_ctx(r, ctx, ngx_http_memcached_module);
 
     u->input_filter_init = ngx_http_memcached_filter_init;
-    u->input_filter = ngx_http_memcached_filter;
+
+    if (mlcf->protocol == NGX_HTTP_MEMCACHED_BINARY) {
+        u->input_filter = ngx_http_memcached_binary_filter;
+
+    } else {
+        u->input_filter = ngx_http_memcached_filter;
+    }
+
     u->input_filter_ctx = ctx;
 
     r->main->count++;
@@ -227,6 +278,10 @@ ngx_http_memcached_create_request(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
+    if (mlcf->protocol == NGX_HTTP_MEMCACHED_BINARY) {
+        return ngx_http_memcached_create_binary_request(r, vv);
+    }
+
     escape = 2 * ngx_escape_uri(NULL, vv->data, vv->len, NGX_ESCAPE_MEMCACHED);
 
     len = sizeof("get ") - 1 + vv->len + escape + sizeof(CRLF) - 1;
@@ -271,9 +326,80 @@ ngx_http_memcached_create_request(ngx_http_request_t *r)
 }
 
 
+static ngx_int_t
+ngx_http_memcached_create_binary_request(ngx_http_request_t *r,
+    ngx_http_variable_value_t *vv)
+{
+    u_char                    *p;
+    ngx_buf_t                 *b;
+    ngx_chain_t               *cl;
+    ngx_http_memcached_ctx_t  *ctx;
+
+    /* keys are sent as is, they need no escaping in the binary protocol */
+
+    if (vv->len > NGX_HTTP_MEMCACHED_MAX_KEY) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "the \"$memcached_key\" variable is too long");
+        return NGX_ERROR;
+    }
+
+    b = ngx_create_temp_buf(r->pool, NGX_HTTP_MEMCACHED_HEADER_LEN + vv->len);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    cl->buf = b;
+    cl->next = NULL;
+
+    r->upstream->request_bufs = cl;
+
+    /*
+     * a GETK request: no extras, the key is both the key and the whole
+     * body, the opaque and the cas are zero; GETK makes memcached return
+     * the key, so the response can be checked as in the text protocol
+     */
+
+    p = b->last;
+
+    ngx_memzero(p, NGX_HTTP_MEMCACHED_HEADER_LEN);
+
+    p[0] = NGX_HTTP_MEMCACHED_MAGIC_REQUEST;
+    p[1] = NGX_HTTP_MEMCACHED_GETK;
+    p[2] = (u_char) (vv->len >> 8);
+    p[3] = (u_char) vv->len;
+    p[10] = (u_char) (vv->len >> 8);
+    p[11] = (u_char) vv->len;
+
+    b->last += NGX_HTTP_MEMCACHED_HEADER_LEN;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_memcached_module);
+
+    ctx->key.data = b->last;
+    ctx->key.len = vv->len;
+
+    b->last = ngx_copy(b->last, vv->data, vv->len);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http memcached binary request: \"%V\"", &ctx->key);
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_memcached_reinit_request(ngx_http_request_t *r)
 {
+    ngx_http_memcached_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_memcached_module);
+
+    ctx->rest = NGX_HTTP_MEMCACHED_END;
+
     return NGX_OK;
 }
 
@@ -368,6 +494,10 @@ found:
         u->headers_in.status_n = 404;
         u->state->status = 404;
 
+        /* the connection can be cached if nothing follows "END" */
+
+        u->keepalive = (p + sizeof("END" CRLF) - 1 == u->buffer.last);
+
         return NGX_OK;
     }
 
@@ -380,6 +510,111 @@ no_valid:
 }
 
 
+static ngx_int_t
+ngx_http_memcached_process_binary_header(ngx_http_request_t *r)
+{
+    u_char                    *p, *key;
+    size_t                     extlen, keylen, bodylen;
+    ngx_uint_t                 status;
+    ngx_http_upstream_t       *u;
+    ngx_http_memcached_ctx_t  *ctx;
+
+    u = r->upstream;
+
+    if (u->buffer.last - u->buffer.pos < NGX_HTTP_MEMCACHED_HEADER_LEN) {
+        return NGX_AGAIN;
+    }
+
+    p = u->buffer.pos;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_memcached_module);
+
+    if (p[0] != NGX_HTTP_MEMCACHED_MAGIC_RESPONSE
+        || p[1] != NGX_HTTP_MEMCACHED_GETK)
+    {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "memcached sent invalid binary response header "
+                      "magic:%02Xd opcode:%02Xd for key \"%V\"",
+                      p[0], p[1], &ctx->key);
+        return NGX_HTTP_UPSTREAM_INVALID_HEADER;
+    }
+
+    keylen = (p[2] << 8) + p[3];
+    extlen = p[4];
+    status = (p[6] << 8) + p[7];
+    bodylen = ((size_t) p[8] << 24) + (p[9] << 16) + (p[10] << 8) + p[11];
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "memcached: status:%ui extras:%uz key:%uz body:%uz",
+                   status, extlen, keylen, bodylen);
+
+    if (extlen + keylen > bodylen) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "memcached sent invalid binary response length %uz "
+                      "for key \"%V\"", bodylen, &ctx->key);
+        return NGX_HTTP_UPSTREAM_INVALID_HEADER;
+    }
+
+    if (status == NGX_HTTP_MEMCACHED_STATUS_OK) {
+
+        if ((size_t) (u->buffer.last - p)
+            < NGX_HTTP_MEMCACHED_HEADER_LEN + extlen + keylen)
+        {
+            return NGX_AGAIN;
+        }
+
+        key = p + NGX_HTTP_MEMCACHED_HEADER_LEN + extlen;
+
+        if (keylen != ctx->key.len
+            || ngx_strncmp(key, ctx->key.data, keylen) != 0)
+        {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "memcached sent invalid key in binary response "
+                          "for key \"%V\"", &ctx->key);
+            return NGX_HTTP_UPSTREAM_INVALID_HEADER;
+        }
+
+        r->headers_out.content_length_n = bodylen - extlen - keylen;
+
+        u->headers_in.status_n = 200;
+        u->state->status = 200;
+        u->buffer.pos = key + keylen;
+
+        if (r->headers_out.content_length_n == 0) {
+            u->keepalive = (u->buffer.pos == u->buffer.last);
+        }
+
+        return NGX_OK;
+    }
+
+    /* an error response is read completely, it is small */
+
+    if ((size_t) (u->buffer.last - p) < NGX_HTTP_MEMCACHED_HEADER_LEN + bodylen)
+    {
+        return NGX_AGAIN;
+    }
+
+    if (status == NGX_HTTP_MEMCACHED_STATUS_NOT_FOUND) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "key: \"%V\" was not found by memcached", &ctx->key);
+
+        u->headers_in.status_n = 404;
+        u->state->status = 404;
+
+        u->keepalive = ((size_t) (u->buffer.last - p)
+                        == NGX_HTTP_MEMCACHED_HEADER_LEN + bodylen);
+
+        return NGX_OK;
+    }
+
+    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                  "memcached sent error status %ui for key \"%V\"",
+                  status, &ctx->key);
+
+    return NGX_HTTP_UPSTREAM_INVALID_HEADER;
+}
+
+
 static ngx_int_t
 ngx_http_memcached_filter_init(void *data)
 {
@@ -389,7 +624,9 @@ ngx_http_memcached_filter_init(void *data)
 
     u = ctx->request->upstream;
 
-    u->length += NGX_HTTP_MEMCACHED_END;
+    if (u->input_filter == ngx_http_memcached_filter) {
+        u->length += NGX_HTTP_MEMCACHED_END;
+    }
 
     return NGX_OK;
 }
@@ -408,9 +645,10 @@ ngx_http_memcached_filter(void *data, ssize_t bytes)
     u = ctx->request->upstream;
     b = &u->buffer;
 
-    if (u->length == ctx->rest) {
+    if (u->length == (ssize_t) ctx->rest) {
 
-        if (ngx_strncmp(b->last,
+        if ((size_t) bytes > ctx->rest
+            || ngx_strncmp(b->last,
                    ngx_http_memcached_end + NGX_HTTP_MEMCACHED_END - ctx->rest,
                    bytes)
             != 0)
@@ -427,6 +665,10 @@ ngx_http_memcached_filter(void *data, ssize_t bytes)
         u->length -= bytes;
         ctx->rest -= bytes;
 
+        if (ctx->rest == 0) {
+            u->keepalive = 1;
+        }
+
         return NGX_OK;
     }
 
@@ -451,7 +693,7 @@ ngx_http_memcached_filter(void *data, ssize_t bytes)
     cl->buf->tag = u->output.tag;
 
     ngx_log_debug4(NGX_LOG_DEBUG_HTTP, ctx->request->connection->log, 0,
-                   "memcached filter bytes:%z size:%z length:%z rest:%z",
+                   "memcached filter bytes:%z size:%z length:%O rest:%z",
                    bytes, b->last - b->pos, u->length, ctx->rest);
 
     if (bytes <= (ssize_t) (u->length - NGX_HTTP_MEMCACHED_END)) {
@@ -461,12 +703,22 @@ ngx_http_memcached_filter(void *data, ssize_t bytes)
 
     last += u->length - NGX_HTTP_MEMCACHED_END;
 
-    if (ngx_strncmp(last, ngx_http_memcached_end, b->last - last) != 0) {
+    if ((size_t) (b->last - last) > ctx->rest
+        || ngx_strncmp(last, ngx_http_memcached_end, b->last - last) != 0)
+    {
         ngx_log_error(NGX_LOG_ERR, ctx->request->connection->log, 0,
                       "memcached sent invalid trailer");
+
+        ctx->rest = 0;
+
+    } else {
+        ctx->rest -= b->last - last;
+
+        if (ctx->rest == 0) {
+            u->keepalive = 1;
+        }
     }
 
-    ctx->rest -= b->last - last;
     b->last = last;
     cl->buf->last = last;
     u->length = ctx->rest;
@@ -475,6 +727,67 @@ ngx_http_memcached_filter(void *data, ssize_t bytes)
 }
 
 
+static ngx_int_t
+ngx_http_memcached_binary_filter(void *data, ssize_t bytes)
+{
+    ngx_http_memcached_ctx_t  *ctx = data;
+
+    u_char               *last;
+    ngx_buf_t            *b;
+    ngx_chain_t          *cl, **ll;
+    ngx_http_upstream_t  *u;
+
+    u = ctx->request->upstream;
+    b = &u->buffer;
+
+    for (cl = u->out_bufs, ll = &u->out_bufs; cl; cl = cl->next) {
+        ll = &cl->next;
+    }
+
+    cl = ngx_chain_get_free_buf(ctx->request->pool, &u->free_bufs);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    cl->buf->flush = 1;
+    cl->buf->memory = 1;
+
+    *ll = cl;
+
+    last = b->last;
+    cl->buf->pos = last;
+    b->last += bytes;
+    cl->buf->last = b->last;
+    cl->buf->tag = u->output.tag;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ctx->request->connection->log, 0,
+                   "memcached binary filter bytes:%z size:%z length:%O",
+                   bytes, b->last - b->pos, u->length);
+
+    if (bytes < u->length) {
+        u->length -= bytes;
+        return NGX_OK;
+    }
+
+    if (bytes > u->length) {
+        ngx_log_error(NGX_LOG_ERR, ctx->request->connection->log, 0,
+                      "memcached sent more data than specified in "
+                      "binary response for key \"%V\"", &ctx->key);
+
+        last += u->length;
+        b->last = last;
+        cl->buf->last = last;
+
+    } else {
+        u->keepalive = 1;
+    }
+
+    u->length = 0;
+
+    return NGX_OK;
+}
+
+
 static void
 ngx_http_memcached_abort_request(ngx_http_request_t *r)
 {
@@ -534,6 +847,7 @@ ngx_http_memcached_create_loc_conf(ngx_conf_t *cf)
     conf->upstream.pass_request_body = 0;
 
     conf->index = NGX_CONF_UNSET;
+    conf->protocol = NGX_CONF_UNSET_UINT;
 
     return conf;
 }
@@ -577,6 +891,9 @@ ngx_http_memcached_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
         conf->index = prev->index;
     }
 
+    ngx_conf_merge_uint_value(conf->protocol, prev->protocol,
+                              NGX_HTTP_MEMCACHED_TEXT);
+
     return NGX_CONF_OK;
 }
 
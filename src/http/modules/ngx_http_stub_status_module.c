@@ -60,11 +60,20 @@ ngx_module_t  ngx_http_stub_status_module = {
 
 static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r)
 {
-    size_t             size;
-    ngx_int_t          rc;
-    ngx_buf_t         *b;
-    ngx_chain_t        out;
-    ngx_atomic_int_t   ap, hn, ac, rq, rd, wr;
+    size_t                size;
+    ngx_int_t             rc;
+    ngx_buf_t            *b;
+    ngx_uint_t            i;
+    ngx_chain_t           out;
+    ngx_list_part_t      *part;
+    ngx_shm_zone_t       *shm_zone;
+    ngx_stat_counter_t   *counter;
+    ngx_slab_pool_t      *sp;
+    ngx_listening_t      *ls;
+    ngx_atomic_int_t      ap, hn, ac, rq, rd, wr;
+#if (NGX_HAVE_TCP_INFO)
+    ngx_uint_t            queue, backlog;
+#endif
 
     if (r->method != NGX_HTTP_GET && r->method != NGX_HTTP_HEAD) {
         return NGX_HTTP_NOT_ALLOWED;
@@ -93,6 +102,43 @@ static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r)
            + 6 + 3 * NGX_ATOMIC_T_LEN
            + sizeof("Reading:  Writing:  Waiting:  \n") + 3 * NGX_ATOMIC_T_LEN;
 
+    if (ngx_use_accept_mutex) {
+        size += sizeof("accept mutex: acquired  spins  sleeps \n")
+                + 3 * NGX_ATOMIC_T_LEN;
+    }
+
+    ls = ngx_cycle->listening.elts;
+
+    for (i = 0; i < ngx_cycle->listening.nelts; i++) {
+        size += sizeof("listen : queue  backlog \n") + ls[i].addr_text.len
+                + 2 * NGX_INT_T_LEN;
+    }
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        size += sizeof("zone \"\": acquired  spins  sleeps  huge pages\n")
+                + shm_zone[i].shm.name.len + 3 * NGX_ATOMIC_T_LEN;
+    }
+
+    counter = ngx_cycle->stat_counters.elts;
+
+    for (i = 0; i < ngx_cycle->stat_counters.nelts; i++) {
+        size += sizeof("counter \"\": \n") + counter[i].name.len
+                + NGX_ATOMIC_T_LEN;
+    }
+
     b = ngx_create_temp_buf(r->pool, size);
     if (b == NULL) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
@@ -101,12 +147,12 @@ static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r)
     out.buf = b;
     out.next = NULL;
 
-    ap = *ngx_stat_accepted;
-    hn = *ngx_stat_handled;
-    ac = *ngx_stat_active;
-    rq = *ngx_stat_requests;
-    rd = *ngx_stat_reading;
-    wr = *ngx_stat_writing;
+    ap = ngx_stat_value(ngx_stat_accepted);
+    hn = ngx_stat_value(ngx_stat_handled);
+    ac = ngx_stat_value(ngx_stat_active);
+    rq = ngx_stat_value(ngx_stat_requests);
+    rd = ngx_stat_value(ngx_stat_reading);
+    wr = ngx_stat_value(ngx_stat_writing);
 
     b->last = ngx_sprintf(b->last, "Active connections: %uA \n", ac);
 
@@ -118,6 +164,70 @@ static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r)
     b->last = ngx_sprintf(b->last, "Reading: %uA Writing: %uA Waiting: %uA \n",
                           rd, wr, ac - (rd + wr));
 
+    /* the contention counters of the shared memory mutexes */
+
+    if (ngx_use_accept_mutex) {
+        b->last = ngx_sprintf(b->last, "accept mutex: acquired %uA spins %uA "
+                              "sleeps %uA \n",
+                              ngx_accept_mutex.sh->acquired,
+                              ngx_accept_mutex.sh->spins,
+                              ngx_accept_mutex.sh->sleeps);
+    }
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        sp = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
+
+        b->last = ngx_sprintf(b->last, "zone \"%V\": acquired %uA spins %uA "
+                              "sleeps %uA%s \n",
+                              &shm_zone[i].shm.name, sp->lock.acquired,
+                              sp->lock.spins, sp->lock.sleeps,
+                              shm_zone[i].shm.huge ? " huge pages" : "");
+    }
+
+#if (NGX_HAVE_TCP_INFO)
+
+    /* the current length of the accept queues */
+
+    for (i = 0; i < ngx_cycle->listening.nelts; i++) {
+
+        if (ngx_tcp_accept_queue(ls[i].fd, &queue, &backlog) != NGX_OK) {
+            continue;
+        }
+
+        b->last = ngx_sprintf(b->last, "listen %V: queue %ui backlog %ui \n",
+                              &ls[i].addr_text, queue, backlog);
+    }
+
+#endif
+
+    /* the counters registered by other modules */
+
+    for (i = 0; i < ngx_cycle->stat_counters.nelts; i++) {
+
+        if (i == ngx_stat_accepted || i == ngx_stat_handled
+            || i == ngx_stat_requests || i == ngx_stat_active
+            || i == ngx_stat_reading || i == ngx_stat_writing)
+        {
+            continue;
+        }
+
+        b->last = ngx_sprintf(b->last, "counter \"%V\": %uA \n",
+                              &counter[i].name, ngx_stat_value(i));
+    }
+
     r->headers_out.status = NGX_HTTP_OK;
     r->headers_out.content_length_n = b->last - b->pos;
 
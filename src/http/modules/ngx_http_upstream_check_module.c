@@ -0,0 +1,950 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_UPSTREAM_CHECK_TCP    0
+#define NGX_HTTP_UPSTREAM_CHECK_HTTP   1
+
+#define NGX_HTTP_UPSTREAM_CHECK_BUFFER_SIZE  1024
+
+
+typedef struct {
+    ngx_atomic_t                          lock;      /* the owner pid */
+
+    ngx_uint_t                            down;
+    ngx_uint_t                            fails;
+    ngx_uint_t                            passes;
+
+    ngx_msec_t                            checked;
+    ngx_msec_t                            up;
+} ngx_http_upstream_check_shared_t;
+
+
+typedef struct {
+    ngx_flag_t                            enable;
+
+    ngx_uint_t                            type;
+    ngx_msec_t                            interval;
+    ngx_msec_t                            timeout;
+    ngx_uint_t                            fails;
+    ngx_uint_t                            passes;
+    ngx_msec_t                            slow_start;
+
+    ngx_str_t                             send;
+    ngx_str_t                            *upstream;
+} ngx_http_upstream_check_srv_conf_t;
+
+
+typedef struct {
+    ngx_http_upstream_check_srv_conf_t   *conf;
+    ngx_http_upstream_check_shared_t     *shared;
+
+    struct sockaddr                      *sockaddr;
+    socklen_t                             socklen;
+    ngx_str_t                             name;
+
+    ngx_event_t                           check_ev;
+    ngx_peer_connection_t                 pc;
+
+    u_char                               *sent;
+    ngx_buf_t                             recv;
+} ngx_http_upstream_check_peer_t;
+
+
+typedef struct {
+    ngx_array_t                           peers;
+    ngx_shm_zone_t                       *shm_zone;
+    ngx_http_upstream_check_shared_t     *shared;
+} ngx_http_upstream_check_main_conf_t;
+
+
+static void ngx_http_upstream_check_begin_handler(ngx_event_t *ev);
+static void ngx_http_upstream_check_connect(
+    ngx_http_upstream_check_peer_t *peer);
+static void ngx_http_upstream_check_send_handler(ngx_event_t *wev);
+static void ngx_http_upstream_check_recv_handler(ngx_event_t *rev);
+static ngx_int_t ngx_http_upstream_check_test_connect(ngx_connection_t *c);
+static ngx_int_t ngx_http_upstream_check_parse_status(ngx_buf_t *b);
+static void ngx_http_upstream_check_finish(ngx_http_upstream_check_peer_t *peer,
+    ngx_uint_t ok);
+static void ngx_http_upstream_check_dummy_handler(ngx_event_t *ev);
+
+static ngx_int_t ngx_http_upstream_check_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_int_t ngx_http_upstream_check_init_process(ngx_cycle_t *cycle);
+
+static void *ngx_http_upstream_check_create_main_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_check_init_main_conf(ngx_conf_t *cf,
+    void *conf);
+static void *ngx_http_upstream_check_create_srv_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_check(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_check_commands[] = {
+
+    { ngx_string("health_check"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_ANY,
+      ngx_http_upstream_check,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_check_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    ngx_http_upstream_check_create_main_conf, /* create main configuration */
+    ngx_http_upstream_check_init_main_conf, /* init main configuration */
+
+    ngx_http_upstream_check_create_srv_conf, /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_check_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_check_module_ctx,   /* module context */
+    ngx_http_upstream_check_commands,      /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_http_upstream_check_init_process,  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+ngx_int_t
+ngx_http_upstream_check_add_peer(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us, ngx_http_upstream_rr_peer_t *peer)
+{
+    ngx_http_upstream_check_peer_t       *cp;
+    ngx_http_upstream_check_srv_conf_t   *ucscf;
+    ngx_http_upstream_check_main_conf_t  *ucmcf;
+
+    /* an upstream implicitly defined by proxy_pass, etc. has no srv_conf */
+
+    if (us->srv_conf == NULL) {
+        return 0;
+    }
+
+    ucscf = ngx_http_conf_upstream_srv_conf(us,
+                                            ngx_http_upstream_check_module);
+
+    if (!ucscf->enable) {
+        return 0;
+    }
+
+    ucmcf = ngx_http_conf_get_module_main_conf(cf,
+                                               ngx_http_upstream_check_module);
+
+    cp = ngx_array_push(&ucmcf->peers);
+    if (cp == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(cp, sizeof(ngx_http_upstream_check_peer_t));
+
+    cp->conf = ucscf;
+    cp->sockaddr = peer->sockaddr;
+    cp->socklen = peer->socklen;
+    cp->name = peer->name;
+
+    return ucmcf->peers.nelts;
+}
+
+
+ngx_uint_t
+ngx_http_upstream_check_peer_down(ngx_uint_t index)
+{
+    ngx_http_upstream_check_main_conf_t  *ucmcf;
+
+    if (index == 0) {
+        return 0;
+    }
+
+    ucmcf = ngx_http_cycle_get_module_main_conf(ngx_cycle,
+                                               ngx_http_upstream_check_module);
+
+    return ucmcf->shared[index - 1].down;
+}
+
+
+ngx_uint_t
+ngx_http_upstream_check_peer_ramp(ngx_uint_t index)
+{
+    ngx_msec_t                            slow_start, elapsed;
+    ngx_http_upstream_check_peer_t       *peer;
+    ngx_http_upstream_check_shared_t     *sh;
+    ngx_http_upstream_check_main_conf_t  *ucmcf;
+
+    if (index == 0) {
+        return 1000;
+    }
+
+    ucmcf = ngx_http_cycle_get_module_main_conf(ngx_cycle,
+                                               ngx_http_upstream_check_module);
+
+    peer = ucmcf->peers.elts;
+    slow_start = peer[index - 1].conf->slow_start;
+
+    sh = &ucmcf->shared[index - 1];
+
+    if (slow_start == 0 || sh->up == 0) {
+        return 1000;
+    }
+
+    elapsed = ngx_current_msec - sh->up;
+
+    if (elapsed >= slow_start) {
+        return 1000;
+    }
+
+    return (ngx_uint_t) (elapsed * 1000 / slow_start) + 1;
+}
+
+
+static void
+ngx_http_upstream_check_begin_handler(ngx_event_t *ev)
+{
+    ngx_msec_t                         tick;
+    ngx_atomic_uint_t                  lock;
+    ngx_http_upstream_check_peer_t    *peer;
+    ngx_http_upstream_check_shared_t  *sh;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    peer = ev->data;
+    sh = peer->shared;
+
+    /*
+     * the timer is not longer than a second, so a worker process
+     * that is shutting down does not wait for it long
+     */
+
+    tick = ngx_min(peer->conf->interval, 1000);
+
+    ngx_add_timer(ev, tick);
+
+    if (peer->pc.connection) {
+        return;
+    }
+
+    if (ngx_current_msec - sh->checked < peer->conf->interval) {
+        return;
+    }
+
+    lock = sh->lock;
+
+    if (lock) {
+
+        /* the owner has probably exited during the check */
+
+        if (ngx_current_msec - sh->checked
+            < peer->conf->interval + peer->conf->timeout)
+        {
+            return;
+        }
+    }
+
+    if (!ngx_atomic_cmp_set(&sh->lock, lock, ngx_pid)) {
+        return;
+    }
+
+    sh->checked = ngx_current_msec;
+
+    ngx_http_upstream_check_connect(peer);
+}
+
+
+static void
+ngx_http_upstream_check_connect(ngx_http_upstream_check_peer_t *peer)
+{
+    ngx_int_t          rc;
+    ngx_connection_t  *c;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "health check connect: %V", &peer->name);
+
+    ngx_memzero(&peer->pc, sizeof(ngx_peer_connection_t));
+
+    peer->pc.sockaddr = peer->sockaddr;
+    peer->pc.socklen = peer->socklen;
+    peer->pc.name = &peer->name;
+    peer->pc.get = ngx_event_get_peer;
+    peer->pc.log = ngx_cycle->log;
+    peer->pc.log_error = NGX_ERROR_ERR;
+    peer->pc.tries = 1;
+
+    rc = ngx_event_connect_peer(&peer->pc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_http_upstream_check_finish(peer, 0);
+        return;
+    }
+
+    /* rc == NGX_OK || rc == NGX_AGAIN */
+
+    c = peer->pc.connection;
+
+    c->data = peer;
+    c->log = ngx_cycle->log;
+    c->sendfile = 0;
+    c->read->log = c->log;
+    c->write->log = c->log;
+
+    c->write->handler = ngx_http_upstream_check_send_handler;
+    c->read->handler = ngx_http_upstream_check_recv_handler;
+
+    peer->sent = peer->conf->send.data;
+    peer->recv.pos = peer->recv.start;
+    peer->recv.last = peer->recv.start;
+
+    /* the timeout covers the whole check */
+
+    ngx_add_timer(c->read, peer->conf->timeout);
+
+    if (rc == NGX_OK) {
+        ngx_http_upstream_check_send_handler(c->write);
+    }
+}
+
+
+static void
+ngx_http_upstream_check_send_handler(ngx_event_t *wev)
+{
+    ssize_t                          n;
+    ngx_connection_t                *c;
+    ngx_http_upstream_check_peer_t  *peer;
+
+    c = wev->data;
+    peer = c->data;
+
+    if (ngx_http_upstream_check_test_connect(c) != NGX_OK) {
+        ngx_http_upstream_check_finish(peer, 0);
+        return;
+    }
+
+    if (peer->conf->type == NGX_HTTP_UPSTREAM_CHECK_TCP) {
+        ngx_http_upstream_check_finish(peer, 1);
+        return;
+    }
+
+    while (peer->sent < peer->conf->send.data + peer->conf->send.len) {
+
+        n = c->send(c, peer->sent,
+                    peer->conf->send.data + peer->conf->send.len - peer->sent);
+
+        if (n == NGX_ERROR) {
+            ngx_http_upstream_check_finish(peer, 0);
+            return;
+        }
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+                ngx_http_upstream_check_finish(peer, 0);
+            }
+
+            return;
+        }
+
+        peer->sent += n;
+    }
+
+    wev->handler = ngx_http_upstream_check_dummy_handler;
+
+    if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+        ngx_http_upstream_check_finish(peer, 0);
+        return;
+    }
+
+    if (c->read->ready) {
+        ngx_http_upstream_check_recv_handler(c->read);
+    }
+}
+
+
+static void
+ngx_http_upstream_check_recv_handler(ngx_event_t *rev)
+{
+    ssize_t                          n;
+    ngx_int_t                        status;
+    ngx_buf_t                       *b;
+    ngx_connection_t                *c;
+    ngx_http_upstream_check_peer_t  *peer;
+
+    c = rev->data;
+    peer = c->data;
+
+    if (rev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                      "health check of %V in upstream \"%V\" timed out",
+                      &peer->name, peer->conf->upstream);
+
+        ngx_http_upstream_check_finish(peer, 0);
+        return;
+    }
+
+    if (peer->sent < peer->conf->send.data + peer->conf->send.len) {
+
+        /* the request is not sent yet */
+
+        if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+            ngx_http_upstream_check_finish(peer, 0);
+        }
+
+        return;
+    }
+
+    b = &peer->recv;
+
+    for ( ;; ) {
+
+        n = c->recv(c, b->last, b->end - b->last);
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+                ngx_http_upstream_check_finish(peer, 0);
+            }
+
+            return;
+        }
+
+        if (n == NGX_ERROR || n == 0) {
+            ngx_http_upstream_check_finish(peer, 0);
+            return;
+        }
+
+        b->last += n;
+
+        status = ngx_http_upstream_check_parse_status(b);
+
+        if (status == NGX_AGAIN) {
+            if (b->last == b->end) {
+                ngx_http_upstream_check_finish(peer, 0);
+                return;
+            }
+
+            continue;
+        }
+
+        if (status == NGX_ERROR) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "health check of %V in upstream \"%V\" "
+                          "got an invalid response",
+                          &peer->name, peer->conf->upstream);
+
+            ngx_http_upstream_check_finish(peer, 0);
+            return;
+        }
+
+        if (status < NGX_HTTP_OK || status >= NGX_HTTP_BAD_REQUEST) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "health check of %V in upstream \"%V\" "
+                          "got status %i",
+                          &peer->name, peer->conf->upstream, status);
+
+            ngx_http_upstream_check_finish(peer, 0);
+            return;
+        }
+
+        ngx_http_upstream_check_finish(peer, 1);
+        return;
+    }
+}
+
+
+static ngx_int_t
+ngx_http_upstream_check_test_connect(ngx_connection_t *c)
+{
+    int        err;
+    socklen_t  len;
+
+    if (c->write->timedout || c->read->timedout) {
+        return NGX_ERROR;
+    }
+
+    err = 0;
+    len = sizeof(int);
+
+    /*
+     * BSDs and Linux return 0 and set a pending error in err
+     * Solaris returns -1 and sets errno
+     */
+
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len) == -1) {
+        err = ngx_errno;
+    }
+
+    if (err) {
+        (void) ngx_connection_error(c, err, "connect() failed");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+/* only the status code of "HTTP/x.y NNN ..." is needed */
+
+static ngx_int_t
+ngx_http_upstream_check_parse_status(ngx_buf_t *b)
+{
+    u_char  *p;
+
+    if (b->last - b->pos < (ssize_t) (sizeof("HTTP/1.0 200") - 1)) {
+        return NGX_AGAIN;
+    }
+
+    if (ngx_strncmp(b->pos, "HTTP/", 5) != 0) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_strlchr(b->pos, b->last, ' ');
+
+    if (p == NULL) {
+        return (b->last - b->pos > 16) ? NGX_ERROR : NGX_AGAIN;
+    }
+
+    if (b->last - p < 4) {
+        return NGX_AGAIN;
+    }
+
+    if (p[1] < '1' || p[1] > '5'
+        || p[2] < '0' || p[2] > '9'
+        || p[3] < '0' || p[3] > '9')
+    {
+        return NGX_ERROR;
+    }
+
+    return (p[1] - '0') * 100 + (p[2] - '0') * 10 + p[3] - '0';
+}
+
+
+static void
+ngx_http_upstream_check_finish(ngx_http_upstream_check_peer_t *peer,
+    ngx_uint_t ok)
+{
+    ngx_http_upstream_check_shared_t  *sh;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "health check done: %V %ui", &peer->name, ok);
+
+    if (peer->pc.connection) {
+        ngx_close_connection(peer->pc.connection);
+        peer->pc.connection = NULL;
+    }
+
+    sh = peer->shared;
+
+    if (ok) {
+        sh->fails = 0;
+        sh->passes++;
+
+        if (sh->down && sh->passes >= peer->conf->passes) {
+            sh->down = 0;
+            sh->up = ngx_current_msec;
+
+            ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                          "health check: %V in upstream \"%V\" is up",
+                          &peer->name, peer->conf->upstream);
+        }
+
+    } else {
+        sh->passes = 0;
+        sh->fails++;
+
+        if (!sh->down && sh->fails >= peer->conf->fails) {
+            sh->down = 1;
+            sh->up = 0;
+
+            ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                          "health check: %V in upstream \"%V\" is down",
+                          &peer->name, peer->conf->upstream);
+        }
+    }
+
+    ngx_memory_barrier();
+
+    sh->lock = 0;
+}
+
+
+static void
+ngx_http_upstream_check_dummy_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "health check dummy handler");
+}
+
+
+static ngx_int_t
+ngx_http_upstream_check_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_upstream_check_main_conf_t  *oucmcf = data;
+
+    size_t                                size;
+    ngx_slab_pool_t                      *shpool;
+    ngx_http_upstream_check_main_conf_t  *ucmcf;
+
+    ucmcf = shm_zone->data;
+
+    if (oucmcf) {
+
+        /* the zone name guarantees the same list of servers */
+
+        ucmcf->shared = oucmcf->shared;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        ucmcf->shared = shpool->data;
+        return NGX_OK;
+    }
+
+    size = ucmcf->peers.nelts * sizeof(ngx_http_upstream_check_shared_t);
+
+    ucmcf->shared = ngx_slab_alloc(shpool, size);
+    if (ucmcf->shared == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* the servers are up until they fail the checks */
+
+    ngx_memzero(ucmcf->shared, size);
+
+    shpool->data = ucmcf->shared;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_check_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                            i;
+    ngx_msec_t                            tick;
+    ngx_http_upstream_check_peer_t       *peer;
+    ngx_http_upstream_check_main_conf_t  *ucmcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    ucmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_upstream_check_module);
+    if (ucmcf == NULL) {
+        return NGX_OK;
+    }
+
+    peer = ucmcf->peers.elts;
+
+    for (i = 0; i < ucmcf->peers.nelts; i++) {
+        peer[i].shared = &ucmcf->shared[i];
+
+        peer[i].recv.start = ngx_palloc(cycle->pool,
+                                        NGX_HTTP_UPSTREAM_CHECK_BUFFER_SIZE);
+        if (peer[i].recv.start == NULL) {
+            return NGX_ERROR;
+        }
+
+        peer[i].recv.end = peer[i].recv.start
+                           + NGX_HTTP_UPSTREAM_CHECK_BUFFER_SIZE;
+
+        peer[i].check_ev.handler = ngx_http_upstream_check_begin_handler;
+        peer[i].check_ev.log = cycle->log;
+        peer[i].check_ev.data = &peer[i];
+
+        /* the workers start the checks at random moments */
+
+        tick = ngx_min(peer[i].conf->interval, 1000);
+
+        ngx_add_timer(&peer[i].check_ev, ngx_random() % tick + 1);
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_upstream_check_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_check_main_conf_t  *ucmcf;
+
+    ucmcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_check_main_conf_t));
+    if (ucmcf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&ucmcf->peers, cf->pool, 16,
+                       sizeof(ngx_http_upstream_check_peer_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return ucmcf;
+}
+
+
+static char *
+ngx_http_upstream_check_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_http_upstream_check_main_conf_t  *ucmcf = conf;
+
+    size_t                           size;
+    uint32_t                         crc;
+    ngx_str_t                        name;
+    ngx_uint_t                       i;
+    ngx_shm_zone_t                  *shm_zone;
+    ngx_http_upstream_check_peer_t  *peer;
+
+    /*
+     * the upstream module is initialized earlier,
+     * so all servers with checks are already added
+     */
+
+    if (ucmcf->peers.nelts == 0) {
+        return NGX_CONF_OK;
+    }
+
+    ngx_crc32_init(crc);
+
+    peer = ucmcf->peers.elts;
+
+    for (i = 0; i < ucmcf->peers.nelts; i++) {
+        ngx_crc32_update(&crc, peer[i].conf->upstream->data,
+                         peer[i].conf->upstream->len);
+        ngx_crc32_update(&crc, peer[i].name.data, peer[i].name.len);
+    }
+
+    ngx_crc32_final(crc);
+
+    name.len = sizeof("upstream_check:") - 1 + 8;
+
+    name.data = ngx_pnalloc(cf->pool, name.len);
+    if (name.data == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_sprintf(name.data, "upstream_check:%08xD", crc);
+
+    size = 8 * ngx_pagesize
+           + ngx_align(ucmcf->peers.nelts
+                       * sizeof(ngx_http_upstream_check_shared_t),
+                       ngx_pagesize);
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_upstream_check_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone->init = ngx_http_upstream_check_init_zone;
+    shm_zone->data = ucmcf;
+
+    ucmcf->shm_zone = shm_zone;
+
+    return NGX_CONF_OK;
+}
+
+
+static void *
+ngx_http_upstream_check_create_srv_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_check_srv_conf_t  *ucscf;
+
+    ucscf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_check_srv_conf_t));
+    if (ucscf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     ucscf->enable = 0;
+     *     ucscf->type = NGX_HTTP_UPSTREAM_CHECK_TCP;
+     *     ucscf->slow_start = 0;
+     *     ucscf->send = { 0, NULL };
+     *     ucscf->upstream = NULL;
+     */
+
+    return ucscf;
+}
+
+
+static char *
+ngx_http_upstream_check(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_check_srv_conf_t  *ucscf = conf;
+
+    u_char                        *p;
+    ngx_str_t                     *value, s, uri;
+    ngx_int_t                      n;
+    ngx_uint_t                     i;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    if (ucscf->enable) {
+        return "is duplicate";
+    }
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    ucscf->enable = 1;
+    ucscf->type = NGX_HTTP_UPSTREAM_CHECK_HTTP;
+    ucscf->interval = 5000;
+    ucscf->timeout = 1000;
+    ucscf->fails = 1;
+    ucscf->passes = 1;
+    ucscf->upstream = &uscf->host;
+
+    ngx_str_set(&uri, "/");
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            n = ngx_parse_time(&s, 0);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            ucscf->interval = (ngx_msec_t) n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = value[i].data + 8;
+
+            n = ngx_parse_time(&s, 0);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            ucscf->timeout = (ngx_msec_t) n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "slow_start=", 11) == 0) {
+
+            s.len = value[i].len - 11;
+            s.data = value[i].data + 11;
+
+            n = ngx_parse_time(&s, 0);
+            if (n == NGX_ERROR) {
+                goto invalid;
+            }
+
+            ucscf->slow_start = (ngx_msec_t) n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "fails=", 6) == 0) {
+
+            n = ngx_atoi(&value[i].data[6], value[i].len - 6);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            ucscf->fails = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "passes=", 7) == 0) {
+
+            n = ngx_atoi(&value[i].data[7], value[i].len - 7);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            ucscf->passes = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "uri=", 4) == 0) {
+
+            uri.len = value[i].len - 4;
+            uri.data = value[i].data + 4;
+
+            if (uri.len == 0 || uri.data[0] != '/') {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "type=http") == 0) {
+            ucscf->type = NGX_HTTP_UPSTREAM_CHECK_HTTP;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "type=tcp") == 0) {
+            ucscf->type = NGX_HTTP_UPSTREAM_CHECK_TCP;
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    /* a HTTP/1.0 request, so the server closes the connection */
+
+    ucscf->send.len = sizeof("GET  HTTP/1.0" CRLF "Host: " CRLF CRLF) - 1
+                      + uri.len + uscf->host.len;
+
+    ucscf->send.data = ngx_pnalloc(cf->pool, ucscf->send.len);
+    if (ucscf->send.data == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    p = ngx_sprintf(ucscf->send.data,
+                    "GET %V HTTP/1.0" CRLF "Host: %V" CRLF CRLF,
+                    &uri, &uscf->host);
+
+    ucscf->send.len = p - ucscf->send.data;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
@@ -0,0 +1,35 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_HTTP_UPSTREAM_CHECK_MODULE_H_INCLUDED_
+#define _NGX_HTTP_UPSTREAM_CHECK_MODULE_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * 上游服务器的主动健康检查：配置了health_check的upstream中每个服务器在共享内存
+ * 中有一个状态，worker进程定时发起探测，同一时刻只有抢到该服务器锁的那个进程
+ * 探测。负载均衡模块通过peer->check_index查询状态，check_index为0表示
+ * 该服务器不做健康检查
+ */
+
+ngx_int_t ngx_http_upstream_check_add_peer(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us, ngx_http_upstream_rr_peer_t *peer);
+/*初始化upstream时为一个服务器注册健康检查，返回它的check_index*/
+
+ngx_uint_t ngx_http_upstream_check_peer_down(ngx_uint_t index);
+/*服务器是否被健康检查标记为不可用*/
+
+ngx_uint_t ngx_http_upstream_check_peer_ramp(ngx_uint_t index);
+/*服务器恢复后slow_start期间权重的千分比，其余时间返回1000*/
+
+
+#endif /* _NGX_HTTP_UPSTREAM_CHECK_MODULE_H_INCLUDED_ */
@@ -178,9 +178,11 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
 
             peer = &iphp->rrp.peers->peer[p];
 
-            /* ngx_lock_mutex(iphp->rrp.peers->mutex); */
+            ngx_http_upstream_rr_peers_lock(iphp->rrp.peers);
 
-            if (!peer->down) {
+            if (!ngx_http_upstream_rr_peer_down(peer)
+                && !ngx_http_upstream_rr_peer_full(peer))
+            {
 
                 if (peer->max_fails == 0 || peer->fails < peer->max_fails) {
                     break;
@@ -194,7 +196,7 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
 
             iphp->rrp.tried[n] |= m;
 
-            /* ngx_unlock_mutex(iphp->rrp.peers->mutex); */
+            ngx_http_upstream_rr_peers_unlock(iphp->rrp.peers);
 
             pc->tries--;
         }
@@ -210,7 +212,10 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
     pc->socklen = peer->socklen;
     pc->name = &peer->name;
 
-    /* ngx_unlock_mutex(iphp->rrp.peers->mutex); */
+    peer->conns++;
+    iphp->rrp.counted = peer;
+
+    ngx_http_upstream_rr_peers_unlock(iphp->rrp.peers);
 
     iphp->rrp.tried[n] |= m;
     iphp->hash = hash;
@@ -231,6 +236,7 @@ ngx_http_upstream_ip_hash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     uscf->flags = NGX_HTTP_UPSTREAM_CREATE
                   |NGX_HTTP_UPSTREAM_MAX_FAILS
                   |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                  |NGX_HTTP_UPSTREAM_MAX_CONNS
                   |NGX_HTTP_UPSTREAM_DOWN;
 
     return NGX_CONF_OK;
@@ -0,0 +1,732 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * least_conn负载均衡：选择活跃连接数与权重之比最小的上游服务器，比值相同时
+ * 按权重轮询。活跃连接数以及失败次数保存在每个upstream各自的共享内存中，
+ * 所有worker进程看到的是同一份数据。共享内存的名字包含服务器列表的crc32，
+ * 重新加载配置时服务器列表不变则沿用原来的计数，否则使用新的共享内存，
+ * 旧的worker进程仍然修改旧的那一份。
+ * 连接数只由增加它的进程减少，所以每个进程还在共享内存中按ngx_process_slot
+ * 记录自己增加的连接数，异常退出的进程留下的连接数由之后占用同一个slot的进程
+ * 从总数中减去
+ */
+
+
+typedef struct {
+    ngx_atomic_t                       conns;
+    ngx_atomic_t                       fails;
+    ngx_atomic_t                       accessed;
+} ngx_http_upstream_least_conn_shared_t;
+
+
+typedef struct {
+    ngx_http_upstream_least_conn_shared_t  *peers;
+
+    /* the connections counted by each process, indexed by ngx_process_slot */
+    ngx_atomic_t                      *rows[NGX_MAX_PROCESSES];
+} ngx_http_upstream_least_conn_sh_t;
+
+
+typedef struct {
+    ngx_shm_zone_t                    *shm_zone;
+    ngx_http_upstream_least_conn_sh_t *sh;
+
+    /* the primary peers first, then the backup ones */
+    ngx_http_upstream_least_conn_shared_t  *shared;
+
+    /* the row of the current process, NULL if it could not be allocated */
+    ngx_atomic_t                      *row;
+
+    ngx_uint_t                         primary;
+    ngx_uint_t                         number;
+} ngx_http_upstream_least_conn_conf_t;
+
+
+typedef struct {
+    /* the round robin data must be first */
+    ngx_http_upstream_rr_peer_data_t   rrp;
+
+    ngx_http_upstream_least_conn_conf_t    *conf;
+
+    /* the chosen peer, NULL if its connection is not counted */
+    ngx_http_upstream_least_conn_shared_t  *shared;
+    ngx_atomic_t                      *conns;
+
+    /* the backup peers are used if rrp.peers is not the primary list */
+    ngx_http_upstream_rr_peers_t      *primary;
+} ngx_http_upstream_least_conn_peer_data_t;
+
+
+static ngx_int_t ngx_http_upstream_init_least_conn(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_init_least_conn_zone(
+    ngx_shm_zone_t *shm_zone, void *data);
+static ngx_int_t ngx_http_upstream_init_least_conn_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_least_conn_init_process(ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_upstream_get_least_conn_peer(
+    ngx_peer_connection_t *pc, void *data);
+static void ngx_http_upstream_free_least_conn_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static ngx_uint_t ngx_http_upstream_least_conn_weight(
+    ngx_http_upstream_rr_peer_t *peer);
+static void *ngx_http_upstream_least_conn_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_least_conn(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_least_conn_commands[] = {
+
+    { ngx_string("least_conn"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_NOARGS,
+      ngx_http_upstream_least_conn,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_least_conn_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_least_conn_create_conf, /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_least_conn_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_least_conn_module_ctx, /* module context */
+    ngx_http_upstream_least_conn_commands, /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_http_upstream_least_conn_init_process, /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_init_least_conn(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    size_t                                size;
+    uint32_t                              crc;
+    ngx_str_t                             name;
+    ngx_uint_t                            i, n, rows;
+    ngx_shm_zone_t                       *shm_zone;
+    ngx_core_conf_t                      *ccf;
+    ngx_http_upstream_rr_peers_t         *peers;
+    ngx_http_upstream_least_conn_conf_t  *lcf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "init least conn");
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_http_upstream_init_least_conn_peer;
+
+    lcf = ngx_http_conf_upstream_srv_conf(us,
+                                          ngx_http_upstream_least_conn_module);
+
+    n = 0;
+    ngx_crc32_init(crc);
+
+    for (peers = us->peer.data; peers; peers = peers->next) {
+        for (i = 0; i < peers->number; i++) {
+            ngx_crc32_update(&crc, peers->peer[i].name.data,
+                             peers->peer[i].name.len);
+        }
+
+        if (n == 0) {
+            n = peers->number;
+
+            if (us->shm_zone) {
+
+                /* the room for the peers added to the upstream zone */
+
+                n = us->shm_zone->shm.size
+                    / sizeof(ngx_http_upstream_rr_peer_t);
+            }
+
+            lcf->primary = n;
+
+        } else {
+            n += peers->number;
+        }
+    }
+
+    ngx_crc32_final(crc);
+
+    lcf->number = n;
+
+    name.len = sizeof("least_conn::") - 1 + us->host.len + 8;
+
+    name.data = ngx_pnalloc(cf->pool, name.len);
+    if (name.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(name.data, "least_conn:%V:%08xD", &us->host, crc);
+
+    /*
+     * the rows for the workers of two configurations at once, while
+     * the old workers are exiting, and for the cache manager and loader
+     */
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                           ngx_core_module);
+
+    rows = 2 * (ccf->worker_processes > 0 ? ccf->worker_processes : 1) + 2;
+
+    size = 8 * ngx_pagesize
+           + ngx_align(sizeof(ngx_http_upstream_least_conn_sh_t), ngx_pagesize)
+           + ngx_align(n * sizeof(ngx_http_upstream_least_conn_shared_t),
+                       ngx_pagesize)
+           + rows * ngx_align(n * sizeof(ngx_atomic_t), ngx_pagesize);
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_upstream_least_conn_module);
+    if (shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    shm_zone->init = ngx_http_upstream_init_least_conn_zone;
+    shm_zone->data = lcf;
+
+    lcf->shm_zone = shm_zone;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_least_conn_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_upstream_least_conn_conf_t  *olcf = data;
+
+    ngx_slab_pool_t                      *shpool;
+    ngx_http_upstream_least_conn_sh_t    *sh;
+    ngx_http_upstream_least_conn_conf_t  *lcf;
+
+    lcf = shm_zone->data;
+
+    if (olcf) {
+
+        /* the zone name guarantees the same list of servers */
+
+        lcf->sh = olcf->sh;
+        lcf->shared = olcf->shared;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        lcf->sh = shpool->data;
+        lcf->shared = lcf->sh->peers;
+        return NGX_OK;
+    }
+
+    sh = ngx_slab_alloc(shpool, sizeof(ngx_http_upstream_least_conn_sh_t));
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(sh, sizeof(ngx_http_upstream_least_conn_sh_t));
+
+    sh->peers = ngx_slab_alloc(shpool,
+                  lcf->number * sizeof(ngx_http_upstream_least_conn_shared_t));
+    if (sh->peers == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(sh->peers,
+                lcf->number * sizeof(ngx_http_upstream_least_conn_shared_t));
+
+    shpool->data = sh;
+
+    lcf->sh = sh;
+    lcf->shared = sh->peers;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_least_conn_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_least_conn_peer_data_t  *lcp;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init least conn peer");
+
+    lcp = ngx_palloc(r->pool, sizeof(ngx_http_upstream_least_conn_peer_data_t));
+    if (lcp == NULL) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.data = &lcp->rrp;
+
+    if (ngx_http_upstream_init_round_robin_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    lcp->conf = ngx_http_conf_upstream_srv_conf(us,
+                                          ngx_http_upstream_least_conn_module);
+    lcp->shared = NULL;
+    lcp->conns = NULL;
+    lcp->primary = lcp->rrp.peers;
+
+    r->upstream->peer.get = ngx_http_upstream_get_least_conn_peer;
+    r->upstream->peer.free = ngx_http_upstream_free_least_conn_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_least_conn_peer_data_t  *lcp = data;
+
+    time_t                                  now;
+    uintptr_t                               m;
+    ngx_int_t                               rc, total;
+    ngx_uint_t                              i, n, p, many, weight, best_weight;
+    ngx_atomic_uint_t                       conns, best_conns;
+    ngx_http_upstream_rr_peer_t            *peer, *best;
+    ngx_http_upstream_rr_peers_t           *peers;
+    ngx_http_upstream_least_conn_shared_t  *shared, *sh;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get least conn peer, try: %ui", pc->tries);
+
+    peers = lcp->rrp.peers;
+
+    shared = lcp->conf->shared;
+
+    if (peers != lcp->primary) {
+        shared += lcp->conf->primary;
+    }
+
+    now = ngx_time();
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    ngx_http_upstream_rr_peers_lock(peers);
+
+    best = NULL;
+    best_conns = 0;
+    best_weight = 0;
+    many = 0;
+    p = 0;
+
+    for (i = 0; i < peers->number; i++) {
+
+        n = i / (8 * sizeof(uintptr_t));
+        m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+        if (lcp->rrp.tried[n] & m) {
+            continue;
+        }
+
+        peer = &peers->peer[i];
+        sh = &shared[i];
+
+        if (ngx_http_upstream_rr_peer_down(peer)) {
+            continue;
+        }
+
+        if (peer->max_conns && sh->conns >= peer->max_conns) {
+            continue;
+        }
+
+        if (peer->max_fails
+            && sh->fails >= peer->max_fails
+            && now - (time_t) sh->accessed <= peer->fail_timeout)
+        {
+            continue;
+        }
+
+        /*
+         * select the peer with the least number of connections per weight,
+         * several such peers are selected by weighted round robin
+         */
+
+        conns = sh->conns;
+        weight = ngx_http_upstream_least_conn_weight(peer);
+
+        if (best == NULL
+            || conns * best_weight < best_conns * weight)
+        {
+            best = peer;
+            best_conns = conns;
+            best_weight = weight;
+            many = 0;
+            p = i;
+
+        } else if (conns * best_weight == best_conns * weight) {
+            many = 1;
+        }
+    }
+
+    if (best == NULL) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get least conn peer, no peer found");
+
+        goto failed;
+    }
+
+    if (many) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get least conn peer, many: %ui", p);
+
+        total = 0;
+
+        for (i = p; i < peers->number; i++) {
+
+            n = i / (8 * sizeof(uintptr_t));
+            m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+            if (lcp->rrp.tried[n] & m) {
+                continue;
+            }
+
+            peer = &peers->peer[i];
+            sh = &shared[i];
+
+            if (ngx_http_upstream_rr_peer_down(peer)) {
+                continue;
+            }
+
+            if (peer->max_conns && sh->conns >= peer->max_conns) {
+                continue;
+            }
+
+            weight = ngx_http_upstream_least_conn_weight(peer);
+
+            if (sh->conns * best_weight != best_conns * weight) {
+                continue;
+            }
+
+            if (peer->max_fails
+                && sh->fails >= peer->max_fails
+                && now - (time_t) sh->accessed <= peer->fail_timeout)
+            {
+                continue;
+            }
+
+            /* the round robin current weight is local to a process */
+
+            peer->current_weight += weight;
+            total += weight;
+
+            if (peer->current_weight > best->current_weight) {
+                best = peer;
+                p = i;
+            }
+        }
+
+        best->current_weight -= total;
+    }
+
+    sh = &shared[p];
+
+    if (sh->fails
+        && best->max_fails
+        && now - (time_t) sh->accessed > best->fail_timeout)
+    {
+        sh->fails = 0;
+    }
+
+    pc->sockaddr = best->sockaddr;
+    pc->socklen = best->socklen;
+    pc->name = &best->name;
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    lcp->rrp.current = p;
+
+    n = p / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+    lcp->rrp.tried[n] |= m;
+
+    (void) ngx_atomic_fetch_add(&sh->conns, 1);
+    lcp->shared = sh;
+
+    if (lcp->conf->row) {
+        lcp->conns = &lcp->conf->row[sh - lcp->conf->shared];
+        (*lcp->conns)++;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get least conn peer, current: %ui, conns: %uA, weight: %i",
+                   p, sh->conns, best->weight);
+
+    if (pc->tries == 1 && peers->next) {
+        pc->tries += peers->next->number;
+
+        n = peers->next->number / (8 * sizeof(uintptr_t)) + 1;
+        for (i = 0; i < n; i++) {
+             lcp->rrp.tried[i] = 0;
+        }
+    }
+
+    return NGX_OK;
+
+failed:
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    if (peers->next) {
+
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0, "backup servers");
+
+        lcp->rrp.peers = peers->next;
+        pc->tries = lcp->rrp.peers->number;
+
+        n = lcp->rrp.peers->number / (8 * sizeof(uintptr_t)) + 1;
+        for (i = 0; i < n; i++) {
+             lcp->rrp.tried[i] = 0;
+        }
+
+        rc = ngx_http_upstream_get_least_conn_peer(pc, lcp);
+
+        if (rc != NGX_BUSY) {
+            return rc;
+        }
+    }
+
+    /*
+     * all peers failed, mark them as live for quick recovery,
+     * unless some peers are just busy with max_conns
+     */
+
+    for (i = 0; i < peers->number; i++) {
+        if (peers->peer[i].max_conns
+            && shared[i].conns >= peers->peer[i].max_conns)
+        {
+            break;
+        }
+    }
+
+    if (i == peers->number) {
+        for (i = 0; i < peers->number; i++) {
+            shared[i].fails = 0;
+        }
+    }
+
+    pc->name = peers->name;
+
+    return NGX_BUSY;
+}
+
+
+static void
+ngx_http_upstream_free_least_conn_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state)
+{
+    ngx_http_upstream_least_conn_peer_data_t  *lcp = data;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free least conn peer %ui %ui", pc->tries, state);
+
+    /* peer.free() may be called more than once */
+
+    if (lcp->shared == NULL) {
+        return;
+    }
+
+    (void) ngx_atomic_fetch_add(&lcp->shared->conns, -1);
+
+    if (lcp->conns) {
+        (*lcp->conns)--;
+        lcp->conns = NULL;
+    }
+
+    if ((state & NGX_PEER_FAILED) && !lcp->rrp.peers->single) {
+        (void) ngx_atomic_fetch_add(&lcp->shared->fails, 1);
+        lcp->shared->accessed = ngx_time();
+    }
+
+    lcp->shared = NULL;
+
+    if (pc->tries) {
+        pc->tries--;
+    }
+}
+
+
+static ngx_int_t
+ngx_http_upstream_least_conn_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                             i, j;
+    ngx_atomic_t                          *row;
+    ngx_atomic_uint_t                      left;
+    ngx_slab_pool_t                       *shpool;
+    ngx_http_upstream_srv_conf_t         **uscfp;
+    ngx_http_upstream_main_conf_t         *umcf;
+    ngx_http_upstream_least_conn_conf_t   *lcf;
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->peer.init_upstream != ngx_http_upstream_init_least_conn) {
+            continue;
+        }
+
+        lcf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                          ngx_http_upstream_least_conn_module);
+
+        shpool = (ngx_slab_pool_t *) lcf->shm_zone->shm.addr;
+
+        ngx_shmtx_lock(&shpool->mutex);
+
+        row = lcf->sh->rows[ngx_process_slot];
+
+        if (row) {
+
+            /*
+             * the previous process in this slot has exited,
+             * and if it has crashed, its connections are still counted
+             */
+
+            left = 0;
+
+            for (j = 0; j < lcf->number; j++) {
+                if (row[j]) {
+                    (void) ngx_atomic_fetch_add(&lcf->shared[j].conns,
+                                                -(ngx_atomic_int_t) row[j]);
+                    left += row[j];
+                    row[j] = 0;
+                }
+            }
+
+            if (left) {
+                ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                              "least_conn: %uA connections to upstream \"%V\" "
+                              "left by an exited process", left,
+                              &uscfp[i]->host);
+            }
+
+        } else if (ngx_process == NGX_PROCESS_WORKER
+                   || ngx_process == NGX_PROCESS_SINGLE)
+        {
+            row = ngx_slab_alloc_locked(shpool,
+                                        lcf->number * sizeof(ngx_atomic_t));
+            if (row) {
+                ngx_memzero((void *) row, lcf->number * sizeof(ngx_atomic_t));
+                lcf->sh->rows[ngx_process_slot] = row;
+            }
+        }
+
+        ngx_shmtx_unlock(&shpool->mutex);
+
+        lcf->row = row;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_least_conn_weight(ngx_http_upstream_rr_peer_t *peer)
+{
+#if (NGX_HTTP_UPSTREAM_CHECK)
+
+    /* a server is slowly started after it has recovered */
+
+    return peer->weight * ngx_http_upstream_check_peer_ramp(peer->check_index);
+
+#else
+
+    return peer->weight;
+
+#endif
+}
+
+
+static void *
+ngx_http_upstream_least_conn_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_least_conn_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_least_conn_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->shm_zone = NULL;
+     *     conf->sh = NULL;
+     *     conf->shared = NULL;
+     *     conf->row = NULL;
+     *     conf->primary = 0;
+     *     conf->number = 0;
+     */
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_least_conn(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    if (uscf->peer.init_upstream) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "load balancing method redefined");
+    }
+
+    uscf->peer.init_upstream = ngx_http_upstream_init_least_conn;
+
+    uscf->flags = NGX_HTTP_UPSTREAM_CREATE
+                  |NGX_HTTP_UPSTREAM_WEIGHT
+                  |NGX_HTTP_UPSTREAM_MAX_FAILS
+                  |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                  |NGX_HTTP_UPSTREAM_MAX_CONNS
+                  |NGX_HTTP_UPSTREAM_DOWN
+                  |NGX_HTTP_UPSTREAM_BACKUP;
+
+    return NGX_CONF_OK;
+}
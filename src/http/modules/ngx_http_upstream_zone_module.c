@@ -0,0 +1,738 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * upstream共享内存：配置了zone的upstream在初始化共享内存时把轮询模块的peers
+ * 数组（包括权重、失败次数等运行状态）复制到slab中，并让us->peer.data指向
+ * 这份拷贝，于是所有worker进程共用同一份服务器列表，访问时加slab的锁。
+ * 共享内存中的数组按zone的大小预留了空位，upstream_conf接口可以在运行时
+ * 添加、摘除(drain)和删除服务器而不需要重新加载配置。
+ * 重新加载配置时zone不复用(noreuse)，新的worker进程使用按新配置建立的列表，
+ * 运行时做的修改不会保留
+ */
+
+
+typedef struct {
+    union {
+        struct sockaddr                 sockaddr;
+        struct sockaddr_in              sockaddr_in;
+#if (NGX_HAVE_INET6)
+        struct sockaddr_in6             sockaddr_in6;
+#endif
+#if (NGX_HAVE_UNIX_DOMAIN)
+        struct sockaddr_un              sockaddr_un;
+#endif
+    } u;
+
+    u_char                              name[NGX_SOCKADDR_STRLEN];
+} ngx_http_upstream_zone_addr_t;
+
+
+static ngx_int_t ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_http_upstream_rr_peers_t *ngx_http_upstream_zone_copy_peers(
+    ngx_slab_pool_t *shpool, ngx_http_upstream_rr_peers_t *src,
+    ngx_uint_t max);
+
+static ngx_int_t ngx_http_upstream_conf_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_upstream_conf_add(ngx_http_request_t *r,
+    ngx_http_upstream_rr_peers_t *peers, ngx_addr_t *addr);
+static u_char *ngx_http_upstream_conf_server(u_char *p,
+    ngx_http_upstream_rr_peer_t *peer, ngx_uint_t backup, ngx_uint_t id);
+static ngx_int_t ngx_http_upstream_conf_send(ngx_http_request_t *r,
+    ngx_uint_t status, ngx_buf_t *b);
+static ngx_int_t ngx_http_upstream_conf_error(ngx_http_request_t *r,
+    ngx_uint_t status, char *err);
+
+static char *ngx_http_upstream_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_upstream_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_zone_commands[] = {
+
+    { ngx_string("zone"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE2,
+      ngx_http_upstream_zone,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("upstream_conf"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_upstream_conf,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_zone_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_zone_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_zone_module_ctx,    /* module context */
+    ngx_http_upstream_zone_commands,       /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    size_t                         size;
+    ngx_uint_t                     n, max;
+    ngx_slab_pool_t               *shpool;
+    ngx_http_upstream_rr_peers_t  *peers, *backup;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    uscf = shm_zone->data;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        uscf->peer.data = shpool->data;
+        return NGX_OK;
+    }
+
+    peers = uscf->peer.data;
+
+    /*
+     * the rest of the zone is the room for the peers added at run time,
+     * a few pages are left for the names and the backup peers
+     */
+
+    size = shpool->end - shpool->start - 8 * ngx_pagesize;
+
+    max = size / (sizeof(ngx_http_upstream_rr_peer_t)
+                  + sizeof(ngx_http_upstream_zone_addr_t));
+
+    n = peers->next ? peers->next->number : 0;
+
+    if (max < peers->number + n) {
+        ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                      "zone \"%V\" is too small for upstream \"%V\"",
+                      &shm_zone->shm.name, &uscf->host);
+        return NGX_ERROR;
+    }
+
+    max -= n;
+
+    backup = NULL;
+
+    if (peers->next) {
+        backup = ngx_http_upstream_zone_copy_peers(shpool, peers->next,
+                                                   peers->next->number);
+        if (backup == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    peers = ngx_http_upstream_zone_copy_peers(shpool, peers, max);
+    if (peers == NULL) {
+        return NGX_ERROR;
+    }
+
+    peers->next = backup;
+
+    uscf->peer.data = peers;
+    shpool->data = peers;
+
+    return NGX_OK;
+}
+
+
+static ngx_http_upstream_rr_peers_t *
+ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
+    ngx_http_upstream_rr_peers_t *src, ngx_uint_t max)
+{
+    size_t                          size;
+    ngx_str_t                      *name;
+    ngx_uint_t                      i;
+    ngx_http_upstream_rr_peer_t    *peer;
+    ngx_http_upstream_rr_peers_t   *peers;
+    ngx_http_upstream_zone_addr_t  *addr;
+
+    size = sizeof(ngx_http_upstream_rr_peers_t)
+           + sizeof(ngx_http_upstream_rr_peer_t) * (max - 1);
+
+    peers = ngx_slab_alloc(shpool,
+                           size + sizeof(ngx_http_upstream_zone_addr_t) * max);
+    if (peers == NULL) {
+        goto failed;
+    }
+
+    name = ngx_slab_alloc(shpool, sizeof(ngx_str_t) + src->name->len);
+    if (name == NULL) {
+        goto failed;
+    }
+
+    name->len = src->name->len;
+    name->data = (u_char *) name + sizeof(ngx_str_t);
+    ngx_memcpy(name->data, src->name->data, name->len);
+
+    ngx_memzero(peers, size);
+    ngx_memcpy(peers, src, sizeof(ngx_http_upstream_rr_peers_t)
+                    + sizeof(ngx_http_upstream_rr_peer_t) * (src->number - 1));
+
+    peers->single = 0;
+    peers->max = max;
+    peers->last_cached = 0;
+    peers->cached = NULL;
+    peers->shpool = shpool;
+    peers->name = name;
+    peers->next = NULL;
+
+    addr = (ngx_http_upstream_zone_addr_t *) ((u_char *) peers + size);
+
+    for (i = 0; i < max; i++) {
+        peer = &peers->peer[i];
+
+        if (i < src->number) {
+            ngx_memcpy(&addr[i].u, peer->sockaddr, peer->socklen);
+            peer->name.len = ngx_min(peer->name.len, NGX_SOCKADDR_STRLEN);
+            ngx_memcpy(addr[i].name, peer->name.data, peer->name.len);
+
+        } else {
+
+            /* a free slot */
+
+            peer->down = 1;
+        }
+
+        peer->sockaddr = &addr[i].u.sockaddr;
+        peer->name.data = addr[i].name;
+    }
+
+    return peers;
+
+failed:
+
+    ngx_log_error(NGX_LOG_EMERG, ngx_cycle->log, 0,
+                  "could not allocate servers of upstream \"%V\" "
+                  "in the upstream zone", src->name);
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_handler(ngx_http_request_t *r)
+{
+    size_t                          size;
+    ngx_int_t                       rc, id, weight, max_fails, max_conns;
+    ngx_buf_t                      *b;
+    ngx_str_t                       value;
+    ngx_url_t                       u;
+    ngx_addr_t                      addr;
+    time_t                          fail_timeout;
+    ngx_uint_t                      i, add, del, drain, up;
+    ngx_http_upstream_rr_peer_t    *peer;
+    ngx_http_upstream_rr_peers_t   *peers, *backup;
+    ngx_http_upstream_srv_conf_t  **uscfp, *uscf;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    if (r->method != NGX_HTTP_GET && r->method != NGX_HTTP_HEAD) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "upstream", 8, &value) != NGX_OK) {
+        return ngx_http_upstream_conf_error(r, NGX_HTTP_BAD_REQUEST,
+                                            "upstream is not specified");
+    }
+
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+
+    uscf = NULL;
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        if (uscfp[i]->shm_zone
+            && uscfp[i]->host.len == value.len
+            && ngx_strncmp(uscfp[i]->host.data, value.data, value.len) == 0)
+        {
+            uscf = uscfp[i];
+            break;
+        }
+    }
+
+    if (uscf == NULL) {
+        return ngx_http_upstream_conf_error(r, NGX_HTTP_NOT_FOUND,
+                                        "upstream with a zone is not found");
+    }
+
+    id = NGX_CONF_UNSET;
+
+    if (ngx_http_arg(r, (u_char *) "id", 2, &value) == NGX_OK) {
+        id = ngx_atoi(value.data, value.len);
+        if (id == NGX_ERROR) {
+            return ngx_http_upstream_conf_error(r, NGX_HTTP_BAD_REQUEST,
+                                                "invalid id");
+        }
+    }
+
+    weight = NGX_CONF_UNSET;
+
+    if (ngx_http_arg(r, (u_char *) "weight", 6, &value) == NGX_OK) {
+        weight = ngx_atoi(value.data, value.len);
+        if (weight == NGX_ERROR || weight == 0) {
+            return ngx_http_upstream_conf_error(r, NGX_HTTP_BAD_REQUEST,
+                                                "invalid weight");
+        }
+    }
+
+    max_fails = NGX_CONF_UNSET;
+
+    if (ngx_http_arg(r, (u_char *) "max_fails", 9, &value) == NGX_OK) {
+        max_fails = ngx_atoi(value.data, value.len);
+        if (max_fails == NGX_ERROR) {
+            return ngx_http_upstream_conf_error(r, NGX_HTTP_BAD_REQUEST,
+                                                "invalid max_fails");
+        }
+    }
+
+    max_conns = NGX_CONF_UNSET;
+
+    if (ngx_http_arg(r, (u_char *) "max_conns", 9, &value) == NGX_OK) {
+        max_conns = ngx_atoi(value.data, value.len);
+        if (max_conns == NGX_ERROR) {
+            return ngx_http_upstream_conf_error(r, NGX_HTTP_BAD_REQUEST,
+                                                "invalid max_conns");
+        }
+    }
+
+    fail_timeout = NGX_CONF_UNSET;
+
+    if (ngx_http_arg(r, (u_char *) "fail_timeout", 12, &value) == NGX_OK) {
+        fail_timeout = ngx_parse_time(&value, 1);
+        if (fail_timeout == NGX_ERROR) {
+            return ngx_http_upstream_conf_error(r, NGX_HTTP_BAD_REQUEST,
+                                                "invalid fail_timeout");
+        }
+    }
+
+    add = (ngx_http_arg(r, (u_char *) "add", 3, &value) == NGX_OK);
+    del = (ngx_http_arg(r, (u_char *) "remove", 6, &value) == NGX_OK);
+    drain = (ngx_http_arg(r, (u_char *) "drain", 5, &value) == NGX_OK);
+    up = (ngx_http_arg(r, (u_char *) "up", 2, &value) == NGX_OK);
+
+    if (add + del + drain + up > 1) {
+        return ngx_http_upstream_conf_error(r, NGX_HTTP_BAD_REQUEST,
+                                            "conflicting actions");
+    }
+
+    if (add) {
+        if (ngx_http_arg(r, (u_char *) "server", 6, &value) != NGX_OK) {
+            return ngx_http_upstream_conf_error(r, NGX_HTTP_BAD_REQUEST,
+                                                "server is not specified");
+        }
+
+        ngx_memzero(&u, sizeof(ngx_url_t));
+
+        u.url = value;
+        u.default_port = 80;
+        u.no_resolve = 1;
+
+        if (ngx_parse_url(r->pool, &u) != NGX_OK || u.host.len == 0) {
+            return ngx_http_upstream_conf_error(r, NGX_HTTP_BAD_REQUEST,
+                                                "invalid server");
+        }
+
+        /* the name is not resolved to not block the worker */
+
+        rc = ngx_parse_addr(r->pool, &addr, u.host.data, u.host.len);
+
+        if (rc != NGX_OK) {
+            return ngx_http_upstream_conf_error(r, NGX_HTTP_BAD_REQUEST,
+                                            "server must be an ip address");
+        }
+
+        switch (addr.sockaddr->sa_family) {
+
+#if (NGX_HAVE_INET6)
+        case AF_INET6:
+            ((struct sockaddr_in6 *) addr.sockaddr)->sin6_port =
+                                                 htons(u.port ? u.port : 80);
+            break;
+#endif
+
+        default: /* AF_INET */
+            ((struct sockaddr_in *) addr.sockaddr)->sin_port =
+                                                 htons(u.port ? u.port : 80);
+        }
+
+    } else if ((del || drain || up) && id == NGX_CONF_UNSET) {
+        return ngx_http_upstream_conf_error(r, NGX_HTTP_BAD_REQUEST,
+                                            "id is not specified");
+    }
+
+    peers = uscf->peer.data;
+    backup = peers->next;
+
+    ngx_http_upstream_rr_peers_lock(peers);
+
+    if (add) {
+        id = ngx_http_upstream_conf_add(r, peers, &addr);
+
+        if (id == NGX_ERROR) {
+            ngx_http_upstream_rr_peers_unlock(peers);
+            return ngx_http_upstream_conf_error(r,
+                                                NGX_HTTP_INSUFFICIENT_STORAGE,
+                                                "upstream zone is full");
+        }
+    }
+
+    peer = NULL;
+
+    if (id != NGX_CONF_UNSET) {
+
+        if ((ngx_uint_t) id >= peers->number
+            || peers->peer[id].name.len == 0)
+        {
+            ngx_http_upstream_rr_peers_unlock(peers);
+            return ngx_http_upstream_conf_error(r, NGX_HTTP_NOT_FOUND,
+                                                "server is not found");
+        }
+
+        peer = &peers->peer[id];
+
+        if (del) {
+
+            /*
+             * the slot is reused by the next added server, the requests
+             * to the removed one keep their copies of its address and name
+             */
+
+            ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                          "server %V is removed from upstream \"%V\"",
+                          &peer->name, peers->name);
+
+            peers->total_weight -= peer->weight;
+
+            peer->name.len = 0;
+            peer->weight = 0;
+            peer->current_weight = 0;
+            peer->down = 1;
+
+            ngx_http_upstream_rr_peers_unlock(peers);
+
+            return ngx_http_upstream_conf_send(r, NGX_HTTP_OK, NULL);
+        }
+
+        if (drain) {
+
+            /* no new requests are sent, the active ones are completed */
+
+            ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                          "server %V is drained in upstream \"%V\"",
+                          &peer->name, peers->name);
+
+            peer->down = 1;
+        }
+
+        if (up) {
+            ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                          "server %V is up in upstream \"%V\"",
+                          &peer->name, peers->name);
+
+            peer->down = 0;
+            peer->fails = 0;
+
+            if (peer->weight == 0 && weight == NGX_CONF_UNSET) {
+                weight = 1;
+            }
+        }
+
+        if (weight != NGX_CONF_UNSET) {
+            peers->total_weight += weight - peer->weight;
+            peer->weight = weight;
+
+            if (peer->current_weight > weight) {
+                peer->current_weight = weight;
+            }
+        }
+
+        if (max_fails != NGX_CONF_UNSET) {
+            peer->max_fails = max_fails;
+        }
+
+        if (fail_timeout != NGX_CONF_UNSET) {
+            peer->fail_timeout = fail_timeout;
+        }
+
+        if (max_conns != NGX_CONF_UNSET) {
+            peer->max_conns = max_conns;
+        }
+    }
+
+    size = sizeof("server  weight= max_fails= fail_timeout=s max_conns="
+                  " down backup; # id=" CRLF) - 1
+           + NGX_SOCKADDR_STRLEN + 3 * NGX_INT_T_LEN + NGX_TIME_T_LEN
+           + NGX_INT_T_LEN;
+
+    size *= (peer ? 1 : peers->number + (backup ? backup->number : 0));
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (peer) {
+        b->last = ngx_http_upstream_conf_server(b->last, peer, 0, id);
+
+    } else {
+        for (i = 0; i < peers->number; i++) {
+            if (peers->peer[i].name.len) {
+                b->last = ngx_http_upstream_conf_server(b->last,
+                                                        &peers->peer[i], 0, i);
+            }
+        }
+
+        for (i = 0; backup && i < backup->number; i++) {
+            b->last = ngx_http_upstream_conf_server(b->last,
+                                                    &backup->peer[i], 1, i);
+        }
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    return ngx_http_upstream_conf_send(r, NGX_HTTP_OK, b);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_add(ngx_http_request_t *r,
+    ngx_http_upstream_rr_peers_t *peers, ngx_addr_t *addr)
+{
+    ngx_uint_t                    i;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    for (i = 0; i < peers->number; i++) {
+        if (peers->peer[i].name.len == 0) {
+            break;
+        }
+    }
+
+    if (i == peers->max) {
+        return NGX_ERROR;
+    }
+
+    peer = &peers->peer[i];
+
+    ngx_memcpy(peer->sockaddr, addr->sockaddr, addr->socklen);
+    peer->socklen = addr->socklen;
+    peer->name.len = ngx_sock_ntop(peer->sockaddr, peer->name.data,
+                                   NGX_SOCKADDR_STRLEN, 1);
+
+    /* peer->conns is kept, a removed server may still have requests */
+
+    peer->weight = 1;
+    peer->current_weight = 0;
+    peer->fails = 0;
+    peer->accessed = 0;
+    peer->max_fails = 1;
+    peer->fail_timeout = 10;
+    peer->max_conns = 0;
+    peer->down = 0;
+
+#if (NGX_HTTP_UPSTREAM_CHECK)
+    peer->check_index = 0;
+#endif
+
+    peers->total_weight += peer->weight;
+
+    if (i == peers->number) {
+        peers->number++;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                  "server %V is added to upstream \"%V\"",
+                  &peer->name, peers->name);
+
+    return i;
+}
+
+
+static u_char *
+ngx_http_upstream_conf_server(u_char *p, ngx_http_upstream_rr_peer_t *peer,
+    ngx_uint_t backup, ngx_uint_t id)
+{
+    p = ngx_sprintf(p, "server %V weight=%i max_fails=%ui fail_timeout=%Ts",
+                    &peer->name, peer->weight, peer->max_fails,
+                    peer->fail_timeout);
+
+    if (peer->max_conns) {
+        p = ngx_sprintf(p, " max_conns=%ui", peer->max_conns);
+    }
+
+    if (peer->down) {
+        p = ngx_cpymem(p, " down", sizeof(" down") - 1);
+    }
+
+    if (backup) {
+        return ngx_sprintf(p, " backup;" CRLF);
+    }
+
+    return ngx_sprintf(p, "; # id=%ui" CRLF, id);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_send(ngx_http_request_t *r, ngx_uint_t status,
+    ngx_buf_t *b)
+{
+    ngx_int_t    rc;
+    ngx_chain_t  out;
+
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+
+    r->headers_out.status = status;
+    r->headers_out.content_length_n = b ? b->last - b->pos : 0;
+
+    if (b == NULL || b->last == b->pos) {
+        r->header_only = 1;
+    }
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    b->last_buf = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_error(ngx_http_request_t *r, ngx_uint_t status,
+    char *err)
+{
+    size_t      len;
+    ngx_buf_t  *b;
+
+    len = ngx_strlen(err);
+
+    b = ngx_create_temp_buf(r->pool, len + sizeof(CRLF) - 1);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->last = ngx_cpymem(b->last, err, len);
+    *b->last++ = CR; *b->last++ = LF;
+
+    return ngx_http_upstream_conf_send(r, status, b);
+}
+
+
+static char *
+ngx_http_upstream_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ssize_t                        size;
+    ngx_str_t                     *value;
+    ngx_http_upstream_srv_conf_t  *uscf, *other;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    if (uscf->shm_zone) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    size = ngx_parse_size(&value[2]);
+
+    if (size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (size < (ssize_t) (16 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    uscf->shm_zone = ngx_shared_memory_add(cf, &value[1], size,
+                                           &ngx_http_upstream_zone_module);
+    if (uscf->shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (uscf->shm_zone->data) {
+        other = uscf->shm_zone->data;
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is already used by upstream \"%V\"",
+                           &value[1], &other->host);
+        return NGX_CONF_ERROR;
+    }
+
+    uscf->shm_zone->init = ngx_http_upstream_init_zone;
+    uscf->shm_zone->data = uscf;
+
+    /*
+     * the old workers use the old servers until they exit,
+     * so a reloaded configuration always gets a new zone
+     */
+
+    uscf->shm_zone->noreuse = 1;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_upstream_conf(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_upstream_conf_handler;
+
+    return NGX_CONF_OK;
+}
@@ -11,6 +11,41 @@
 #include <ngx_md5.h>
 
 
+#define NGX_HTTP_FILE_CACHE_MAX_SHARDS    256
+
+
+/*
+ * the keys zone snapshot: a header followed by the entries that have
+ * a cache file, in the order they should be put in the LRU queue
+ */
+
+#define NGX_HTTP_FILE_CACHE_INDEX_MAGIC   0x78646e69
+#define NGX_HTTP_FILE_CACHE_INDEX_BATCH   1024
+
+
+typedef struct {
+    uint32_t                         magic;
+    uint32_t                         crc32;
+    uint32_t                         entry_size;
+    uint32_t                         clean;
+    size_t                           bsize;
+    time_t                           time;
+    ngx_uint_t                       entries;
+} ngx_http_file_cache_index_header_t;
+
+
+typedef struct {
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN];
+    ngx_file_uniq_t                  uniq;
+    time_t                           inactive;
+    off_t                            fs_size;
+    size_t                           body_start;
+} ngx_http_file_cache_index_entry_t;
+
+
+static ngx_int_t ngx_http_file_cache_lock(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev);
 static ngx_int_t ngx_http_file_cache_read(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static ssize_t ngx_http_file_cache_aio_read(ngx_http_request_t *r,
@@ -18,19 +53,29 @@ static ssize_t ngx_http_file_cache_aio_read(ngx_http_request_t *r,
 #if (NGX_HAVE_FILE_AIO)
 static void ngx_http_cache_aio_event_handler(ngx_event_t *ev);
 #endif
+#if (NGX_THREAD_POOL)
+static ngx_int_t ngx_http_cache_thread_handler(ngx_thread_task_t *task,
+    ngx_file_t *file);
+static void ngx_http_cache_thread_event_handler(ngx_event_t *ev);
+#endif
 static ngx_int_t ngx_http_file_cache_exists(ngx_http_file_cache_t *cache,
     ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_name(ngx_http_request_t *r,
     ngx_path_t *path);
+static ngx_http_file_cache_shard_t *
+    ngx_http_file_cache_shard(ngx_http_file_cache_t *cache, u_char *key);
 static ngx_http_file_cache_node_t *
-    ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key);
+    ngx_http_file_cache_lookup(ngx_http_file_cache_shard_t *shard,
+    u_char *key);
 static void ngx_http_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 static void ngx_http_file_cache_cleanup(void *data);
 static time_t ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache);
 static time_t ngx_http_file_cache_expire(ngx_http_file_cache_t *cache);
+static time_t ngx_http_file_cache_expire_shard(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard, u_char *name, time_t now);
 static void ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
-    ngx_queue_t *q, u_char *name);
+    ngx_http_file_cache_shard_t *shard, ngx_queue_t *q, u_char *name);
 static ngx_int_t
     ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache);
 static ngx_int_t ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx,
@@ -43,6 +88,16 @@ static ngx_int_t ngx_http_file_cache_add(ngx_http_file_cache_t *cache,
     ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
+static void ngx_http_file_cache_read_index(ngx_http_file_cache_t *cache,
+    ngx_log_t *log);
+static int ngx_libc_cdecl ngx_http_file_cache_index_cmp(const void *one,
+    const void *two);
+static void ngx_http_file_cache_saver(void *data, ngx_uint_t clean);
+static void ngx_http_file_cache_write_index(ngx_http_file_cache_t *cache,
+    ngx_uint_t clean);
+static ngx_http_file_cache_node_t *
+    ngx_http_file_cache_index_next(ngx_http_file_cache_shard_t *shard,
+    u_char *key);
 
 
 ngx_str_t  ngx_http_cache_status[] = {
@@ -51,6 +106,7 @@ ngx_str_t  ngx_http_cache_status[] = {
     ngx_string("EXPIRED"),
     ngx_string("STALE"),
     ngx_string("UPDATING"),
+    ngx_string("REVALIDATED"),
     ngx_string("HIT")
 };
 
@@ -63,9 +119,11 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 {
     ngx_http_file_cache_t  *ocache = data;
 
-    size_t                  len;
-    ngx_uint_t              n;
-    ngx_http_file_cache_t  *cache;
+    size_t                        len;
+    u_char                       *file;
+    ngx_uint_t                    n;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_shard_t  *shard;
 
     cache = shm_zone->data;
 
@@ -89,6 +147,13 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
             }
         }
 
+        if (cache->shards != ocache->sh->nshards) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "cache \"%V\" had previously different shards",
+                          &shm_zone->shm.name);
+            return NGX_ERROR;
+        }
+
         cache->sh = ocache->sh;
 
         cache->shpool = ocache->shpool;
@@ -119,14 +184,51 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 
     cache->shpool->data = cache->sh;
 
-    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
-                    ngx_http_file_cache_rbtree_insert_value);
+    len = cache->shards * sizeof(ngx_http_file_cache_shard_t);
+
+    cache->sh->shards = ngx_slab_alloc(cache->shpool, len);
+    if (cache->sh->shards == NULL) {
+        return NGX_ERROR;
+    }
+
+#if (NGX_HAVE_ATOMIC_OPS)
+
+    file = NULL;
+
+#else
+
+    len = ngx_cycle->lock_file.len + shm_zone->shm.name.len + NGX_INT_T_LEN + 2;
+
+    file = ngx_pnalloc(ngx_cycle->pool, len);
+    if (file == NULL) {
+        return NGX_ERROR;
+    }
+
+#endif
+
+    for (n = 0; n < cache->shards; n++) {
+        shard = &cache->sh->shards[n];
 
-    ngx_queue_init(&cache->sh->queue);
+        ngx_memzero(shard, sizeof(ngx_http_file_cache_shard_t));
 
+        ngx_rbtree_init(&shard->rbtree, &shard->sentinel,
+                        ngx_http_file_cache_rbtree_insert_value);
+
+        ngx_queue_init(&shard->queue);
+
+#if !(NGX_HAVE_ATOMIC_OPS)
+        (void) ngx_sprintf(file, "%V%V.%ui%Z", &ngx_cycle->lock_file,
+                           &shm_zone->shm.name, n);
+#endif
+
+        if (ngx_shmtx_create(&shard->mutex, &shard->lock, file) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    cache->sh->nshards = cache->shards;
     cache->sh->cold = 1;
     cache->sh->loading = 0;
-    cache->sh->size = 0;
 
     cache->bsize = ngx_fs_bsize(cache->path->name.data);
 
@@ -142,6 +244,18 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
     ngx_sprintf(cache->shpool->log_ctx, " in cache keys zone \"%V\"%Z",
                 &shm_zone->shm.name);
 
+    /*
+     * reading the index removes the "clean" flag on disk,
+     * so neither "nginx -t" nor "nginx -s" may read it
+     */
+
+    if (cache->index.len
+        && !ngx_test_config
+        && ngx_process != NGX_PROCESS_SIGNALLER)
+    {
+        ngx_http_file_cache_read_index(cache, shm_zone->shm.log);
+    }
+
     return NGX_OK;
 }
 
@@ -236,22 +350,55 @@ ngx_http_file_cache_create_key(ngx_http_request_t *r)
 ngx_int_t
 ngx_http_file_cache_open(ngx_http_request_t *r)
 {
-    ngx_int_t                  rc, rv;
-    ngx_uint_t                 cold, test;
-    ngx_http_cache_t          *c;
-    ngx_pool_cleanup_t        *cln;
-    ngx_open_file_info_t       of;
-    ngx_http_file_cache_t     *cache;
-    ngx_http_core_loc_conf_t  *clcf;
+    ngx_int_t                     rc, rv;
+    ngx_uint_t                    cold, test;
+    ngx_http_cache_t             *c;
+    ngx_pool_cleanup_t           *cln;
+    ngx_open_file_info_t          of;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_core_loc_conf_t     *clcf;
+    ngx_http_file_cache_shard_t  *shard;
 
     c = r->cache;
 
+    if (c->waiting) {
+        return NGX_AGAIN;
+    }
+
     if (c->buf) {
         return ngx_http_file_cache_read(r, c);
     }
 
     cache = c->file_cache;
 
+    if (c->node) {
+
+        /* the cache lock has been released or has timed out */
+
+        shard = ngx_http_file_cache_shard(cache, c->key);
+
+        ngx_shmtx_lock(&shard->mutex);
+
+        c->exists = c->node->exists;
+        c->uniq = c->node->uniq;
+        c->error = c->node->error;
+
+        if (c->node->body_start) {
+            c->body_start = c->node->body_start;
+        }
+
+        ngx_shmtx_unlock(&shard->mutex);
+
+        if (c->error) {
+            return c->error;
+        }
+
+        test = c->exists ? 1 : 0;
+        rv = NGX_DECLINED;
+
+        goto open;
+    }
+
     cln = ngx_pool_cleanup_add(r->pool, 0);
     if (cln == NULL) {
         return NGX_ERROR;
@@ -307,8 +454,10 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
+open:
+
     if (!test) {
-        return NGX_DECLINED;
+        goto done;
     }
 
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
@@ -332,7 +481,7 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
 
         case NGX_ENOENT:
         case NGX_ENOTDIR:
-            return rv;
+            goto done;
 
         default:
             ngx_log_error(NGX_LOG_CRIT, r->connection->log, of.err,
@@ -356,6 +505,131 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
     }
 
     return ngx_http_file_cache_read(r, c);
+
+done:
+
+    if (rv == NGX_DECLINED) {
+        return ngx_http_file_cache_lock(r, c);
+    }
+
+    return rv;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    ngx_msec_t                    now, timer;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_shard_t  *shard;
+
+    if (!c->lock) {
+        return NGX_DECLINED;
+    }
+
+    cache = c->file_cache;
+
+    /*
+     * the first request that misses becomes the owner of the lock and
+     * goes to the upstream, the rest wait until it has updated the node
+     */
+
+    shard = ngx_http_file_cache_shard(cache, c->key);
+
+    ngx_shmtx_lock(&shard->mutex);
+
+    if (!c->node->updating) {
+        c->node->updating = 1;
+        c->updating = 1;
+    }
+
+    ngx_shmtx_unlock(&shard->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache lock u:%d wt:%M",
+                   c->updating, c->wait_time);
+
+    if (c->updating) {
+        return NGX_DECLINED;
+    }
+
+    c->waiting = 1;
+
+    now = ngx_current_msec;
+
+    if (c->wait_time == 0) {
+        c->wait_time = now + c->lock_timeout;
+
+        c->wait_event.handler = ngx_http_file_cache_lock_wait_handler;
+        c->wait_event.data = r;
+        c->wait_event.log = r->connection->log;
+    }
+
+    timer = c->wait_time - now;
+
+    ngx_add_timer(&c->wait_event, (timer > 500) ? 500 : timer);
+
+    r->main->blocked++;
+
+    return NGX_AGAIN;
+}
+
+
+static void
+ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev)
+{
+    ngx_uint_t                    wait;
+    ngx_msec_t                    timer;
+    ngx_http_cache_t             *c;
+    ngx_connection_t             *conn;
+    ngx_http_request_t           *r;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_shard_t  *shard;
+
+    r = ev->data;
+    c = r->cache;
+    conn = r->connection;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http file cache wait handler wt:%M cur:%M",
+                   c->wait_time, ngx_current_msec);
+
+    timer = c->wait_time - ngx_current_msec;
+
+    if ((ngx_msec_int_t) timer <= 0) {
+        ngx_log_error(NGX_LOG_INFO, ev->log, 0, "cache lock timeout");
+
+        /* stop waiting and go to the upstream */
+
+        c->lock = 0;
+        goto wakeup;
+    }
+
+    cache = c->file_cache;
+    shard = ngx_http_file_cache_shard(cache, c->key);
+    wait = 0;
+
+    ngx_shmtx_lock(&shard->mutex);
+
+    if (c->node->updating) {
+        wait = 1;
+    }
+
+    ngx_shmtx_unlock(&shard->mutex);
+
+    if (wait) {
+        ngx_add_timer(ev, (timer > 500) ? 500 : timer);
+        return;
+    }
+
+wakeup:
+
+    c->waiting = 0;
+    r->main->blocked--;
+
+    r->write_event_handler(r);
+
+    ngx_http_run_posted_requests(conn);
 }
 
 
@@ -366,6 +640,7 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
     ssize_t                        n;
     ngx_int_t                      rc;
     ngx_http_file_cache_t         *cache;
+    ngx_http_file_cache_shard_t   *shard;
     ngx_http_file_cache_header_t  *h;
 
     n = ngx_http_file_cache_aio_read(r, c);
@@ -398,19 +673,24 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
     c->buf->last += n;
 
     c->valid_sec = h->valid_sec;
+    c->updating_sec = h->updating_sec;
+    c->error_sec = h->error_sec;
     c->last_modified = h->last_modified;
     c->date = h->date;
     c->valid_msec = h->valid_msec;
     c->header_start = h->header_start;
     c->body_start = h->body_start;
+    c->etag.len = h->etag_len;
+    c->etag.data = h->etag;
 
     r->cached = 1;
 
     cache = c->file_cache;
+    shard = ngx_http_file_cache_shard(cache, c->key);
 
     if (cache->sh->cold) {
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_shmtx_lock(&shard->mutex);
 
         if (!c->node->exists) {
             c->node->uses = 1;
@@ -419,17 +699,19 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
             c->node->uniq = c->uniq;
             c->node->fs_size = c->fs_size;
 
-            cache->sh->size += c->fs_size;
+            shard->size += c->fs_size;
         }
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(&shard->mutex);
     }
 
     now = ngx_time();
 
     if (c->valid_sec < now) {
+        c->stale_updating = c->valid_sec + c->updating_sec >= now;
+        c->stale_error = c->valid_sec + c->error_sec >= now;
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_shmtx_lock(&shard->mutex);
 
         if (c->node->updating) {
             rc = NGX_HTTP_CACHE_UPDATING;
@@ -440,7 +722,7 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
             rc = NGX_HTTP_CACHE_STALE;
         }
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(&shard->mutex);
 
         ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "http file cache expired: %i %T %T",
@@ -456,17 +738,34 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 static ssize_t
 ngx_http_file_cache_aio_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-#if (NGX_HAVE_FILE_AIO)
+#if (NGX_HAVE_FILE_AIO || NGX_THREAD_POOL)
     ssize_t                    n;
     ngx_http_core_loc_conf_t  *clcf;
 
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+#endif
+
+#if (NGX_THREAD_POOL)
+
+    if (clcf->aio == NGX_HTTP_AIO_THREADS) {
+        c->file.thread_handler = ngx_http_cache_thread_handler;
+        c->file.thread_ctx = r;
+
+        n = ngx_thread_read(&c->thread_task, &c->file, c->buf->pos,
+                            c->body_start, 0, r->pool);
+
+        return n;
+    }
+
+#endif
+
+#if (NGX_HAVE_FILE_AIO)
+
     if (!ngx_file_aio) {
         goto noaio;
     }
 
-    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
-
-    if (!clcf->aio) {
+    if (clcf->aio != NGX_HTTP_AIO_ON && clcf->aio != NGX_HTTP_AIO_SENDFILE) {
         goto noaio;
     }
 
@@ -512,18 +811,69 @@ ngx_http_cache_aio_event_handler(ngx_event_t *ev)
 #endif
 
 
+#if (NGX_THREAD_POOL)
+
+static ngx_int_t
+ngx_http_cache_thread_handler(ngx_thread_task_t *task, ngx_file_t *file)
+{
+    ngx_http_request_t        *r;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    r = file->thread_ctx;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    task->event.data = r;
+    task->event.handler = ngx_http_cache_thread_event_handler;
+
+    if (ngx_thread_task_post(clcf->thread_pool, task) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->main->blocked++;
+    r->aio = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_cache_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    r->connection->write->handler(r->connection->write);
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 {
-    ngx_int_t                    rc;
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_int_t                     rc;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard;
+
+    shard = ngx_http_file_cache_shard(cache, c->key);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_shmtx_lock(&shard->mutex);
 
-    fcn = ngx_http_file_cache_lookup(cache, c->key);
+    fcn = ngx_http_file_cache_lookup(shard, c->key);
 
     if (fcn) {
-        ngx_queue_remove(&fcn->queue);
+
+        /*
+         * a hit only marks the node as referenced, the node is moved
+         * in the inactive queue later, when the queue is swept
+         */
+
+        fcn->referenced = 1;
 
         fcn->uses++;
         fcn->count++;
@@ -556,17 +906,15 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
         goto done;
     }
 
-    fcn = ngx_slab_alloc_locked(cache->shpool,
-                                sizeof(ngx_http_file_cache_node_t));
+    fcn = ngx_slab_alloc(cache->shpool, sizeof(ngx_http_file_cache_node_t));
     if (fcn == NULL) {
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(&shard->mutex);
 
         (void) ngx_http_file_cache_forced_expire(cache);
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_shmtx_lock(&shard->mutex);
 
-        fcn = ngx_slab_alloc_locked(cache->shpool,
-                                    sizeof(ngx_http_file_cache_node_t));
+        fcn = ngx_slab_alloc(cache->shpool, sizeof(ngx_http_file_cache_node_t));
         if (fcn == NULL) {
             rc = NGX_ERROR;
             goto failed;
@@ -578,12 +926,15 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
     ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
                NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-    ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+    ngx_rbtree_insert(&shard->rbtree, &fcn->node);
+
+    ngx_queue_insert_head(&shard->queue, &fcn->queue);
 
     fcn->uses = 1;
     fcn->count = 1;
     fcn->updating = 0;
     fcn->deleting = 0;
+    fcn->referenced = 0;
 
 renew:
 
@@ -601,15 +952,13 @@ done:
 
     fcn->expire = ngx_time() + cache->inactive;
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
-
     c->uniq = fcn->uniq;
     c->error = fcn->error;
     c->node = fcn;
 
 failed:
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->mutex);
 
     return rc;
 }
@@ -646,8 +995,19 @@ ngx_http_file_cache_name(ngx_http_request_t *r, ngx_path_t *path)
 }
 
 
+static ngx_http_file_cache_shard_t *
+ngx_http_file_cache_shard(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_rbtree_key_t  node_key;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    return &cache->sh->shards[node_key % cache->sh->nshards];
+}
+
+
 static ngx_http_file_cache_node_t *
-ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key)
+ngx_http_file_cache_lookup(ngx_http_file_cache_shard_t *shard, u_char *key)
 {
     ngx_int_t                    rc;
     ngx_rbtree_key_t             node_key;
@@ -656,8 +1016,8 @@ ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key)
 
     ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
 
-    node = cache->sh->rbtree.root;
-    sentinel = cache->sh->rbtree.sentinel;
+    node = shard->rbtree.root;
+    sentinel = shard->rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -750,6 +1110,8 @@ ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
     c = r->cache;
 
     h->valid_sec = c->valid_sec;
+    h->updating_sec = c->updating_sec;
+    h->error_sec = c->error_sec;
     h->last_modified = c->last_modified;
     h->date = c->date;
     h->crc32 = c->crc32;
@@ -757,6 +1119,14 @@ ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
     h->header_start = (u_short) c->header_start;
     h->body_start = (u_short) c->body_start;
 
+    if (c->etag.len <= NGX_HTTP_CACHE_ETAG_LEN) {
+        h->etag_len = (u_char) c->etag.len;
+        ngx_memcpy(h->etag, c->etag.data, c->etag.len);
+
+    } else {
+        h->etag_len = 0;
+    }
+
     p = buf + sizeof(ngx_http_file_cache_header_t);
 
     p = ngx_cpymem(p, ngx_http_file_cache_key, sizeof(ngx_http_file_cache_key));
@@ -773,13 +1143,14 @@ ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
 void
 ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 {
-    off_t                   fs_size;
-    ngx_int_t               rc;
-    ngx_file_uniq_t         uniq;
-    ngx_file_info_t         fi;
-    ngx_http_cache_t        *c;
-    ngx_ext_rename_file_t   ext;
-    ngx_http_file_cache_t  *cache;
+    off_t                         fs_size;
+    ngx_int_t                     rc;
+    ngx_file_uniq_t               uniq;
+    ngx_file_info_t               fi;
+    ngx_http_cache_t             *c;
+    ngx_ext_rename_file_t         ext;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_shard_t  *shard;
 
     c = r->cache;
 
@@ -825,13 +1196,15 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
         }
     }
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    shard = ngx_http_file_cache_shard(cache, c->key);
+
+    ngx_shmtx_lock(&shard->mutex);
 
     c->node->count--;
     c->node->uniq = uniq;
     c->node->body_start = c->body_start;
 
-    cache->sh->size += fs_size - c->node->fs_size;
+    shard->size += fs_size - c->node->fs_size;
     c->node->fs_size = fs_size;
 
     if (rc == NGX_OK) {
@@ -840,57 +1213,159 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 
     c->node->updating = 0;
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->mutex);
 }
 
 
-ngx_int_t
-ngx_http_cache_send(ngx_http_request_t *r)
+void
+ngx_http_file_cache_update_header(ngx_http_request_t *r)
 {
-    ngx_int_t          rc;
-    ngx_buf_t         *b;
-    ngx_chain_t        out;
-    ngx_http_cache_t  *c;
+    ssize_t                        n;
+    ngx_file_t                     file;
+    ngx_file_info_t                fi;
+    ngx_http_cache_t              *c;
+    ngx_http_file_cache_t         *cache;
+    ngx_http_file_cache_shard_t   *shard;
+    ngx_http_file_cache_header_t   h;
 
     c = r->cache;
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache send: %s", c->file.name.data);
-
-    if (r != r->main && c->length - c->body_start == 0) {
-        return ngx_http_send_header(r);
+    if (c->updated) {
+        return;
     }
 
-    /* we need to allocate all before the header would be sent */
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache update header");
 
-    b = ngx_pcalloc(r->pool, sizeof(ngx_buf_t));
-    if (b == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    c->updated = 1;
+    c->updating = 0;
+
+    cache = c->file_cache;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = c->file.name;
+    file.log = r->connection->log;
+
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDWR, NGX_FILE_OPEN, 0);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", file.name.data);
+        goto done;
     }
 
-    b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
-    if (b->file == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", file.name.data);
+        goto close;
     }
 
-    rc = ngx_http_send_header(r);
+    n = ngx_read_file(&file, (u_char *) &h,
+                      sizeof(ngx_http_file_cache_header_t), 0);
 
-    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
-        return rc;
+    if (n == NGX_ERROR) {
+        goto close;
     }
 
-    b->file_pos = c->body_start;
-    b->file_last = c->length;
+    if ((size_t) n != sizeof(ngx_http_file_cache_header_t)) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      ngx_read_file_n " read only %z of %z from \"%s\"",
+                      n, sizeof(ngx_http_file_cache_header_t),
+                      file.name.data);
+        goto close;
+    }
 
-    b->in_file = (c->length - c->body_start) ? 1: 0;
-    b->last_buf = (r == r->main) ? 1: 0;
-    b->last_in_chain = 1;
+    if (ngx_file_uniq(&fi) != c->uniq
+        || h.crc32 != c->crc32
+        || h.last_modified != c->last_modified
+        || h.header_start != c->header_start
+        || h.body_start != c->body_start)
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache \"%s\" content changed",
+                       file.name.data);
+        goto close;
+    }
 
-    b->file->fd = c->file.fd;
-    b->file->name = c->file.name;
-    b->file->log = r->connection->log;
+    /* only the validity of the entry changes, the body is left intact */
 
-    out.buf = b;
+    h.valid_sec = c->valid_sec;
+    h.updating_sec = c->updating_sec;
+    h.error_sec = c->error_sec;
+    h.date = c->date;
+    h.valid_msec = (u_short) c->valid_msec;
+
+    (void) ngx_write_file(&file, (u_char *) &h,
+                          sizeof(ngx_http_file_cache_header_t), 0);
+
+close:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+
+done:
+
+    shard = ngx_http_file_cache_shard(cache, c->key);
+
+    ngx_shmtx_lock(&shard->mutex);
+
+    c->node->count--;
+    c->node->updating = 0;
+
+    ngx_shmtx_unlock(&shard->mutex);
+}
+
+
+ngx_int_t
+ngx_http_cache_send(ngx_http_request_t *r)
+{
+    ngx_int_t          rc;
+    ngx_buf_t         *b;
+    ngx_chain_t        out;
+    ngx_http_cache_t  *c;
+
+    c = r->cache;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache send: %s", c->file.name.data);
+
+    if (r != r->main && c->length - c->body_start == 0) {
+        return ngx_http_send_header(r);
+    }
+
+    /* we need to allocate all before the header would be sent */
+
+    b = ngx_pcalloc(r->pool, sizeof(ngx_buf_t));
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+    if (b->file == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    b->file_pos = c->body_start;
+    b->file_last = c->length;
+
+    b->in_file = (c->length - c->body_start) ? 1: 0;
+    b->last_buf = (r == r->main) ? 1: 0;
+    b->last_in_chain = 1;
+
+    b->file->fd = c->file.fd;
+    b->file->name = c->file.name;
+    b->file->log = r->connection->log;
+
+    out.buf = b;
     out.next = NULL;
 
     return ngx_http_output_filter(r, &out);
@@ -900,8 +1375,9 @@ ngx_http_cache_send(ngx_http_request_t *r)
 void
 ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 {
-    ngx_http_file_cache_t       *cache;
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard;
 
     if (c->updated || c->node == NULL) {
         return;
@@ -912,7 +1388,9 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
                    "http file cache free, fd: %d", c->file.fd);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    shard = ngx_http_file_cache_shard(cache, c->key);
+
+    ngx_shmtx_lock(&shard->mutex);
 
     fcn = c->node;
     fcn->count--;
@@ -931,12 +1409,12 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 
     } else if (!fcn->exists && fcn->count == 0 && c->min_uses == 1) {
         ngx_queue_remove(&fcn->queue);
-        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
-        ngx_slab_free_locked(cache->shpool, fcn);
+        ngx_rbtree_delete(&shard->rbtree, &fcn->node);
+        ngx_slab_free(cache->shpool, fcn);
         c->node = NULL;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->mutex);
 
     c->updated = 1;
     c->updating = 0;
@@ -962,6 +1440,10 @@ ngx_http_file_cache_cleanup(void *data)
 {
     ngx_http_cache_t  *c = data;
 
+    if (c->wait_event.timer_set) {
+        ngx_del_timer(&c->wait_event);
+    }
+
     if (c->updated) {
         return;
     }
@@ -981,13 +1463,14 @@ ngx_http_file_cache_cleanup(void *data)
 static time_t
 ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
 {
-    u_char                      *name;
-    size_t                       len;
-    time_t                       wait;
-    ngx_uint_t                   tries;
-    ngx_path_t                  *path;
-    ngx_queue_t                 *q;
-    ngx_http_file_cache_node_t  *fcn;
+    u_char                       *name;
+    size_t                        len;
+    time_t                        wait;
+    ngx_uint_t                    i, tries;
+    ngx_path_t                   *path;
+    ngx_queue_t                  *q, *prev;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
                    "http file cache forced expire");
@@ -1003,38 +1486,54 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
     ngx_memcpy(name, path->name.data, path->name.len);
 
     wait = 10;
-    tries = 20;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    /* the shards are tried in turn, so that a single shard is not drained */
 
-    for (q = ngx_queue_last(&cache->sh->queue);
-         q != ngx_queue_sentinel(&cache->sh->queue);
-         q = ngx_queue_prev(q))
-    {
-        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+    for (i = 0; i < cache->sh->nshards && wait != 0; i++) {
 
-        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+        shard = &cache->sh->shards[cache->next_shard++ % cache->sh->nshards];
+
+        tries = 20;
+
+        ngx_shmtx_lock(&shard->mutex);
+
+        for (q = ngx_queue_last(&shard->queue);
+             q != ngx_queue_sentinel(&shard->queue);
+             q = prev)
+        {
+            prev = ngx_queue_prev(q);
+
+            fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+            ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
                   "http file cache forced expire: #%d %d %02xd%02xd%02xd%02xd",
                   fcn->count, fcn->exists,
                   fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
 
-        if (fcn->count == 0) {
-            ngx_http_file_cache_delete(cache, q, name);
-            wait = 0;
+            if (fcn->count == 0 && !fcn->referenced) {
+                ngx_http_file_cache_delete(cache, shard, q, name);
+                wait = 0;
+                break;
+            }
+
+            if (fcn->referenced) {
+                fcn->referenced = 0;
+                ngx_queue_remove(q);
+                ngx_queue_insert_head(&shard->queue, q);
+            }
 
-        } else {
             if (--tries) {
                 continue;
             }
 
             wait = 1;
+
+            break;
         }
 
-        break;
+        ngx_shmtx_unlock(&shard->mutex);
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
-
     ngx_free(name);
 
     return wait;
@@ -1044,13 +1543,11 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
 static time_t
 ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
 {
-    u_char                      *name, *p;
-    size_t                       len;
-    time_t                       now, wait;
-    ngx_path_t                  *path;
-    ngx_queue_t                 *q;
-    ngx_http_file_cache_node_t  *fcn;
-    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+    u_char      *name;
+    size_t       len;
+    time_t       now, wait, next;
+    ngx_uint_t   i;
+    ngx_path_t  *path;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
                    "http file cache expire");
@@ -1066,23 +1563,86 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
     ngx_memcpy(name, path->name.data, path->name.len);
 
     now = ngx_time();
+    next = 10;
+
+    for (i = 0; i < cache->sh->nshards; i++) {
+        wait = ngx_http_file_cache_expire_shard(cache, &cache->sh->shards[i],
+                                                name, now);
+        if (wait < next) {
+            next = wait;
+        }
+    }
+
+    ngx_free(name);
+
+    return next;
+}
+
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+static time_t
+ngx_http_file_cache_expire_shard(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard, u_char *name, time_t now)
+{
+    u_char                      *p;
+    size_t                       len;
+    time_t                       wait;
+    ngx_uint_t                   tries;
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+
+    tries = 20;
+
+    ngx_shmtx_lock(&shard->mutex);
 
     for ( ;; ) {
 
-        if (ngx_queue_empty(&cache->sh->queue)) {
+        if (ngx_queue_empty(&shard->queue)) {
             wait = 10;
             break;
         }
 
-        q = ngx_queue_last(&cache->sh->queue);
+        q = ngx_queue_last(&shard->queue);
 
         fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
         wait = fcn->expire - now;
 
         if (wait > 0) {
+
+            /*
+             * a node hit since the last sweep gets a second chance,
+             * it is given the latest expiration time to keep the queue
+             * sorted, so it may live up to about twice the inactive time
+             */
+
+            if (fcn->referenced) {
+                fcn->referenced = 0;
+                fcn->expire = now + cache->inactive;
+                ngx_queue_remove(q);
+                ngx_queue_insert_head(&shard->queue, q);
+
+                if (--tries) {
+                    continue;
+                }
+
+                /* the mutex is released for a while after every 20 moves */
+
+                ngx_shmtx_unlock(&shard->mutex);
+
+                ngx_time_update();
+
+                if (ngx_time() != now) {
+                    return 1;
+                }
+
+                tries = 20;
+
+                ngx_shmtx_lock(&shard->mutex);
+
+                continue;
+            }
+
             wait = wait > 10 ? 10 : wait;
             break;
         }
@@ -1093,7 +1653,7 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
                        fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
 
         if (fcn->count == 0) {
-            ngx_http_file_cache_delete(cache, q, name);
+            ngx_http_file_cache_delete(cache, shard, q, name);
             continue;
         }
 
@@ -1115,24 +1675,22 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
 
         ngx_queue_remove(q);
         fcn->expire = ngx_time() + cache->inactive;
-        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+        ngx_queue_insert_head(&shard->queue, &fcn->queue);
 
         ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
                       "ignore long locked inactive cache entry %*s, count:%d",
                       2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
-
-    ngx_free(name);
+    ngx_shmtx_unlock(&shard->mutex);
 
     return wait;
 }
 
 
 static void
-ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
-    u_char *name)
+ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard, ngx_queue_t *q, u_char *name)
 {
     u_char                      *p;
     size_t                       len;
@@ -1142,7 +1700,7 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
     fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
     if (fcn->exists) {
-        cache->sh->size -= fcn->fs_size;
+        shard->size -= fcn->fs_size;
 
         path = cache->path;
         p = name + path->name.len + 1 + path->len;
@@ -1154,7 +1712,7 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
 
         fcn->count++;
         fcn->deleting = 1;
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(&shard->mutex);
 
         len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
         ngx_create_hashed_filename(path, name, len);
@@ -1167,15 +1725,15 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
                           ngx_delete_file_n " \"%s\" failed", name);
         }
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_shmtx_lock(&shard->mutex);
         fcn->count--;
         fcn->deleting = 0;
     }
 
     if (fcn->count == 0) {
         ngx_queue_remove(q);
-        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
-        ngx_slab_free_locked(cache->shpool, fcn);
+        ngx_rbtree_delete(&shard->rbtree, &fcn->node);
+        ngx_slab_free(cache->shpool, fcn);
     }
 }
 
@@ -1185,20 +1743,46 @@ ngx_http_file_cache_manager(void *data)
 {
     ngx_http_file_cache_t  *cache = data;
 
-    off_t   size;
-    time_t  next, wait;
+    off_t                         size;
+    time_t                        next, wait, now;
+    ngx_uint_t                    i;
+    ngx_http_file_cache_shard_t  *shard;
+
+    if (cache->index.len) {
+        now = ngx_time();
+
+        if (cache->index_next == 0) {
+            cache->index_next = now + cache->index_interval;
+
+        } else if (cache->index_next <= now) {
+            ngx_http_file_cache_write_index(cache, 0);
+
+            ngx_time_update();
+            cache->index_next = ngx_time() + cache->index_interval;
+        }
+    }
 
     next = ngx_http_file_cache_expire(cache);
 
+    if (cache->index.len && cache->index_next - ngx_time() < next) {
+        next = cache->index_next - ngx_time();
+    }
+
     cache->last = ngx_current_msec;
     cache->files = 0;
 
     for ( ;; ) {
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        size = 0;
+
+        for (i = 0; i < cache->sh->nshards; i++) {
+            shard = &cache->sh->shards[i];
 
-        size = cache->sh->size;
+            ngx_shmtx_lock(&shard->mutex);
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+            size += shard->size;
+
+            ngx_shmtx_unlock(&shard->mutex);
+        }
 
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
                        "http file cache size: %O", size);
@@ -1225,6 +1809,8 @@ ngx_http_file_cache_loader(void *data)
 {
     ngx_http_file_cache_t  *cache = data;
 
+    off_t           size;
+    ngx_uint_t      i;
     ngx_tree_ctx_t  tree;
 
     if (!cache->sh->cold || cache->sh->loading) {
@@ -1258,10 +1844,16 @@ ngx_http_file_cache_loader(void *data)
     cache->sh->cold = 0;
     cache->sh->loading = 0;
 
+    size = 0;
+
+    for (i = 0; i < cache->sh->nshards; i++) {
+        size += cache->sh->shards[i].size;
+    }
+
     ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
                   "http file cache: %V %.3fM, bsize: %uz",
                   &cache->path->name,
-                  ((double) cache->sh->size * cache->bsize) / (1024 * 1024),
+                  ((double) size * cache->bsize) / (1024 * 1024),
                   cache->bsize);
 }
 
@@ -1315,6 +1907,15 @@ ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
 
     cache = ctx->data;
 
+    /* the snapshot and its temporary file may be in the cache directory */
+
+    if (cache->index.len
+        && path->len >= cache->index.len
+        && ngx_strncmp(path->data, cache->index.data, cache->index.len) == 0)
+    {
+        return NGX_OK;
+    }
+
     if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
         (void) ngx_http_file_cache_delete_file(ctx, path);
     }
@@ -1369,18 +1970,20 @@ ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
 static ngx_int_t
 ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 {
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard;
+
+    shard = ngx_http_file_cache_shard(cache, c->key);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_shmtx_lock(&shard->mutex);
 
-    fcn = ngx_http_file_cache_lookup(cache, c->key);
+    fcn = ngx_http_file_cache_lookup(shard, c->key);
 
     if (fcn == NULL) {
 
-        fcn = ngx_slab_alloc_locked(cache->shpool,
-                                    sizeof(ngx_http_file_cache_node_t));
+        fcn = ngx_slab_alloc(cache->shpool, sizeof(ngx_http_file_cache_node_t));
         if (fcn == NULL) {
-            ngx_shmtx_unlock(&cache->shpool->mutex);
+            ngx_shmtx_unlock(&shard->mutex);
             return NGX_ERROR;
         }
 
@@ -1389,7 +1992,9 @@ ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
         ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
                    NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+        ngx_rbtree_insert(&shard->rbtree, &fcn->node);
+
+        ngx_queue_insert_head(&shard->queue, &fcn->queue);
 
         fcn->uses = 1;
         fcn->count = 0;
@@ -1398,22 +2003,21 @@ ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
         fcn->exists = 1;
         fcn->updating = 0;
         fcn->deleting = 0;
+        fcn->referenced = 0;
         fcn->uniq = 0;
         fcn->valid_sec = 0;
         fcn->body_start = 0;
         fcn->fs_size = c->fs_size;
 
-        cache->sh->size += c->fs_size;
+        shard->size += c->fs_size;
 
     } else {
-        ngx_queue_remove(&fcn->queue);
+        fcn->referenced = 1;
     }
 
     fcn->expire = ngx_time() + cache->inactive;
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
-
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->mutex);
 
     return NGX_OK;
 }
@@ -1434,6 +2038,470 @@ ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
 }
 
 
+static void
+ngx_http_file_cache_read_index(ngx_http_file_cache_t *cache, ngx_log_t *log)
+{
+    size_t                               size;
+    time_t                               now, inactive;
+    ssize_t                              n;
+    uint32_t                             crc32;
+    ngx_err_t                            err;
+    ngx_uint_t                           i, loaded;
+    ngx_file_t                           file;
+    ngx_file_info_t                      fi;
+    ngx_http_file_cache_node_t          *fcn;
+    ngx_http_file_cache_shard_t         *shard;
+    ngx_http_file_cache_index_entry_t   *entries, *e;
+    ngx_http_file_cache_index_header_t   h;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = cache->index;
+    file.log = log;
+
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDWR, NGX_FILE_OPEN, 0);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
+
+        if (err != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, log, err,
+                          ngx_open_file_n " \"%s\" failed", file.name.data);
+        }
+
+        return;
+    }
+
+    entries = NULL;
+
+    n = ngx_read_file(&file, (u_char *) &h, sizeof(h), 0);
+
+    if (n == NGX_ERROR) {
+        goto done;
+    }
+
+    if ((size_t) n != sizeof(h)
+        || h.magic != NGX_HTTP_FILE_CACHE_INDEX_MAGIC
+        || h.entry_size != sizeof(ngx_http_file_cache_index_entry_t)
+        || h.bsize != cache->bsize)
+    {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "cache index \"%s\" is invalid, ignored",
+                      file.name.data);
+        goto done;
+    }
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", file.name.data);
+        goto done;
+    }
+
+    size = (size_t) (ngx_file_size(&fi) - sizeof(h));
+
+    if (size != h.entries * sizeof(ngx_http_file_cache_index_entry_t)) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "cache index \"%s\" is truncated, ignored",
+                      file.name.data);
+        goto done;
+    }
+
+    if (size) {
+        entries = ngx_alloc(size, log);
+        if (entries == NULL) {
+            goto done;
+        }
+
+        n = ngx_read_file(&file, (u_char *) entries, size, sizeof(h));
+
+        if (n == NGX_ERROR) {
+            goto done;
+        }
+
+        if ((size_t) n != size) {
+            ngx_log_error(NGX_LOG_WARN, log, 0,
+                          "cache index \"%s\" is truncated, ignored",
+                          file.name.data);
+            goto done;
+        }
+    }
+
+    ngx_crc32_init(crc32);
+    ngx_crc32_update(&crc32, (u_char *) entries, size);
+    ngx_crc32_final(crc32);
+
+    if (crc32 != h.crc32) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "cache index \"%s\" has wrong checksum, ignored",
+                      file.name.data);
+        goto done;
+    }
+
+    /* the least recently used entries are put in the queue first */
+
+    ngx_qsort(entries, h.entries, sizeof(ngx_http_file_cache_index_entry_t),
+              ngx_http_file_cache_index_cmp);
+
+    now = ngx_time();
+    loaded = 0;
+
+    for (i = 0; i < h.entries; i++) {
+        e = &entries[i];
+
+        shard = ngx_http_file_cache_shard(cache, e->key);
+
+        if (ngx_http_file_cache_lookup(shard, e->key)) {
+            continue;
+        }
+
+        fcn = ngx_slab_alloc_locked(cache->shpool,
+                                    sizeof(ngx_http_file_cache_node_t));
+        if (fcn == NULL) {
+            ngx_log_error(NGX_LOG_WARN, log, 0,
+                          "cache index \"%s\" does not fit in keys zone, "
+                          "%ui of %ui entries loaded",
+                          file.name.data, loaded, h.entries);
+            h.clean = 0;
+            break;
+        }
+
+        ngx_memcpy((u_char *) &fcn->node.key, e->key,
+                   sizeof(ngx_rbtree_key_t));
+
+        ngx_memcpy(fcn->key, &e->key[sizeof(ngx_rbtree_key_t)],
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        ngx_rbtree_insert(&shard->rbtree, &fcn->node);
+
+        fcn->uses = 1;
+        fcn->count = 0;
+        fcn->valid_msec = 0;
+        fcn->error = 0;
+        fcn->exists = 1;
+        fcn->updating = 0;
+        fcn->deleting = 0;
+        fcn->referenced = 0;
+        fcn->uniq = e->uniq;
+        fcn->valid_sec = 0;
+        fcn->body_start = e->body_start;
+        fcn->fs_size = e->fs_size;
+
+        inactive = ngx_min(e->inactive, cache->inactive);
+        fcn->expire = now + inactive;
+
+        ngx_queue_insert_head(&shard->queue, &fcn->queue);
+
+        shard->size += e->fs_size;
+
+        loaded++;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "http file cache: %V index loaded, %ui entries%s",
+                  &cache->path->name, loaded, h.clean ? "" : ", not clean");
+
+    /*
+     * a snapshot written by the master process on graceful shutdown
+     * matches the cache directory, so the loader does not need to walk it;
+     * the snapshot is marked as used, since after a crash it would not
+     * match the directory
+     */
+
+    if (h.clean) {
+        cache->sh->cold = 0;
+        cache->path->loader = NULL;
+
+        h.clean = 0;
+        (void) ngx_write_file(&file, (u_char *) &h, sizeof(h), 0);
+    }
+
+done:
+
+    if (entries) {
+        ngx_free(entries);
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+}
+
+
+static int ngx_libc_cdecl
+ngx_http_file_cache_index_cmp(const void *one, const void *two)
+{
+    ngx_http_file_cache_index_entry_t  *first, *second;
+
+    first = (ngx_http_file_cache_index_entry_t *) one;
+    second = (ngx_http_file_cache_index_entry_t *) two;
+
+    if (first->inactive < second->inactive) {
+        return -1;
+    }
+
+    return (first->inactive > second->inactive) ? 1 : 0;
+}
+
+
+static void
+ngx_http_file_cache_saver(void *data, ngx_uint_t clean)
+{
+    ngx_http_file_cache_t  *cache = data;
+
+    if (cache->index.len) {
+        ngx_http_file_cache_write_index(cache, clean && !cache->sh->cold);
+    }
+}
+
+
+static void
+ngx_http_file_cache_write_index(ngx_http_file_cache_t *cache,
+    ngx_uint_t clean)
+{
+    size_t                               size;
+    time_t                               now;
+    off_t                                offset;
+    u_char                               key[NGX_HTTP_CACHE_KEY_LEN];
+    ngx_uint_t                           n, i, more;
+    ngx_file_t                           file;
+    ngx_rbtree_node_t                   *node, *sentinel;
+    ngx_http_file_cache_node_t          *fcn;
+    ngx_http_file_cache_shard_t         *shard;
+    ngx_http_file_cache_index_entry_t   *entries, *e;
+    ngx_http_file_cache_index_header_t   h;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.log = ngx_cycle->log;
+    file.name.len = cache->index.len + sizeof(".tmp") - 1;
+
+    file.name.data = ngx_alloc(file.name.len + 1, ngx_cycle->log);
+    if (file.name.data == NULL) {
+        return;
+    }
+
+    ngx_sprintf(file.name.data, "%V.tmp%Z", &cache->index);
+
+    entries = ngx_alloc(NGX_HTTP_FILE_CACHE_INDEX_BATCH
+                        * sizeof(ngx_http_file_cache_index_entry_t),
+                        ngx_cycle->log);
+    if (entries == NULL) {
+        ngx_free(file.name.data);
+        return;
+    }
+
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                            NGX_FILE_DEFAULT_ACCESS);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", file.name.data);
+        goto failed;
+    }
+
+    ngx_memzero(&h, sizeof(ngx_http_file_cache_index_header_t));
+
+    h.magic = NGX_HTTP_FILE_CACHE_INDEX_MAGIC;
+    h.entry_size = sizeof(ngx_http_file_cache_index_entry_t);
+    h.clean = clean;
+    h.bsize = cache->bsize;
+    h.time = ngx_time();
+
+    ngx_crc32_init(h.crc32);
+
+    offset = sizeof(ngx_http_file_cache_index_header_t);
+
+    /*
+     * the shard trees are walked in key order by small batches, so a shard
+     * mutex is not held for long; each batch is looked up again by the
+     * key it starts from, as the nodes may be freed in between
+     */
+
+    i = 0;
+    more = 0;
+
+    for ( ;; ) {
+
+        shard = &cache->sh->shards[i];
+
+        ngx_shmtx_lock(&shard->mutex);
+
+        now = ngx_time();
+        sentinel = shard->rbtree.sentinel;
+
+        fcn = ngx_http_file_cache_index_next(shard, more ? key : NULL);
+        node = fcn ? &fcn->node : sentinel;
+
+        for (n = 0; n < NGX_HTTP_FILE_CACHE_INDEX_BATCH && node != sentinel;
+             /* void */ )
+        {
+            fcn = (ngx_http_file_cache_node_t *) node;
+
+            if (fcn->exists && !fcn->deleting) {
+                e = &entries[n++];
+
+                ngx_memzero(e, sizeof(ngx_http_file_cache_index_entry_t));
+
+                ngx_memcpy(e->key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+                ngx_memcpy(&e->key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                           NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+                e->uniq = fcn->uniq;
+                e->inactive = fcn->expire - now;
+                e->fs_size = fcn->fs_size;
+                e->body_start = fcn->body_start;
+            }
+
+            /* the next node in order */
+
+            if (node->right != sentinel) {
+                node = node->right;
+
+                while (node->left != sentinel) {
+                    node = node->left;
+                }
+
+            } else {
+                while (node != shard->rbtree.root
+                       && node == node->parent->right)
+                {
+                    node = node->parent;
+                }
+
+                node = (node == shard->rbtree.root) ? sentinel : node->parent;
+            }
+        }
+
+        more = (node != sentinel);
+
+        if (more) {
+            fcn = (ngx_http_file_cache_node_t *) node;
+
+            ngx_memcpy(key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+        }
+
+        ngx_shmtx_unlock(&shard->mutex);
+
+        if (n) {
+            size = n * sizeof(ngx_http_file_cache_index_entry_t);
+
+            ngx_crc32_update(&h.crc32, (u_char *) entries, size);
+
+            if (ngx_write_file(&file, (u_char *) entries, size, offset)
+                == NGX_ERROR)
+            {
+                goto failed;
+            }
+
+            offset += size;
+            h.entries += n;
+        }
+
+        if (!more && ++i == cache->sh->nshards) {
+            break;
+        }
+    }
+
+    ngx_crc32_final(h.crc32);
+
+    if (ngx_write_file(&file, (u_char *) &h, sizeof(h), 0) == NGX_ERROR) {
+        goto failed;
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+
+    file.fd = NGX_INVALID_FILE;
+
+    if (ngx_rename_file(file.name.data, cache->index.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%V\" failed",
+                      file.name.data, &cache->index);
+        goto failed;
+    }
+
+    ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                  "http file cache: %V index saved, %ui entries%s",
+                  &cache->path->name, h.entries, clean ? ", clean" : "");
+
+    ngx_free(entries);
+    ngx_free(file.name.data);
+
+    return;
+
+failed:
+
+    if (file.fd != NGX_INVALID_FILE) {
+        if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", file.name.data);
+        }
+
+        if (ngx_delete_file(file.name.data) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed",
+                          file.name.data);
+        }
+    }
+
+    ngx_free(entries);
+    ngx_free(file.name.data);
+}
+
+
+static ngx_http_file_cache_node_t *
+ngx_http_file_cache_index_next(ngx_http_file_cache_shard_t *shard, u_char *key)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_key_t             node_key;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_http_file_cache_node_t  *fcn, *next;
+
+    /* the first node with the key not less than the given one */
+
+    node = shard->rbtree.root;
+    sentinel = shard->rbtree.sentinel;
+
+    next = NULL;
+    node_key = 0;
+
+    if (key) {
+        ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+    }
+
+    while (node != sentinel) {
+
+        fcn = (ngx_http_file_cache_node_t *) node;
+
+        if (key == NULL || node->key > node_key) {
+            rc = 1;
+
+        } else if (node->key < node_key) {
+            rc = -1;
+
+        } else {
+            rc = ngx_memcmp(fcn->key, &key[sizeof(ngx_rbtree_key_t)],
+                            NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+        }
+
+        if (rc >= 0) {
+            next = fcn;
+            node = node->left;
+
+        } else {
+            node = node->right;
+        }
+    }
+
+    return next;
+}
+
+
 time_t
 ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status)
 {
@@ -1465,9 +2533,10 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     off_t                   max_size;
     u_char                 *last, *p;
-    time_t                  inactive;
+    time_t                  inactive, index_interval;
     ssize_t                 size;
-    ngx_str_t               s, name, *value;
+    ngx_int_t               shards;
+    ngx_str_t               s, name, index, *value;
     ngx_uint_t              i, n;
     ngx_http_file_cache_t  *cache;
 
@@ -1482,10 +2551,13 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     inactive = 600;
+    index_interval = 600;
 
     name.len = 0;
+    index.len = 0;
     size = 0;
     max_size = NGX_MAX_OFF_T_VALUE;
+    shards = 1;
 
     value = cf->args->elts;
 
@@ -1595,6 +2667,52 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (shards < 1 || shards > NGX_HTTP_FILE_CACHE_MAX_SHARDS) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid shards value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "index=", 6) == 0) {
+
+            index.len = value[i].len - 6;
+            index.data = value[i].data + 6;
+
+            if (index.len == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid index \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (ngx_conf_full_name(cf->cycle, &index, 0) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "index_interval=", 15) == 0) {
+
+            s.len = value[i].len - 15;
+            s.data = value[i].data + 15;
+
+            index_interval = ngx_parse_time(&s, 1);
+            if (index_interval <= 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid index_interval value \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -1609,6 +2727,7 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     cache->path->manager = ngx_http_file_cache_manager;
     cache->path->loader = ngx_http_file_cache_loader;
+    cache->path->saver = ngx_http_file_cache_saver;
     cache->path->data = cache;
     cache->path->conf_file = cf->conf_file->file.name.data;
     cache->path->line = cf->conf_file->line;
@@ -1634,6 +2753,10 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     cache->inactive = inactive;
     cache->max_size = max_size;
+    cache->shards = shards;
+
+    cache->index = index;
+    cache->index_interval = index_interval;
 
     return NGX_CONF_OK;
 }
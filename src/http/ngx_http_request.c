@@ -210,7 +210,7 @@ ngx_http_init_connection(ngx_connection_t *c)
     c->write->handler = ngx_http_empty_handler;
 
 #if (NGX_STAT_STUB)
-    (void) ngx_atomic_fetch_add(ngx_stat_reading, 1);
+    ngx_stat_add(ngx_stat_reading, 1);
 #endif
 	// 连接上有用户请求的数据
     if (rev->ready) {
@@ -230,7 +230,7 @@ ngx_http_init_connection(ngx_connection_t *c)
 	/*调用ngx_handle_read_event方法把连接c的可读事件添加到epoll中 这里并没有把可写事件添加到epoll中，因为现在不需要向客户端发送任何数据--luguifang*/
     if (ngx_handle_read_event(rev, 0) != NGX_OK) {
 #if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_reading, -1);
+        ngx_stat_add(ngx_stat_reading, -1);
 #endif
         ngx_http_close_connection(c);
         return;
@@ -260,7 +260,7 @@ ngx_http_init_request(ngx_event_t *rev)
 #endif
 
 #if (NGX_STAT_STUB)
-    (void) ngx_atomic_fetch_add(ngx_stat_reading, -1);
+    ngx_stat_add(ngx_stat_reading, -1);
 #endif
 
     c = rev->data;
@@ -522,9 +522,9 @@ ngx_http_init_request(ngx_event_t *rev)
     r->log_handler = ngx_http_log_error_handler;
 
 #if (NGX_STAT_STUB)
-    (void) ngx_atomic_fetch_add(ngx_stat_reading, 1);
+    ngx_stat_add(ngx_stat_reading, 1);
     r->stat_reading = 1;
-    (void) ngx_atomic_fetch_add(ngx_stat_requests, 1);
+    ngx_stat_add(ngx_stat_requests, 1);
 #endif
 	/*step11:调用ngx_http_process_request_line 接受http请求行------luguifang*/
     rev->handler(rev);
@@ -1684,9 +1684,9 @@ ngx_http_process_request(ngx_http_request_t *r)
     }
 
 #if (NGX_STAT_STUB)
-    (void) ngx_atomic_fetch_add(ngx_stat_reading, -1);
+    ngx_stat_add(ngx_stat_reading, -1);
     r->stat_reading = 0;
-    (void) ngx_atomic_fetch_add(ngx_stat_writing, 1);
+    ngx_stat_add(ngx_stat_writing, 1);
     r->stat_writing = 1;
 #endif
 	/*现在开始不会再需要接收HTTP请求行或者头部，所以需要重新设置当前连接读/写事件的回调方法*/
@@ -1967,6 +1967,30 @@ ngx_http_finalize_connection方法还会去检查引用计数情况，并不一
         rc = r->post_subrequest->handler(r, r->post_subrequest->data, rc);
     }
 
+    if (r->background) {
+
+        /*
+         * a background subrequest has no output of its own,
+         * it only holds a reference to the main request
+         */
+
+        if (r->done) {
+            return;
+        }
+
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+        if (clcf->log_subrequest) {
+            ngx_http_log_request(r);
+        }
+
+        r->logged = 1;
+        r->done = 1;
+
+        ngx_http_finalize_connection(r->main);
+        return;
+    }
+
     if (rc == NGX_ERROR
         || rc == NGX_HTTP_REQUEST_TIME_OUT
         || rc == NGX_HTTP_CLIENT_CLOSED_REQUEST
@@ -2582,7 +2606,7 @@ ngx_http_set_keepalive(ngx_http_request_t *r)
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "pipelined request");
 
 #if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_reading, 1);
+        ngx_stat_add(ngx_stat_reading, 1);
 #endif
 
         hc->pipeline = 1;
@@ -2813,7 +2837,7 @@ ngx_http_keepalive_handler(ngx_event_t *rev)
     b->last += n;
 
 #if (NGX_STAT_STUB)
-    (void) ngx_atomic_fetch_add(ngx_stat_reading, 1);
+    ngx_stat_add(ngx_stat_reading, 1);
 #endif
 
     c->log->handler = ngx_http_log_error;
@@ -3079,11 +3103,11 @@ ngx_http_free_request(ngx_http_request_t *r, ngx_int_t rc)
 #if (NGX_STAT_STUB)
 
     if (r->stat_reading) {
-        (void) ngx_atomic_fetch_add(ngx_stat_reading, -1);
+        ngx_stat_add(ngx_stat_reading, -1);
     }
 
     if (r->stat_writing) {
-        (void) ngx_atomic_fetch_add(ngx_stat_writing, -1);
+        ngx_stat_add(ngx_stat_writing, -1);
     }
 
 #endif
@@ -3167,7 +3191,7 @@ ngx_http_close_connection(ngx_connection_t *c)
 #endif
 
 #if (NGX_STAT_STUB)
-    (void) ngx_atomic_fetch_add(ngx_stat_active, -1);
+    ngx_stat_add(ngx_stat_active, -1);
 #endif
 
     c->destroyed = 1;
@@ -62,6 +62,7 @@
 #define NGX_HTTP_SUBREQUEST_IN_MEMORY      2
 #define NGX_HTTP_SUBREQUEST_WAITED         4
 #define NGX_HTTP_LOG_UNSAFE                8
+#define NGX_HTTP_SUBREQUEST_BACKGROUND     16
 
 
 #define NGX_HTTP_OK                        200
@@ -528,9 +529,11 @@ struct ngx_http_request_s {
     unsigned                          request_body_in_clean_file:1;
     unsigned                          request_body_file_group_access:1;
     unsigned                          request_body_file_log_level:3;
+    unsigned                          request_body_no_buffering:1;
 
     unsigned                          subrequest_in_memory:1;
     unsigned                          waited:1;
+    unsigned                          background:1;
 
 #if (NGX_HTTP_CACHE)
     unsigned                          cached:1;
@@ -44,6 +44,7 @@ ngx_http_read_client_request_body(ngx_http_request_t *r,
 	已经读取过HTTP包体了，不需要再次读取一遍，再检查请求ngx_http_request_t结构体中的discard_body标志位，如果discard_body为1，则证明曾经执行过
 	丢弃包体的方法，现在包体正在被丢弃中luguifang*/
     if (r->request_body || r->discard_body) {
+        r->request_body_no_buffering = 0;
 		/*直接执行各HTTP模块提供的post_handler回调方法*/
         post_handler(r);
         return NGX_OK;
@@ -60,6 +61,10 @@ ngx_http_read_client_request_body(ngx_http_request_t *r,
 
     r->request_body = rb;
 
+    if (r->headers_in.content_length_n <= 0) {
+        r->request_body_no_buffering = 0;
+    }
+
     if (r->headers_in.content_length_n < 0) {
         post_handler(r);
         return NGX_OK;
@@ -109,6 +114,51 @@ ngx_http_read_client_request_body(ngx_http_request_t *r,
 	设置到request_body结构体的post_handler成员中luguifang*/
     rb->post_handler = post_handler;
 
+    if (r->request_body_no_buffering) {
+
+        /*
+         * the body is not read here: the pre-read part is copied to rb->buf
+         * and the rest is read by the caller with
+         * ngx_http_read_unbuffered_request_body() as the buffer is sent
+         */
+
+        preread = r->header_in->last - r->header_in->pos;
+
+        if ((off_t) preread > r->headers_in.content_length_n) {
+            preread = (size_t) r->headers_in.content_length_n;
+        }
+
+        size = clcf->client_body_buffer_size;
+
+        if ((off_t) size > r->headers_in.content_length_n) {
+            size = (ssize_t) r->headers_in.content_length_n;
+        }
+
+        if ((size_t) size < preread) {
+            size = preread;
+        }
+
+        rb->buf = ngx_create_temp_buf(r->pool, size);
+        if (rb->buf == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http client request body unbuffered preread %uz",
+                       preread);
+
+        rb->buf->last = ngx_cpymem(rb->buf->last, r->header_in->pos, preread);
+
+        r->header_in->pos += preread;
+        r->request_length += preread;
+
+        rb->rest = r->headers_in.content_length_n - preread;
+
+        post_handler(r);
+
+        return NGX_OK;
+    }
+
     /*
      * set by ngx_pcalloc():
      *
@@ -424,6 +474,89 @@ ngx_http_do_read_client_request_body(ngx_http_request_t *r)
 }
 
 
+/*
+ * reads the unbuffered body into the free space of r->request_body->buf,
+ * returns NGX_AGAIN if the buffer is full or the client has sent nothing yet
+ */
+
+ngx_int_t
+ngx_http_read_unbuffered_request_body(ngx_http_request_t *r)
+{
+    size_t                     size;
+    ssize_t                    n;
+    ngx_connection_t          *c;
+    ngx_http_request_body_t   *rb;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    c = r->connection;
+    rb = r->request_body;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http read unbuffered client request body");
+
+    if (c->read->timedout) {
+        c->timedout = 1;
+        return NGX_HTTP_REQUEST_TIME_OUT;
+    }
+
+    while (rb->rest) {
+
+        size = rb->buf->end - rb->buf->last;
+
+        if (size == 0) {
+
+            /* the buffer has not been sent yet */
+
+            if (c->read->timer_set) {
+                ngx_del_timer(c->read);
+            }
+
+            return NGX_AGAIN;
+        }
+
+        if ((off_t) size > rb->rest) {
+            size = (size_t) rb->rest;
+        }
+
+        n = c->recv(c, rb->buf->last, size);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http client request body recv %z", n);
+
+        if (n == NGX_AGAIN) {
+            clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+            ngx_add_timer(c->read, clcf->client_body_timeout);
+
+            if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            }
+
+            return NGX_AGAIN;
+        }
+
+        if (n == 0) {
+            ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                          "client closed prematurely connection");
+        }
+
+        if (n == 0 || n == NGX_ERROR) {
+            c->error = 1;
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        rb->buf->last += n;
+        rb->rest -= n;
+        r->request_length += n;
+    }
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_write_request_body(ngx_http_request_t *r, ngx_chain_t *body)
 {
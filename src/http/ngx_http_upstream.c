@@ -15,8 +15,14 @@ static ngx_int_t ngx_http_upstream_cache(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static ngx_int_t ngx_http_upstream_cache_send(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_cache_background_update(
+    ngx_http_request_t *r, ngx_http_upstream_t *u);
 static ngx_int_t ngx_http_upstream_cache_status(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_upstream_cache_last_modified(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_upstream_cache_etag(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
 #endif
 
 static void ngx_http_upstream_init_request(ngx_http_request_t *r);
@@ -27,10 +33,15 @@ static void ngx_http_upstream_check_broken_connection(ngx_http_request_t *r,
     ngx_event_t *ev);
 static void ngx_http_upstream_connect(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_copy_peer(ngx_http_request_t *r,
+    ngx_peer_connection_t *pc);
 static ngx_int_t ngx_http_upstream_reinit(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static void ngx_http_upstream_send_request(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_send_request_body(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_read_request_handler(ngx_http_request_t *r);
 static void ngx_http_upstream_send_request_handler(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static void ngx_http_upstream_process_header(ngx_http_request_t *r,
@@ -67,6 +78,27 @@ static void ngx_http_upstream_dummy_handler(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static void ngx_http_upstream_next(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_uint_t ft_type);
+static void ngx_http_upstream_hedge_init(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_hedge_handler(ngx_event_t *ev);
+static void ngx_http_upstream_hedge_read_handler(ngx_event_t *ev);
+static void ngx_http_upstream_hedge_restore(ngx_http_request_t *r,
+    ngx_http_upstream_t *u, ngx_uint_t state);
+static void ngx_http_upstream_hedge_done(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_hedge_cmp(const void *one,
+    const void *two);
+static void ngx_http_upstream_hedge_close(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_hedge_close_connection(ngx_connection_t *c);
+static ngx_int_t ngx_http_upstream_queue_add(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_queue_handler(ngx_event_t *ev);
+static void ngx_http_upstream_queue_poll_handler(ngx_event_t *ev);
+static void ngx_http_upstream_queue_wake(ngx_http_upstream_queue_t *q);
+static void ngx_http_upstream_queue_remove(ngx_http_upstream_t *u);
+static void ngx_http_upstream_queue_remove_waiter(
+    ngx_http_upstream_waiter_t *w);
 static void ngx_http_upstream_cleanup(void *data);
 static void ngx_http_upstream_finalize_request(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_int_t rc);
@@ -90,6 +122,11 @@ static ngx_int_t ngx_http_upstream_process_buffering(ngx_http_request_t *r,
     ngx_table_elt_t *h, ngx_uint_t offset);
 static ngx_int_t ngx_http_upstream_process_charset(ngx_http_request_t *r,
     ngx_table_elt_t *h, ngx_uint_t offset);
+static ngx_int_t ngx_http_upstream_process_connection(ngx_http_request_t *r,
+    ngx_table_elt_t *h, ngx_uint_t offset);
+static ngx_int_t
+    ngx_http_upstream_process_transfer_encoding(ngx_http_request_t *r,
+    ngx_table_elt_t *h, ngx_uint_t offset);
 static ngx_int_t ngx_http_upstream_copy_header_line(ngx_http_request_t *r,
     ngx_table_elt_t *h, ngx_uint_t offset);
 static ngx_int_t
@@ -126,6 +163,8 @@ static ngx_int_t ngx_http_upstream_response_length_variable(
 static char *ngx_http_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy);
 static char *ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_upstream_queue(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 static void *ngx_http_upstream_create_main_conf(ngx_conf_t *cf);
 static char *ngx_http_upstream_init_main_conf(ngx_conf_t *cf, void *conf);
@@ -216,9 +255,13 @@ ngx_http_upstream_header_t  ngx_http_upstream_headers_in[] = {
                  offsetof(ngx_http_headers_out_t, accept_ranges), 1 },
 
     { ngx_string("Connection"),
-                 ngx_http_upstream_ignore_header_line, 0,
+                 ngx_http_upstream_process_connection, 0,
                  ngx_http_upstream_ignore_header_line, 0, 0 },
 
+    { ngx_string("Transfer-Encoding"),
+                 ngx_http_upstream_process_transfer_encoding, 0,
+                 ngx_http_upstream_copy_header_line, 0, 0 },
+
     { ngx_string("Keep-Alive"),
                  ngx_http_upstream_ignore_header_line, 0,
                  ngx_http_upstream_ignore_header_line, 0, 0 },
@@ -275,6 +318,13 @@ static ngx_command_t  ngx_http_upstream_commands[] = {
       0,
       NULL },
 
+    { ngx_string("queue"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      ngx_http_upstream_queue,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -334,6 +384,14 @@ static ngx_http_variable_t  ngx_http_upstream_vars[] = {
       ngx_http_upstream_cache_status, 0,
       NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+    { ngx_string("upstream_cache_last_modified"), NULL,
+      ngx_http_upstream_cache_last_modified, 0,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("upstream_cache_etag"), NULL,
+      ngx_http_upstream_cache_etag, 0,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
 #endif
 
     { ngx_null_string, NULL, NULL, 0, 0, 0 }
@@ -491,6 +549,10 @@ ngx_http_upstream_init_request(ngx_http_request_t *r)
         r->write_event_handler = ngx_http_upstream_wr_check_broken_connection;
     }
 
+    if (r->request_body_no_buffering) {
+        r->read_event_handler = ngx_http_upstream_read_request_handler;
+    }
+
     if (r->request_body) {
         u->request_bufs = r->request_body->bufs;
     }
@@ -510,8 +572,11 @@ create_request方法没有返回NGX_OK，则upstream机制结束-----luguifang*/
     u->output.pool = r->pool;
     u->output.bufs.num = 1;
     u->output.bufs.size = clcf->client_body_buffer_size;
-    u->output.output_filter = ngx_chain_writer;
-    u->output.filter_ctx = &u->writer;
+
+    if (u->output.output_filter == NULL) {
+        u->output.output_filter = ngx_chain_writer;
+        u->output.filter_ctx = &u->writer;
+    }
 
     u->writer.pool = r->pool;
 
@@ -635,11 +700,30 @@ create_request方法没有返回NGX_OK，则upstream机制结束-----luguifang*/
 
 found:
 
+    /* the waiter is created first, peer.init() saves the peer data in it */
+
+    if (uscf->queue) {
+        u->waiter = ngx_pcalloc(r->pool, sizeof(ngx_http_upstream_waiter_t));
+        if (u->waiter == NULL) {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        u->waiter->conf = uscf->queue;
+        u->waiter->upstream = uscf;
+        u->waiter->event.handler = ngx_http_upstream_queue_handler;
+        u->waiter->event.data = r;
+        u->waiter->event.log = r->connection->log;
+    }
+
     if (uscf->peer.init(r, uscf) != NGX_OK) {
         ngx_http_upstream_finalize_request(r, u,
                                            NGX_HTTP_INTERNAL_SERVER_ERROR);
         return;
     }
+
+    u->peer_copy = (uscf->shm_zone != NULL);
 	/*调用ngx_http_upstream_connect方法向上游服务器发起连接----luguifang*/
     ngx_http_upstream_connect(r, u);
 }
@@ -709,6 +793,9 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
         c->body_start = u->conf->buffer_size;
         c->file_cache = u->conf->cache->data;
 
+        c->lock = u->conf->cache_lock;
+        c->lock_timeout = u->conf->cache_lock_timeout;
+
         u->cache_status = NGX_HTTP_CACHE_MISS;
     }
 
@@ -719,9 +806,41 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     switch (rc) {
 
+    case NGX_HTTP_CACHE_STALE:
+
+        if (((u->conf->cache_use_stale & NGX_HTTP_UPSTREAM_FT_UPDATING)
+             || c->stale_updating)
+            && !r->background
+            && u->conf->cache_background_update)
+        {
+            if (ngx_http_upstream_cache_background_update(r, u) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            /*
+             * the entry is refreshed by the subrequest, which takes over
+             * the updating flag of the node
+             */
+
+            c->updating = 0;
+            u->cache_status = rc;
+            rc = NGX_OK;
+        }
+
+        break;
+
     case NGX_HTTP_CACHE_UPDATING:
 
-        if (u->conf->cache_use_stale & NGX_HTTP_UPSTREAM_FT_UPDATING) {
+        if (r->background) {
+
+            /* the parent request has handed the update over to us */
+
+            c->updating = 1;
+            rc = NGX_HTTP_CACHE_STALE;
+
+        } else if ((u->conf->cache_use_stale & NGX_HTTP_UPSTREAM_FT_UPDATING)
+                   || c->stale_updating)
+        {
             u->cache_status = rc;
             rc = NGX_OK;
 
@@ -750,6 +869,8 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
     case NGX_HTTP_CACHE_STALE:
 
         c->valid_sec = 0;
+        c->updating_sec = 0;
+        c->error_sec = 0;
         u->buffer.start = NULL;
         u->cache_status = NGX_HTTP_CACHE_EXPIRED;
 
@@ -796,6 +917,25 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 }
 
 
+static ngx_int_t
+ngx_http_upstream_cache_background_update(ngx_http_request_t *r,
+    ngx_http_upstream_t *u)
+{
+    ngx_http_request_t  *sr;
+
+    if (ngx_http_subrequest(r, &r->uri, &r->args, &sr, NULL,
+                            NGX_HTTP_SUBREQUEST_BACKGROUND)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    sr->header_only = 1;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_upstream_cache_send(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
@@ -1132,9 +1272,23 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
         return;
     }
 
+    if (rc != NGX_BUSY
+        && u->peer_copy
+        && ngx_http_upstream_copy_peer(r, &u->peer) != NGX_OK)
+    {
+        ngx_http_upstream_finalize_request(r, u,
+                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
     u->state->peer = u->peer.name;
 
     if (rc == NGX_BUSY) {
+
+        if (u->waiter && ngx_http_upstream_queue_add(r, u) == NGX_OK) {
+            return;
+        }
+
         ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "no live upstreams");
         ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_NOLIVE);
         return;
@@ -1145,7 +1299,7 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
         return;
     }
 
-    /* rc == NGX_OK || rc == NGX_AGAIN */
+    /* rc == NGX_OK || rc == NGX_AGAIN || rc == NGX_DONE */
 
     c = u->peer.connection;
 
@@ -1163,8 +1317,20 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
     c->sendfile &= r->connection->sendfile;
     u->output.sendfile = c->sendfile;
 
-    c->pool = r->pool;
+    if (c->pool == NULL) {
+
+        /* the connection may outlive the request in the keepalive cache */
+
+        c->pool = ngx_create_pool(128, r->connection->log);
+        if (c->pool == NULL) {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+    }
+
     c->log = r->connection->log;
+    c->pool->log = c->log;
     c->read->log = c->log;
     c->write->log = c->log;
 
@@ -1303,6 +1469,40 @@ ngx_http_upstream_ssl_handshake(ngx_connection_t *c)
 #endif
 
 
+/*
+ * a server removed from the upstream zone at run time leaves its slot
+ * to the next added one, so the request keeps its own copy of the address
+ * and the name for keepalive, for hedging and for $upstream_addr
+ */
+
+static ngx_int_t
+ngx_http_upstream_copy_peer(ngx_http_request_t *r, ngx_peer_connection_t *pc)
+{
+    u_char     *p;
+    ngx_str_t  *name;
+
+    p = ngx_palloc(r->pool, sizeof(ngx_str_t) + pc->socklen + pc->name->len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    name = (ngx_str_t *) p;
+    p += sizeof(ngx_str_t);
+
+    ngx_memcpy(p, pc->sockaddr, pc->socklen);
+    pc->sockaddr = (struct sockaddr *) p;
+    p += pc->socklen;
+
+    name->len = pc->name->len;
+    name->data = p;
+    ngx_memcpy(p, pc->name->data, name->len);
+
+    pc->name = name;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_upstream_reinit(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
@@ -1314,6 +1514,8 @@ ngx_http_upstream_reinit(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     ngx_memzero(&u->headers_in, sizeof(ngx_http_upstream_headers_in_t));
 
+    u->keepalive = 0;
+
     if (ngx_list_init(&u->headers_in.headers, r->pool, 8,
                       sizeof(ngx_table_elt_t))
         != NGX_OK)
@@ -1328,6 +1530,14 @@ ngx_http_upstream_reinit(ngx_http_request_t *r, ngx_http_upstream_t *u)
         cl->buf->file_pos = 0;
     }
 
+    /* the unbuffered body is sent again from the start of its buffer */
+
+    if (r->request_body_no_buffering) {
+        r->request_body->buf->pos = r->request_body->buf->start;
+        u->request_body_busy = NULL;
+        u->request_body_sent = 0;
+    }
+
     /* reinit the subrequest's ngx_output_chain() context */
 
     if (r->request_body && r->request_body->temp_file
@@ -1391,16 +1601,30 @@ ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
 	
 
-    rc = ngx_output_chain(&u->output, u->request_sent ? NULL : u->request_bufs);
+    if (r->request_body_no_buffering) {
+        rc = ngx_http_upstream_send_request_body(r, u);
+
+    } else {
+        rc = ngx_output_chain(&u->output,
+                              u->request_sent ? NULL : u->request_bufs);
 
 	//置为1 已经发送过请求
-    u->request_sent = 1;
+        u->request_sent = 1;
+    }
 
     if (rc == NGX_ERROR) {
         ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_ERROR);
         return;
     }
 
+    if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+
+        /* reading of the unbuffered client request body has failed */
+
+        ngx_http_upstream_finalize_request(r, u, rc);
+        return;
+    }
+
 	/*检测写事件的timer_set 标志位 如果存在就将该事件从定时器中移除*/
 
     if (c->write->timer_set) {
@@ -1413,7 +1637,15 @@ ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u)
     if (rc == NGX_AGAIN) {
 		/*调用ngx_add_timer方法将写事件添加到定时器中，防止发送请求超时 并调用ngx_handle_write_event方法
 		将写事件添加到事件模型中-------lgf*/
-        ngx_add_timer(c->write, u->conf->send_timeout);
+
+        /*
+         * an unbuffered body may wait for the client while
+         * the upstream connection is writable
+         */
+
+        if (!r->request_body_no_buffering || !c->write->ready) {
+            ngx_add_timer(c->write, u->conf->send_timeout);
+        }
 
         if (ngx_handle_write_event(c->write, u->conf->send_lowat) != NGX_OK) {
             ngx_http_upstream_finalize_request(r, u,
@@ -1443,6 +1675,10 @@ ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u)
 	添加到定时器中检查接收响应是否超时-----------lgf*/
     ngx_add_timer(c->read, u->conf->read_timeout);
 
+    if (u->conf->hedge_stat) {
+        ngx_http_upstream_hedge_init(r, u);
+    }
+
 
 	/*检测读事件的ready标志位，如果ready为1，则表示已经有响应可以读出 ------lgf*/
 
@@ -1476,6 +1712,154 @@ ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u)
 }
 
 
+static ngx_int_t
+ngx_http_upstream_send_request_body(ngx_http_request_t *r,
+    ngx_http_upstream_t *u)
+{
+    ngx_int_t                 rc;
+    ngx_buf_t                *b;
+    ngx_chain_t              *cl;
+    ngx_http_request_body_t  *rb;
+
+    rb = r->request_body;
+
+    if (!u->request_sent) {
+        u->request_sent = 1;
+
+        if (ngx_output_chain(&u->output, u->request_bufs) == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
+    for ( ;; ) {
+
+        if (rb->rest) {
+            rc = ngx_http_read_unbuffered_request_body(r);
+
+            if (rc != NGX_OK && rc != NGX_AGAIN) {
+                return rc;
+            }
+        }
+
+        cl = NULL;
+
+        if (rb->buf->pos != rb->buf->last) {
+
+            /* pass the part of the body that has been read since last time */
+
+            cl = ngx_chain_get_free_buf(r->pool, &u->request_body_free);
+            if (cl == NULL) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            }
+
+            b = cl->buf;
+
+            ngx_memzero(b, sizeof(ngx_buf_t));
+
+            b->start = rb->buf->pos;
+            b->pos = rb->buf->pos;
+            b->last = rb->buf->last;
+            b->end = rb->buf->last;
+            b->temporary = 1;
+            b->last_buf = (rb->rest == 0);
+            b->tag = u->output.tag;
+
+            rb->buf->pos = rb->buf->last;
+        }
+
+        rc = ngx_output_chain(&u->output, cl);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        ngx_chain_update_chains(&u->request_body_free, &u->request_body_busy,
+                                &cl, u->output.tag);
+
+        if (rc == NGX_AGAIN) {
+            return NGX_AGAIN;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http upstream request body rest %O", rb->rest);
+
+        if (rb->rest == 0) {
+            u->request_body_sent = 1;
+
+            if (!u->store && !r->post_action && !u->conf->ignore_client_abort) {
+                r->read_event_handler =
+                                  ngx_http_upstream_rd_check_broken_connection;
+
+            } else {
+                r->read_event_handler = ngx_http_block_reading;
+            }
+
+            return NGX_OK;
+        }
+
+        if (rb->buf->last != rb->buf->end) {
+            return NGX_AGAIN;
+        }
+
+        /*
+         * the whole buffer has been sent, it is reused for the rest of
+         * the body and the request can not be sent to another server anymore
+         */
+
+        rb->buf->pos = rb->buf->start;
+        rb->buf->last = rb->buf->start;
+
+        u->request_body_streamed = 1;
+    }
+}
+
+
+static void
+ngx_http_upstream_read_request_handler(ngx_http_request_t *r)
+{
+    ngx_connection_t         *c;
+    ngx_http_upstream_t      *u;
+    ngx_http_request_body_t  *rb;
+
+    c = r->connection;
+    u = r->upstream;
+    rb = r->request_body;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream read request handler");
+
+    if (c->read->timedout) {
+        c->timedout = 1;
+        ngx_http_upstream_finalize_request(r, u, NGX_HTTP_REQUEST_TIME_OUT);
+        return;
+    }
+
+    /* the body is read while the request is sent to the upstream */
+
+    if (!u->request_sent
+        || u->header_sent
+        || (rb->rest && rb->buf->last == rb->buf->end))
+    {
+        /*
+         * the body is not read now, so a level-triggered read event
+         * is deleted to not be reported again and again; it is added
+         * again when the body is read after the upstream write event
+         */
+
+        if (!u->store && !r->post_action && !u->conf->ignore_client_abort) {
+            ngx_http_upstream_check_broken_connection(r, c->read);
+
+        } else {
+            ngx_http_block_reading(r);
+        }
+
+        return;
+    }
+
+    ngx_http_upstream_send_request(r, u);
+}
+
+
 static void
 ngx_http_upstream_send_request_handler(ngx_http_request_t *r,
     ngx_http_upstream_t *u)
@@ -1616,6 +2000,10 @@ ngx_http_upstream_process_header(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
         u->buffer.last += n;
 
+        if (u->hedge) {
+            ngx_http_upstream_hedge_done(r, u);
+        }
+
 #if 0
         u->valid_header_in = 0;
 
@@ -1751,47 +2139,108 @@ ngx_http_upstream_test_next(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     status = u->headers_in.status_n;
 
-    for (un = ngx_http_upstream_next_errors; un->status; un++) {
-
-        if (status != un->status) {
-            continue;
-        }
-
-        if (u->peer.tries > 1 && (u->conf->next_upstream & un->mask)) {
-            ngx_http_upstream_next(r, u, un->mask);
-            return NGX_OK;
-        }
-
 #if (NGX_HTTP_CACHE)
 
-        if (u->cache_status == NGX_HTTP_CACHE_EXPIRED
-            && (u->conf->cache_use_stale & un->mask))
-        {
-            ngx_int_t  rc;
+    if (status == NGX_HTTP_NOT_MODIFIED
+        && u->cache_status == NGX_HTTP_CACHE_EXPIRED
+        && u->conf->cache_revalidate)
+    {
+        time_t     now, valid;
+        ngx_int_t  rc;
 
-            rc = u->reinit_request(r);
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http upstream not modified");
 
-            if (rc == NGX_OK) {
-                u->cache_status = NGX_HTTP_CACHE_STALE;
-                rc = ngx_http_upstream_cache_send(r, u);
-            }
+        now = ngx_time();
+        valid = r->cache->valid_sec;
 
+        rc = u->reinit_request(r);
+
+        if (rc != NGX_OK) {
             ngx_http_upstream_finalize_request(r, u, rc);
             return NGX_OK;
         }
 
-#endif
-    }
+        u->cache_status = NGX_HTTP_CACHE_REVALIDATED;
+        rc = ngx_http_upstream_cache_send(r, u);
 
-    return NGX_DECLINED;
-}
+        if (rc == NGX_DONE) {
+            return NGX_OK;
+        }
 
+        if (rc == NGX_HTTP_UPSTREAM_INVALID_HEADER) {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return NGX_OK;
+        }
 
-static ngx_int_t
-ngx_http_upstream_intercept_errors(ngx_http_request_t *r,
-    ngx_http_upstream_t *u)
-{
-    ngx_int_t                  status;
+        if (valid == 0) {
+            valid = r->cache->valid_sec;
+        }
+
+        if (valid == 0) {
+            valid = ngx_http_file_cache_valid(u->conf->cache_valid,
+                                              u->headers_in.status_n);
+            if (valid) {
+                valid = now + valid;
+            }
+        }
+
+        if (valid) {
+            r->cache->valid_sec = valid;
+            r->cache->date = now;
+
+            ngx_http_file_cache_update_header(r);
+        }
+
+        ngx_http_upstream_finalize_request(r, u, rc);
+        return NGX_OK;
+    }
+
+#endif
+
+    for (un = ngx_http_upstream_next_errors; un->status; un++) {
+
+        if (status != un->status) {
+            continue;
+        }
+
+        if (u->peer.tries > 1 && (u->conf->next_upstream & un->mask)) {
+            ngx_http_upstream_next(r, u, un->mask);
+            return NGX_OK;
+        }
+
+#if (NGX_HTTP_CACHE)
+
+        if (u->cache_status == NGX_HTTP_CACHE_EXPIRED
+            && ((u->conf->cache_use_stale & un->mask)
+                || r->cache->stale_error))
+        {
+            ngx_int_t  rc;
+
+            rc = u->reinit_request(r);
+
+            if (rc == NGX_OK) {
+                u->cache_status = NGX_HTTP_CACHE_STALE;
+                rc = ngx_http_upstream_cache_send(r, u);
+            }
+
+            ngx_http_upstream_finalize_request(r, u, rc);
+            return NGX_OK;
+        }
+
+#endif
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_intercept_errors(ngx_http_request_t *r,
+    ngx_http_upstream_t *u)
+{
+    ngx_int_t                  status;
     ngx_uint_t                 i;
     ngx_table_elt_t           *h;
     ngx_http_err_page_t       *err_page;
@@ -2024,12 +2473,7 @@ ngx_http_upstream_process_headers(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     u->headers_in.content_length_n = r->headers_out.content_length_n;
 
-    if (r->headers_out.content_length_n != -1) {
-        u->length = (size_t) r->headers_out.content_length_n;
-
-    } else {
-        u->length = NGX_MAX_SIZE_T_VALUE;
-    }
+    u->length = r->headers_out.content_length_n;
 
     return NGX_OK;
 }
@@ -2101,6 +2545,11 @@ ngx_http_upstream_process_body_in_memory(ngx_http_request_t *r,
         }
     }
 
+    if (u->length == 0) {
+        ngx_http_upstream_finalize_request(r, u, 0);
+        return;
+    }
+
 	/*调用ngx_handle_read_event方法将读事件添加到epoll中*/
     if (ngx_handle_read_event(rev, 0) != NGX_OK) {
         ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
@@ -2151,7 +2600,16 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     if (r->header_only) {
 
-        if (u->cacheable || u->store) {
+        if (r->background) {
+
+            /* the response is only stored to the cache */
+
+            if (!u->buffering || !u->cacheable) {
+                ngx_http_upstream_finalize_request(r, u, rc);
+                return;
+            }
+
+        } else if (u->cacheable || u->store) {
 
             if (ngx_shutdown_socket(c->fd, NGX_WRITE_SHUTDOWN) == -1) {
                 ngx_connection_error(c, ngx_socket_errno,
@@ -2272,7 +2730,7 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
 			/*如果与上游服务器的连接上有可读事件，则调用
 			ngx_http_upstream_process_non_buffered_upstream方法处理响应；否则，当前流程结束，将控
 			制权交还给Nginx框架*/
-            if (u->peer.connection->read->ready) {
+            if (u->peer.connection->read->ready || u->length == 0) {
                 ngx_http_upstream_process_non_buffered_upstream(r, u);
             }
         }
@@ -2334,6 +2792,13 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
         if (valid) {
             r->cache->last_modified = r->headers_out.last_modified_time;
             r->cache->date = now;
+
+            if (u->headers_in.etag) {
+                r->cache->etag = u->headers_in.etag->value;
+
+            } else {
+                ngx_str_null(&r->cache->etag);
+            }
             r->cache->body_start = (u_short) (u->buffer.pos - u->buffer.start);
 
             ngx_http_file_cache_set_header(r, u->buffer.start);
@@ -2452,6 +2917,19 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
     p->send_timeout = clcf->send_timeout;
     p->send_lowat = clcf->send_lowat;
 
+    p->length = -1;
+
+    if (r->background) {
+        p->downstream_error = 1;
+    }
+
+    if (u->input_filter_init
+        && u->input_filter_init(p->input_ctx) != NGX_OK)
+    {
+        ngx_http_upstream_finalize_request(r, u, 0);
+        return;
+    }
+
 	/*设置处理上游读事件回调方法为ngx_http_upstream_process_upstream*/
     u->read_event_handler = ngx_http_upstream_process_upstream;
 	/*设置处理下游写事件的回调方法为ngx_http_upstream_process_downstream*/
@@ -2576,8 +3054,8 @@ ngx_http_upstream_process_non_buffered_request(ngx_http_request_t *r,
 		/*获取buffer缓冲区中还有多少剩余空间*/
         size = b->end - b->last;
 
-        if (size > u->length) {
-            size = u->length;
+        if (u->length != -1 && size > (size_t) u->length) {
+            size = (size_t) u->length;
         }
 
         if (size && upstream->read->ready) {
@@ -2690,7 +3168,7 @@ ngx_http_upstream_non_buffered_filter(void *data, ssize_t bytes)
     cl->buf->last = b->last;
     cl->buf->tag = u->output.tag;
 
-    if (u->length == NGX_MAX_SIZE_T_VALUE) {
+    if (u->length == -1) {
         return NGX_OK;
     }
 
@@ -2902,55 +3380,612 @@ ngx_http_upstream_store(ngx_http_request_t *r, ngx_http_upstream_t *u)
             return;
         }
 
-        u->pipe->temp_file = tf;
+        u->pipe->temp_file = tf;
+    }
+
+    ext.access = u->conf->store_access;
+    ext.path_access = u->conf->store_access;
+    ext.time = -1;
+    ext.create_path = 1;
+    ext.delete_file = 1;
+    ext.log = r->connection->log;
+
+    if (u->headers_in.last_modified) {
+
+        lm = ngx_http_parse_time(u->headers_in.last_modified->value.data,
+                                 u->headers_in.last_modified->value.len);
+
+        if (lm != NGX_ERROR) {
+            ext.time = lm;
+            ext.fd = tf->file.fd;
+        }
+    }
+
+    if (u->conf->store_lengths == NULL) {
+
+        ngx_http_map_uri_to_path(r, &path, &root, 0);
+
+    } else {
+        if (ngx_http_script_run(r, &path, u->conf->store_lengths->elts, 0,
+                                u->conf->store_values->elts)
+            == NULL)
+        {
+            return;
+        }
+    }
+
+    path.len--;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "upstream stores \"%s\" to \"%s\"",
+                   tf->file.name.data, path.data);
+
+    (void) ngx_ext_rename_file(&tf->file.name, &path, &ext);
+}
+
+
+static void
+ngx_http_upstream_dummy_handler(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream dummy handler");
+}
+
+
+static void
+ngx_http_upstream_hedge_init(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_msec_t                       delay;
+    ngx_http_upstream_hedge_t       *hedge;
+    ngx_http_upstream_hedge_stat_t  *stat;
+
+    stat = u->conf->hedge_stat;
+
+    if (stat == NULL
+        || !(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))
+        || r->request_body_no_buffering
+        || u->peer.tries < 2)
+    {
+        return;
+    }
+
+    hedge = u->hedge;
+
+    if (hedge == NULL) {
+        hedge = ngx_pcalloc(r->pool, sizeof(ngx_http_upstream_hedge_t));
+        if (hedge == NULL) {
+            return;
+        }
+
+        hedge->event.handler = ngx_http_upstream_hedge_handler;
+        hedge->event.data = r;
+        hedge->event.log = r->connection->log;
+
+        u->hedge = hedge;
+
+    } else if (hedge->fired) {
+        return;
+    }
+
+    hedge->start = ngx_current_msec;
+
+    delay = u->conf->hedge_delay ? u->conf->hedge_delay : stat->delay;
+
+    if (delay == 0) {
+        return;
+    }
+
+    if (++stat->requests == 1000) {
+        stat->requests /= 2;
+        stat->hedged /= 2;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream hedge delay: %M", delay);
+
+    ngx_add_timer(&hedge->event, delay);
+}
+
+
+static void
+ngx_http_upstream_hedge_handler(ngx_event_t *ev)
+{
+    ngx_connection_t                *c, *pc;
+    ngx_http_request_t              *r;
+    ngx_http_log_ctx_t              *ctx;
+    ngx_http_upstream_t             *u;
+    ngx_http_upstream_hedge_t       *hedge;
+    ngx_http_upstream_hedge_stat_t  *stat;
+
+    r = ev->data;
+    u = r->upstream;
+    c = r->connection;
+
+    ctx = c->log->data;
+    ctx->current_request = r;
+
+    hedge = u->hedge;
+    stat = u->conf->hedge_stat;
+    pc = u->peer.connection;
+
+    if (pc == NULL
+        || u->peer.tries < 2
+        || stat->hedged * 100 >= stat->requests * u->conf->hedge_budget)
+    {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http upstream hedge skipped");
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream hedge, waiting fd: %d", pc->fd);
+
+    stat->hedged++;
+    hedge->fired = 1;
+
+    /* keep the original connection aside until the first response */
+
+    hedge->connection = pc;
+    hedge->name = u->peer.name;
+    hedge->state = u->state - (ngx_http_upstream_state_t *)
+                                                    r->upstream_states->elts;
+    hedge->response_sec = u->state->response_sec;
+    hedge->response_msec = u->state->response_msec;
+
+    pc->read->handler = ngx_http_upstream_hedge_read_handler;
+    pc->write->handler = ngx_http_upstream_hedge_read_handler;
+
+    /*
+     * the peer is released now, so a balancer tracking a single current
+     * peer does not count it twice and peer.get() picks another one
+     */
+
+    u->peer.free(&u->peer, u->peer.data, 0);
+    u->peer.sockaddr = NULL;
+    u->peer.connection = NULL;
+
+    ngx_http_upstream_connect(r, u);
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+static void
+ngx_http_upstream_hedge_read_handler(ngx_event_t *ev)
+{
+    int                   n;
+    char                  buf[1];
+    ngx_err_t             err;
+    ngx_connection_t     *c, *pc;
+    ngx_http_request_t   *r;
+    ngx_http_log_ctx_t   *ctx;
+    ngx_http_upstream_t  *u;
+
+    if (ev->write) {
+        return;
+    }
+
+    pc = ev->data;
+    r = pc->data;
+    u = r->upstream;
+    c = r->connection;
+
+    ctx = c->log->data;
+    ctx->current_request = r;
+
+    if (ev->timedout) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, NGX_ETIMEDOUT,
+                       "http upstream hedge original timed out");
+
+        ngx_http_upstream_hedge_close(r, u);
+        return;
+    }
+
+    n = recv(pc->fd, buf, 1, MSG_PEEK);
+
+    err = ngx_socket_errno;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, err,
+                   "http upstream hedge recv(): %d", n);
+
+    if (n == -1 && err == NGX_EAGAIN) {
+
+        if (ngx_handle_read_event(ev, 0) != NGX_OK) {
+            ngx_http_upstream_hedge_close(r, u);
+        }
+
+        return;
+    }
+
+    if (n <= 0) {
+        ngx_http_upstream_hedge_close(r, u);
+        return;
+    }
+
+    /* the original upstream has answered first */
+
+    ngx_http_upstream_hedge_restore(r, u, 0);
+
+    ngx_http_upstream_process_header(r, u);
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+static void
+ngx_http_upstream_hedge_restore(ngx_http_request_t *r, ngx_http_upstream_t *u,
+    ngx_uint_t state)
+{
+    ngx_time_t                 *tp;
+    ngx_connection_t           *pc;
+    ngx_http_upstream_hedge_t  *hedge;
+
+    hedge = u->hedge;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream hedge restore fd: %d",
+                   hedge->connection->fd);
+
+    if (u->peer.sockaddr) {
+        u->peer.free(&u->peer, u->peer.data, state);
+        u->peer.sockaddr = NULL;
+
+        if (u->waiter) {
+            ngx_http_upstream_queue_wake(u->waiter->conf);
+        }
+    }
+
+    if (u->peer.connection) {
+        ngx_http_upstream_hedge_close_connection(u->peer.connection);
+    }
+
+    if (u->state->response_sec) {
+        tp = ngx_timeofday();
+        u->state->response_sec = tp->sec - u->state->response_sec;
+        u->state->response_msec = tp->msec - u->state->response_msec;
+    }
+
+    u->state = (ngx_http_upstream_state_t *) r->upstream_states->elts
+               + hedge->state;
+    u->state->response_sec = hedge->response_sec;
+    u->state->response_msec = hedge->response_msec;
+
+    pc = hedge->connection;
+    hedge->connection = NULL;
+
+    pc->read->handler = ngx_http_upstream_handler;
+    pc->write->handler = ngx_http_upstream_handler;
+
+    /* the peer of the original connection was already released */
+
+    u->peer.connection = pc;
+    u->peer.name = hedge->name;
+    u->peer.cached = 0;
+
+    u->writer.connection = pc;
+    u->request_sent = 1;
+
+    u->write_event_handler = ngx_http_upstream_dummy_handler;
+    u->read_event_handler = ngx_http_upstream_process_header;
+}
+
+
+static void
+ngx_http_upstream_hedge_done(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_msec_t                       ms;
+    ngx_uint_t                       n;
+    ngx_http_upstream_hedge_t       *hedge;
+    ngx_http_upstream_hedge_stat_t  *stat;
+    ngx_msec_t                       samples[NGX_HTTP_UPSTREAM_HEDGE_SAMPLES];
+
+    hedge = u->hedge;
+
+    if (hedge->event.timer_set) {
+        ngx_del_timer(&hedge->event);
+    }
+
+    ngx_http_upstream_hedge_close(r, u);
+
+    if (hedge->start == 0) {
+        return;
+    }
+
+    ms = ngx_current_msec - hedge->start;
+    hedge->start = 0;
+
+    if (u->conf->hedge_percentile == 0) {
+        return;
+    }
+
+    stat = u->conf->hedge_stat;
+
+    n = stat->nsamples++ % NGX_HTTP_UPSTREAM_HEDGE_SAMPLES;
+    stat->samples[n] = ms;
+
+    if (n != NGX_HTTP_UPSTREAM_HEDGE_SAMPLES - 1) {
+        return;
+    }
+
+    /* recalculate the delay every time the window is filled up */
+
+    ngx_memcpy(samples, stat->samples, sizeof(samples));
+
+    ngx_sort(samples, NGX_HTTP_UPSTREAM_HEDGE_SAMPLES, sizeof(ngx_msec_t),
+             ngx_http_upstream_hedge_cmp);
+
+    n = NGX_HTTP_UPSTREAM_HEDGE_SAMPLES * u->conf->hedge_percentile / 100;
+
+    stat->delay = ngx_max(samples[n], 1);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream hedge p%ui delay: %M",
+                   u->conf->hedge_percentile, stat->delay);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hedge_cmp(const void *one, const void *two)
+{
+    ngx_msec_t  first, second;
+
+    first = *(ngx_msec_t *) one;
+    second = *(ngx_msec_t *) two;
+
+    if (first == second) {
+        return 0;
+    }
+
+    return (first < second) ? -1 : 1;
+}
+
+
+static void
+ngx_http_upstream_hedge_close(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_http_upstream_hedge_t  *hedge;
+
+    hedge = u->hedge;
+
+    if (hedge->connection == NULL) {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "close hedged http upstream connection: %d",
+                   hedge->connection->fd);
+
+    ngx_http_upstream_hedge_close_connection(hedge->connection);
+
+    hedge->connection = NULL;
+}
+
+
+static void
+ngx_http_upstream_hedge_close_connection(ngx_connection_t *c)
+{
+#if (NGX_HTTP_SSL)
+
+    if (c->ssl) {
+        c->ssl->no_wait_shutdown = 1;
+        c->ssl->no_send_shutdown = 1;
+
+        (void) ngx_ssl_shutdown(c);
+    }
+#endif
+
+    if (c->pool) {
+        ngx_destroy_pool(c->pool);
+    }
+
+    ngx_close_connection(c);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_queue_add(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_time_t                  *tp;
+    ngx_msec_int_t               timer;
+    ngx_http_upstream_queue_t   *q;
+    ngx_http_upstream_waiter_t  *w;
+
+    /* only a request that has not been sent to any server waits */
+
+    if (u->request_sent) {
+        return NGX_DECLINED;
+    }
+
+    w = u->waiter;
+    q = w->conf;
+
+    if (!w->queued) {
+
+        if (q->number == q->max) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "upstream queue is full");
+            return NGX_DECLINED;
+        }
+
+        w->deadline = ngx_current_msec + q->timeout;
+        w->queued = 1;
+
+        ngx_queue_insert_tail(&q->waiting, &w->queue);
+
+    } else {
+
+        timer = (ngx_msec_int_t) (w->deadline - ngx_current_msec);
+
+        if (timer <= 0) {
+            return NGX_DECLINED;
+        }
+
+        /* the whole wait is accounted in the state of the previous try */
+
+        tp = ngx_timeofday();
+
+        r->upstream_states->nelts--;
+
+        u->state = (ngx_http_upstream_state_t *) r->upstream_states->elts
+                   + r->upstream_states->nelts - 1;
+        u->state->response_sec = tp->sec - u->state->response_sec;
+        u->state->response_msec = tp->msec - u->state->response_msec;
+
+        /* a woken request that has not got a server keeps its place */
+
+        ngx_queue_insert_head(&q->waiting, &w->queue);
+    }
+
+    q->number++;
+    w->waiting = 1;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream queue: %ui", q->number);
+
+    ngx_add_timer(&w->event, w->deadline - ngx_current_msec);
+
+    /*
+     * the connections released by other worker processes are not
+     * signaled, so the first waiting request is retried periodically
+     */
+
+    if (!q->event.timer_set) {
+        ngx_add_timer(&q->event, NGX_HTTP_UPSTREAM_QUEUE_POLL);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_queue_handler(ngx_event_t *ev)
+{
+    ngx_connection_t     *c;
+    ngx_http_request_t   *r;
+    ngx_http_log_ctx_t   *ctx;
+    ngx_http_upstream_t  *u;
+
+    r = ev->data;
+    u = r->upstream;
+    c = r->connection;
+
+    ctx = c->log->data;
+    ctx->current_request = r;
+
+    if (ev->timedout) {
+        ev->timedout = 0;
+
+        ngx_http_upstream_queue_remove(u);
+
+        ngx_log_error(NGX_LOG_ERR, c->log, 0, "upstream queue timed out");
+
+        ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_NOLIVE);
+
+    } else {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http upstream queue wake up");
+
+        /* the servers that were busy are tried again */
+
+        if (u->waiter->data) {
+            ngx_http_upstream_reset_round_robin_peer(&u->peer,
+                                                     u->waiter->upstream,
+                                                     u->waiter->data);
+            ngx_http_upstream_connect(r, u);
+
+        } else if (u->waiter->upstream->peer.init(r, u->waiter->upstream)
+                   != NGX_OK)
+        {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+        } else {
+            ngx_http_upstream_connect(r, u);
+        }
+    }
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+static void
+ngx_http_upstream_queue_poll_handler(ngx_event_t *ev)
+{
+    ngx_http_upstream_queue_t  *q;
+
+    q = ev->data;
+
+    ngx_http_upstream_queue_wake(q);
+
+    if (!ngx_queue_empty(&q->waiting)) {
+        ngx_add_timer(ev, NGX_HTTP_UPSTREAM_QUEUE_POLL);
+    }
+}
+
+
+static void
+ngx_http_upstream_queue_wake(ngx_http_upstream_queue_t *q)
+{
+    ngx_event_t                 *ev;
+    ngx_queue_t                 *head;
+    ngx_http_upstream_waiter_t  *w;
+
+    if (ngx_queue_empty(&q->waiting)) {
+        return;
     }
 
-    ext.access = u->conf->store_access;
-    ext.path_access = u->conf->store_access;
-    ext.time = -1;
-    ext.create_path = 1;
-    ext.delete_file = 1;
-    ext.log = r->connection->log;
+    head = ngx_queue_head(&q->waiting);
+    w = ngx_queue_data(head, ngx_http_upstream_waiter_t, queue);
 
-    if (u->headers_in.last_modified) {
+    ngx_http_upstream_queue_remove_waiter(w);
 
-        lm = ngx_http_parse_time(u->headers_in.last_modified->value.data,
-                                 u->headers_in.last_modified->value.len);
+    /* the request is resumed after the current event is handled */
 
-        if (lm != NGX_ERROR) {
-            ext.time = lm;
-            ext.fd = tf->file.fd;
-        }
-    }
+    ev = &w->event;
 
-    if (u->conf->store_lengths == NULL) {
+    ngx_post_event(ev, &ngx_posted_events);
+}
 
-        ngx_http_map_uri_to_path(r, &path, &root, 0);
 
-    } else {
-        if (ngx_http_script_run(r, &path, u->conf->store_lengths->elts, 0,
-                                u->conf->store_values->elts)
-            == NULL)
-        {
-            return;
-        }
-    }
+static void
+ngx_http_upstream_queue_remove(ngx_http_upstream_t *u)
+{
+    ngx_event_t                 *ev;
+    ngx_http_upstream_waiter_t  *w;
 
-    path.len--;
+    w = u->waiter;
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "upstream stores \"%s\" to \"%s\"",
-                   tf->file.name.data, path.data);
+    ngx_http_upstream_queue_remove_waiter(w);
 
-    (void) ngx_ext_rename_file(&tf->file.name, &path, &ext);
+    ev = &w->event;
+
+    if (ev->prev) {
+        ngx_delete_posted_event(ev);
+    }
 }
 
 
 static void
-ngx_http_upstream_dummy_handler(ngx_http_request_t *r, ngx_http_upstream_t *u)
+ngx_http_upstream_queue_remove_waiter(ngx_http_upstream_waiter_t *w)
 {
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http upstream dummy handler");
+    ngx_http_upstream_queue_t  *q;
+
+    if (w->event.timer_set) {
+        ngx_del_timer(&w->event);
+    }
+
+    if (!w->waiting) {
+        return;
+    }
+
+    q = w->conf;
+
+    ngx_queue_remove(&w->queue);
+    q->number--;
+    w->waiting = 0;
+
+    if (ngx_queue_empty(&q->waiting) && q->event.timer_set) {
+        ngx_del_timer(&q->event);
+    }
 }
 
 
@@ -2973,8 +4008,33 @@ ngx_http_upstream_next(ngx_http_request_t *r, ngx_http_upstream_t *u,
         state = NGX_PEER_FAILED;
     }
 
-    if (ft_type != NGX_HTTP_UPSTREAM_FT_NOLIVE) {
+    if (u->hedge) {
+
+        if (u->hedge->event.timer_set) {
+            ngx_del_timer(&u->hedge->event);
+        }
+
+        if (u->hedge->connection) {
+
+            /* the hedged request has failed, wait for the original one */
+
+            ngx_http_upstream_hedge_restore(r, u, state);
+
+            if (u->peer.connection->read->ready) {
+                ngx_http_upstream_process_header(r, u);
+            }
+
+            return;
+        }
+    }
+
+    if (ft_type != NGX_HTTP_UPSTREAM_FT_NOLIVE && u->peer.sockaddr) {
         u->peer.free(&u->peer, u->peer.data, state);
+        u->peer.sockaddr = NULL;
+
+        if (u->waiter) {
+            ngx_http_upstream_queue_wake(u->waiter->conf);
+        }
     }
 
     if (ft_type == NGX_HTTP_UPSTREAM_FT_TIMEOUT) {
@@ -2982,9 +4042,15 @@ ngx_http_upstream_next(ngx_http_request_t *r, ngx_http_upstream_t *u,
                       "upstream timed out");
     }
 
-    if (u->peer.cached && ft_type == NGX_HTTP_UPSTREAM_FT_ERROR) {
+    if (u->peer.cached && ft_type == NGX_HTTP_UPSTREAM_FT_ERROR
+        && !u->request_body_streamed)
+    {
         status = 0;
 
+        /* a cached connection closed by upstream does not use up a try */
+
+        u->peer.tries++;
+
     } else {
         switch(ft_type) {
 
@@ -3019,12 +4085,16 @@ ngx_http_upstream_next(ngx_http_request_t *r, ngx_http_upstream_t *u,
     if (status) {
         u->state->status = status;
 
-        if (u->peer.tries == 0 || !(u->conf->next_upstream & ft_type)) {
+        if (u->peer.tries == 0
+            || !(u->conf->next_upstream & ft_type)
+            || u->request_body_streamed)
+        {
 
 #if (NGX_HTTP_CACHE)
 
             if (u->cache_status == NGX_HTTP_CACHE_EXPIRED
-                && (u->conf->cache_use_stale & ft_type))
+                && ((u->conf->cache_use_stale & ft_type)
+                    || r->cache->stale_error))
             {
                 ngx_int_t  rc;
 
@@ -3059,6 +4129,10 @@ ngx_http_upstream_next(ngx_http_request_t *r, ngx_http_upstream_t *u,
         }
 #endif
 
+        if (u->peer.connection->pool) {
+            ngx_destroy_pool(u->peer.connection->pool);
+        }
+
         ngx_close_connection(u->peer.connection);
         u->peer.connection = NULL;
     }
@@ -3129,8 +4203,41 @@ ngx_http_upstream_finalize_request(ngx_http_request_t *r,
 	/*表示调用HTTP模块负责实现的finalize_request方法。HTTP模块可能会在upstream请求结束时执行一些操作*/
     u->finalize_request(r, rc);
 
-    if (u->peer.free) {
+    if (u->hedge) {
+
+        if (u->hedge->event.timer_set) {
+            ngx_del_timer(&u->hedge->event);
+        }
+
+        ngx_http_upstream_hedge_close(r, u);
+    }
+
+    if (u->waiter) {
+        ngx_http_upstream_queue_remove(u);
+    }
+
+    if (r->request_body_no_buffering) {
+
+        if (!u->request_body_sent) {
+            u->keepalive = 0;
+        }
+
+        if (r->request_body->rest) {
+
+            /* the rest of the body must not be taken for the next request */
+
+            r->keepalive = 0;
+            r->lingering_close = 1;
+        }
+    }
+
+    if (u->peer.free && u->peer.sockaddr) {
         u->peer.free(&u->peer, u->peer.data, 0);
+        u->peer.sockaddr = NULL;
+
+        if (u->waiter) {
+            ngx_http_upstream_queue_wake(u->waiter->conf);
+        }
     }
 
 	/*如果与上游间的TCP连接还存在，则关闭这个TCP连接*/
@@ -3158,6 +4265,10 @@ ngx_http_upstream_finalize_request(ngx_http_request_t *r,
                        "close http upstream connection: %d",
                        u->peer.connection->fd);
 
+        if (u->peer.connection->pool) {
+            ngx_destroy_pool(u->peer.connection->pool);
+        }
+
         ngx_close_connection(u->peer.connection);
     }
 
@@ -3301,7 +4412,7 @@ ngx_http_upstream_process_cache_control(ngx_http_request_t *r,
 
 #if (NGX_HTTP_CACHE)
     {
-    u_char     *p, *last;
+    u_char     *p, *q, *last;
     ngx_int_t   n;
 
     if (u->conf->ignore_headers & NGX_HTTP_UPSTREAM_IGN_CACHE_CONTROL) {
@@ -3312,12 +4423,44 @@ ngx_http_upstream_process_cache_control(ngx_http_request_t *r,
         return NGX_OK;
     }
 
+    p = h->value.data;
+    last = p + h->value.len;
+
+    p = ngx_strlcasestrn(p, last, (u_char *) "stale-while-revalidate=",
+                         23 - 1);
+
+    if (p) {
+        for (q = p + 23; q < last && *q >= '0' && *q <= '9'; q++) {
+            /* void */
+        }
+
+        n = ngx_atoi(p + 23, q - p - 23);
+
+        if (n != NGX_ERROR) {
+            r->cache->updating_sec = n;
+        }
+    }
+
+    p = ngx_strlcasestrn(h->value.data, last, (u_char *) "stale-if-error=",
+                         15 - 1);
+
+    if (p) {
+        for (q = p + 15; q < last && *q >= '0' && *q <= '9'; q++) {
+            /* void */
+        }
+
+        n = ngx_atoi(p + 15, q - p - 15);
+
+        if (n != NGX_ERROR) {
+            r->cache->error_sec = n;
+        }
+    }
+
     if (r->cache->valid_sec != 0) {
         return NGX_OK;
     }
 
     p = h->value.data;
-    last = p + h->value.len;
 
     if (ngx_strlcasestrn(p, last, (u_char *) "no-cache", 8 - 1) != NULL
         || ngx_strlcasestrn(p, last, (u_char *) "no-store", 8 - 1) != NULL
@@ -3534,6 +4677,40 @@ ngx_http_upstream_process_charset(ngx_http_request_t *r, ngx_table_elt_t *h,
 }
 
 
+static ngx_int_t
+ngx_http_upstream_process_connection(ngx_http_request_t *r, ngx_table_elt_t *h,
+    ngx_uint_t offset)
+{
+    r->upstream->headers_in.connection = h;
+
+    if (ngx_strlcasestrn(h->value.data, h->value.data + h->value.len,
+                         (u_char *) "close", 5 - 1)
+        != NULL)
+    {
+        r->upstream->headers_in.connection_close = 1;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_process_transfer_encoding(ngx_http_request_t *r,
+    ngx_table_elt_t *h, ngx_uint_t offset)
+{
+    r->upstream->headers_in.transfer_encoding = h;
+
+    if (ngx_strlcasestrn(h->value.data, h->value.data + h->value.len,
+                         (u_char *) "chunked", 7 - 1)
+        != NULL)
+    {
+        r->upstream->headers_in.chunked = 1;
+    }
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_upstream_copy_header_line(ngx_http_request_t *r, ngx_table_elt_t *h,
     ngx_uint_t offset)
@@ -3647,6 +4824,10 @@ ngx_http_upstream_copy_content_length(ngx_http_request_t *r, ngx_table_elt_t *h,
 {
     ngx_table_elt_t  *ho;
 
+    if (r->upstream->headers_in.chunked) {
+        return NGX_OK;
+    }
+
     ho = ngx_list_push(&r->headers_out.headers);
     if (ho == NULL) {
         return NGX_ERROR;
@@ -4154,6 +5335,59 @@ ngx_http_upstream_cache_status(ngx_http_request_t *r,
     return NGX_OK;
 }
 
+
+static ngx_int_t
+ngx_http_upstream_cache_last_modified(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char  *p;
+
+    if (r->upstream == NULL
+        || !r->upstream->conf->cache_revalidate
+        || r->upstream->cache_status != NGX_HTTP_CACHE_EXPIRED
+        || r->cache->last_modified == -1)
+    {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(r->pool, sizeof("Mon, 28 Sep 1970 06:00:00 GMT") - 1);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_http_time(p, r->cache->last_modified) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_cache_etag(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    if (r->upstream == NULL
+        || !r->upstream->conf->cache_revalidate
+        || r->upstream->cache_status != NGX_HTTP_CACHE_EXPIRED
+        || r->cache->etag.len == 0)
+    {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->len = r->cache->etag.len;
+    v->data = r->cache->etag.data;
+
+    return NGX_OK;
+}
+
 #endif
 
 
@@ -4180,6 +5414,7 @@ ngx_http_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
                                          |NGX_HTTP_UPSTREAM_WEIGHT
                                          |NGX_HTTP_UPSTREAM_MAX_FAILS
                                          |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                                         |NGX_HTTP_UPSTREAM_MAX_CONNS
                                          |NGX_HTTP_UPSTREAM_DOWN
                                          |NGX_HTTP_UPSTREAM_BACKUP);
     if (uscf == NULL) {
@@ -4273,7 +5508,7 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     time_t                       fail_timeout;
     ngx_str_t                   *value, s;
     ngx_url_t                    u;
-    ngx_int_t                    weight, max_fails;
+    ngx_int_t                    weight, max_fails, max_conns;
     ngx_uint_t                   i;
     ngx_http_upstream_server_t  *us;
 
@@ -4310,6 +5545,7 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     weight = 1;
     max_fails = 1;
+    max_conns = 0;
     fail_timeout = 10;
 
     for (i = 2; i < cf->args->nelts; i++) {
@@ -4344,6 +5580,21 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "max_conns=", 10) == 0) {
+
+            if (!(uscf->flags & NGX_HTTP_UPSTREAM_MAX_CONNS)) {
+                goto invalid;
+            }
+
+            max_conns = ngx_atoi(&value[i].data[10], value[i].len - 10);
+
+            if (max_conns == NGX_ERROR) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "fail_timeout=", 13) == 0) {
 
             if (!(uscf->flags & NGX_HTTP_UPSTREAM_FAIL_TIMEOUT)) {
@@ -4392,6 +5643,7 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     us->weight = weight;
     us->max_fails = max_fails;
     us->fail_timeout = fail_timeout;
+    us->max_conns = max_conns;
 
     return NGX_CONF_OK;
 
@@ -4404,6 +5656,75 @@ invalid:
 }
 
 
+static char *
+ngx_http_upstream_queue(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_srv_conf_t  *uscf = conf;
+
+    ngx_int_t                   n;
+    ngx_str_t                  *value, s;
+    ngx_msec_t                  timeout;
+    ngx_http_upstream_queue_t  *q;
+
+    if (uscf->queue) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid queue size \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    timeout = 60000;
+
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "timeout=", 8) != 0) {
+            goto invalid;
+        }
+
+        s.len = value[2].len - 8;
+        s.data = &value[2].data[8];
+
+        timeout = ngx_parse_time(&s, 0);
+
+        if (timeout == (ngx_msec_t) NGX_ERROR) {
+            goto invalid;
+        }
+    }
+
+    q = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_queue_t));
+    if (q == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    q->max = n;
+    q->timeout = timeout;
+
+    ngx_queue_init(&q->waiting);
+
+    q->event.handler = ngx_http_upstream_queue_poll_handler;
+    q->event.data = q;
+    q->event.log = &cf->cycle->new_log;
+
+    uscf->queue = q;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[2]);
+
+    return NGX_CONF_ERROR;
+}
+
+
 ngx_http_upstream_srv_conf_t *
 ngx_http_upstream_add(ngx_conf_t *cf, ngx_url_t *u, ngx_uint_t flags)
 {
@@ -4553,6 +5874,61 @@ ngx_http_upstream_bind_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
 }
 
 
+char *
+ngx_http_upstream_hedge_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    char  *p = conf;
+
+    ngx_int_t                  n;
+    ngx_msec_t                 ms;
+    ngx_str_t                 *value;
+    ngx_http_upstream_conf_t  *ucf;
+
+    ucf = (ngx_http_upstream_conf_t *) (p + cmd->offset);
+
+    if (ucf->hedge_percentile != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        ucf->hedge_delay = 0;
+        ucf->hedge_percentile = 0;
+        return NGX_CONF_OK;
+    }
+
+    if (value[1].data[0] == 'p') {
+        n = ngx_atoi(value[1].data + 1, value[1].len - 1);
+        if (n < 1 || n > 99) {
+            goto invalid;
+        }
+
+        ucf->hedge_delay = 0;
+        ucf->hedge_percentile = n;
+        return NGX_CONF_OK;
+    }
+
+    ms = ngx_parse_time(&value[1], 0);
+    if (ms == (ngx_msec_t) NGX_ERROR || ms == 0) {
+        goto invalid;
+    }
+
+    ucf->hedge_delay = ms;
+    ucf->hedge_percentile = 0;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid value \"%V\"", &value[1]);
+
+    return NGX_CONF_ERROR;
+}
+
+
 ngx_int_t
 ngx_http_upstream_hide_headers_hash(ngx_conf_t *cf,
     ngx_http_upstream_conf_t *conf, ngx_http_upstream_conf_t *prev,
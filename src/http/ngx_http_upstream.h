@@ -50,6 +50,11 @@
 #define NGX_HTTP_UPSTREAM_IGN_XA_CHARSET     0x00000100
 
 
+#define NGX_HTTP_UPSTREAM_HEDGE_SAMPLES      64
+
+#define NGX_HTTP_UPSTREAM_QUEUE_POLL         100
+
+
 typedef struct {
     ngx_msec_t                       bl_time;
     ngx_uint_t                       bl_state;
@@ -90,18 +95,54 @@ typedef struct {
     ngx_uint_t                       weight;
     ngx_uint_t                       max_fails;
     time_t                           fail_timeout;
+    ngx_uint_t                       max_conns;
 
     unsigned                         down:1;
     unsigned                         backup:1;
 } ngx_http_upstream_server_t;
 
 
+typedef struct {
+    ngx_uint_t                       max;
+    ngx_uint_t                       number;
+    ngx_msec_t                       timeout;
+
+    ngx_queue_t                      waiting;
+    ngx_event_t                      event;
+} ngx_http_upstream_queue_t;
+
+
+typedef struct {
+    ngx_http_upstream_queue_t       *conf;
+    ngx_http_upstream_srv_conf_t    *upstream;
+    void                            *data;
+                                        /* ngx_http_upstream_rr_peer_data_t */
+    ngx_queue_t                      queue;
+    ngx_event_t                      event;
+    ngx_msec_t                       deadline;
+
+    unsigned                         waiting:1;
+    unsigned                         queued:1;
+} ngx_http_upstream_waiter_t;
+
+
+typedef struct {
+    ngx_uint_t                       requests;
+    ngx_uint_t                       hedged;
+
+    ngx_msec_t                       delay;
+    ngx_uint_t                       nsamples;
+    ngx_msec_t                       samples[NGX_HTTP_UPSTREAM_HEDGE_SAMPLES];
+} ngx_http_upstream_hedge_stat_t;
+
+
 #define NGX_HTTP_UPSTREAM_CREATE        0x0001
 #define NGX_HTTP_UPSTREAM_WEIGHT        0x0002
 #define NGX_HTTP_UPSTREAM_MAX_FAILS     0x0004
 #define NGX_HTTP_UPSTREAM_FAIL_TIMEOUT  0x0008
 #define NGX_HTTP_UPSTREAM_DOWN          0x0010
 #define NGX_HTTP_UPSTREAM_BACKUP        0x0020
+#define NGX_HTTP_UPSTREAM_MAX_CONNS     0x0040
 
 
 struct ngx_http_upstream_srv_conf_s {
@@ -116,6 +157,9 @@ struct ngx_http_upstream_srv_conf_s {
     ngx_uint_t                       line;
     in_port_t                        port;
     in_port_t                        default_port;
+
+    ngx_shm_zone_t                  *shm_zone;
+    ngx_http_upstream_queue_t       *queue;
 };
 
 
@@ -146,6 +190,7 @@ typedef struct {
     ngx_flag_t                       buffering;
     ngx_flag_t                       pass_request_headers;
     ngx_flag_t                       pass_request_body;
+    ngx_flag_t                       request_buffering;
 
     ngx_flag_t                       ignore_client_abort;
     ngx_flag_t                       intercept_errors;
@@ -159,6 +204,11 @@ typedef struct {
 
     ngx_addr_t                      *local;
 
+    ngx_msec_t                       hedge_delay;
+    ngx_uint_t                       hedge_percentile;
+    ngx_uint_t                       hedge_budget;
+    ngx_http_upstream_hedge_stat_t  *hedge_stat;
+
 #if (NGX_HTTP_CACHE)
     ngx_shm_zone_t                  *cache;
 
@@ -166,6 +216,12 @@ typedef struct {
     ngx_uint_t                       cache_use_stale;
     ngx_uint_t                       cache_methods;
 
+    ngx_flag_t                       cache_lock;
+    ngx_msec_t                       cache_lock_timeout;
+
+    ngx_flag_t                       cache_background_update;
+    ngx_flag_t                       cache_revalidate;
+
     ngx_array_t                     *cache_valid;
     ngx_array_t                     *cache_bypass;
     ngx_array_t                     *no_cache;
@@ -187,6 +243,21 @@ typedef struct {
 } ngx_http_upstream_conf_t;
 
 
+typedef struct {
+    ngx_event_t                      event;
+    ngx_msec_t                       start;
+
+    ngx_connection_t                *connection;
+    ngx_str_t                       *name;
+
+    ngx_uint_t                       state;
+    time_t                           response_sec;
+    ngx_uint_t                       response_msec;
+
+    unsigned                         fired:1;
+} ngx_http_upstream_hedge_t;
+
+
 typedef struct {
     ngx_str_t                        name;
     ngx_http_header_handler_pt       handler;
@@ -216,6 +287,7 @@ typedef struct {
 
     ngx_table_elt_t                 *content_type;
     ngx_table_elt_t                 *content_length;
+    ngx_table_elt_t                 *transfer_encoding;
 
     ngx_table_elt_t                 *last_modified;
     ngx_table_elt_t                 *location;
@@ -229,6 +301,9 @@ typedef struct {
     off_t                            content_length_n;
 
     ngx_array_t                      cache_control;
+
+    unsigned                         connection_close:1;
+    unsigned                         chunked:1;
 } ngx_http_upstream_headers_in_t;
 
 
@@ -292,8 +367,8 @@ struct ngx_http_upstream_s {
 	buffer。注意，如果没有自定义input_filter方法处理包体，将会使用
 	buffer存储全部的包体，这时buffer必须足够大！它的大小由
 	ngx_http_upstream_conf_t配置结构体中的buffer_size成员决定*/
-    size_t                           length;
-	/*表示来自上游服务器的响应包体的长度*/
+    off_t                            length;
+	/*表示来自上游服务器的响应包体还需要接收的长度，-1表示未知*/
 
     ngx_chain_t                     *out_bufs;
 	/*out_bufs在两种场景下有不同的意义：①当不需要转发包体，且使用默认的
@@ -350,6 +425,19 @@ reinit_request方法*/
     ngx_http_upstream_state_t       *state;
 	/*用于表示上游响应的错误码、包体长度等信息*/
 
+    ngx_http_upstream_hedge_t       *hedge;
+	/*对冲请求：原请求迟迟没有响应时向另一台上游服务器再发一次，connection
+	是等待中的原连接，谁先返回响应就用谁，另一个连接被关闭*/
+
+    ngx_http_upstream_waiter_t      *waiter;
+	/*所有服务器都达到max_conns时请求在upstream的queue中排队等待，
+	有服务器释放连接时按先后顺序唤醒*/
+
+    ngx_chain_t                     *request_body_free;
+    ngx_chain_t                     *request_body_busy;
+	/*不缓存请求包体（request_buffering off）时，边接收边发往上游的包体
+	片段所用的ngx_buf_t，发送完的回收到request_body_free中复用*/
+
     ngx_str_t                        method;
 	/*不使用文件缓存时没有意义*/
     ngx_str_t                        schema;
@@ -365,11 +453,16 @@ reinit_request方法*/
 	/*是否启用文件缓存，本章仅讨论cacheable标志位为0的场景*/
     unsigned                         accel:1;
     unsigned                         ssl:1;
+    unsigned                         keepalive:1;
+	/*响应已经完整读完且上游没有要求关闭连接，这时连接可以由keepalive模块缓存复用*/
 	/*是否基于SSL协议访问上游服务器*/
 #if (NGX_HTTP_CACHE)
     unsigned                         cache_status:3;
 #endif
 
+    unsigned                         peer_copy:1;
+	/*upstream配置了zone时为1，服务器的地址和名字复制到请求的内存池中*/
+
     unsigned                         buffering:1;
 	/*下游转发上游的响应包体时，是否开启更大的内存及临时磁盘文件用于缓存来不及发送到下游的响应包体*/
 
@@ -379,6 +472,11 @@ reinit_request方法*/
 	事实上，这个标志位更多的是为了使用ngx_output_chain方法发送请求，因为该方法发送
 	请求时会自动把未发送完的request_bufs链表记录下来，为了防止反复发送重复请求，
 	必须有request_sent标志位记录是否调用过ngx_output_chain方法*/
+    unsigned                         request_body_sent:1;
+	/*不缓存请求包体时，整个包体是否已经发往当前的上游连接*/
+    unsigned                         request_body_streamed:1;
+	/*不缓存请求包体时，已发送的部分包体是否已被新接收的包体覆盖，
+	为1时请求无法再重试其他上游服务器*/
     unsigned                         header_sent:1;
 	/*将上游服务器的响应划分为包头和包尾，如果把响应直接转发给客户端，
 	header_sent标志位表示包头是否发送，header_sent为
@@ -402,6 +500,8 @@ ngx_http_upstream_srv_conf_t *ngx_http_upstream_add(ngx_conf_t *cf,
     ngx_url_t *u, ngx_uint_t flags);
 char *ngx_http_upstream_bind_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+char *ngx_http_upstream_hedge_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 ngx_int_t ngx_http_upstream_hide_headers_hash(ngx_conf_t *cf,
     ngx_http_upstream_conf_t *conf, ngx_http_upstream_conf_t *prev,
     ngx_str_t *default_hide_headers, ngx_hash_init_t *hash);
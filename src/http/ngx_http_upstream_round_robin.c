@@ -14,6 +14,10 @@ static ngx_int_t ngx_http_upstream_cmp_servers(const void *one,
     const void *two);
 static ngx_uint_t
 ngx_http_upstream_get_peer(ngx_http_upstream_rr_peers_t *peers);
+static ngx_int_t
+ngx_http_upstream_rr_peer_weight(ngx_http_upstream_rr_peer_t *peer);
+static ngx_uint_t
+ngx_http_upstream_rr_tried_size(ngx_http_upstream_rr_peers_t *peers);
 
 #if (NGX_HTTP_SSL)
 
@@ -30,7 +34,10 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
     ngx_http_upstream_srv_conf_t *us)
 {
     ngx_url_t                      u;
-    ngx_uint_t                     i, j, n;
+    ngx_uint_t                     i, j, n, w;
+#if (NGX_HTTP_UPSTREAM_CHECK)
+    ngx_int_t                      rc;
+#endif
     ngx_http_upstream_server_t    *server;
     ngx_http_upstream_rr_peers_t  *peers, *backup;
 
@@ -57,9 +64,11 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 
         peers->single = (n == 1);
         peers->number = n;
+        peers->max = n;
         peers->name = &us->host;
 
         n = 0;
+        w = 0;
 
         for (i = 0; i < us->servers->nelts; i++) {
             for (j = 0; j < server[i].naddrs; j++) {
@@ -72,13 +81,27 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                 peers->peer[n].name = server[i].addrs[j].name;
                 peers->peer[n].max_fails = server[i].max_fails;
                 peers->peer[n].fail_timeout = server[i].fail_timeout;
+                peers->peer[n].max_conns = server[i].max_conns;
                 peers->peer[n].down = server[i].down;
                 peers->peer[n].weight = server[i].down ? 0 : server[i].weight;
                 peers->peer[n].current_weight = peers->peer[n].weight;
+                w += peers->peer[n].weight;
+
+#if (NGX_HTTP_UPSTREAM_CHECK)
+                rc = ngx_http_upstream_check_add_peer(cf, us, &peers->peer[n]);
+                if (rc == NGX_ERROR) {
+                    return NGX_ERROR;
+                }
+
+                peers->peer[n].check_index = rc;
+#endif
+
                 n++;
             }
         }
 
+        peers->total_weight = w;
+
         us->peer.data = peers;
 
         ngx_sort(&peers->peer[0], (size_t) n,
@@ -110,9 +133,11 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
         peers->single = 0;
         backup->single = 0;
         backup->number = n;
+        backup->max = n;
         backup->name = &us->host;
 
         n = 0;
+        w = 0;
 
         for (i = 0; i < us->servers->nelts; i++) {
             for (j = 0; j < server[i].naddrs; j++) {
@@ -127,11 +152,25 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                 backup->peer[n].current_weight = server[i].weight;
                 backup->peer[n].max_fails = server[i].max_fails;
                 backup->peer[n].fail_timeout = server[i].fail_timeout;
+                backup->peer[n].max_conns = server[i].max_conns;
                 backup->peer[n].down = server[i].down;
+                w += server[i].weight;
+
+#if (NGX_HTTP_UPSTREAM_CHECK)
+                rc = ngx_http_upstream_check_add_peer(cf, us, &backup->peer[n]);
+                if (rc == NGX_ERROR) {
+                    return NGX_ERROR;
+                }
+
+                backup->peer[n].check_index = rc;
+#endif
+
                 n++;
             }
         }
 
+        backup->total_weight = w;
+
         peers->next = backup;
 
         ngx_sort(&backup->peer[0], (size_t) n,
@@ -176,6 +215,8 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 
     peers->single = (n == 1);
     peers->number = n;
+    peers->max = n;
+    peers->total_weight = n;
     peers->name = &us->host;
 
     for (i = 0; i < u.naddrs; i++) {
@@ -228,26 +269,25 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
 
     rrp->peers = us->peer.data;
     rrp->current = 0;
+    rrp->counted = NULL;
 
-    n = rrp->peers->number;
-
-    if (rrp->peers->next && rrp->peers->next->number > n) {
-        n = rrp->peers->next->number;
-    }
+    n = ngx_http_upstream_rr_tried_size(rrp->peers);
 
-    if (n <= 8 * sizeof(uintptr_t)) {
+    if (n == 1) {
         rrp->tried = &rrp->data;
         rrp->data = 0;
 
     } else {
-        n = (n + (8 * sizeof(uintptr_t) - 1)) / (8 * sizeof(uintptr_t));
-
         rrp->tried = ngx_pcalloc(r->pool, n * sizeof(uintptr_t));
         if (rrp->tried == NULL) {
             return NGX_ERROR;
         }
     }
 
+    if (r->upstream->waiter) {
+        r->upstream->waiter->data = rrp;
+    }
+
     r->upstream->peer.get = ngx_http_upstream_get_round_robin_peer;
     r->upstream->peer.free = ngx_http_upstream_free_round_robin_peer;
     r->upstream->peer.tries = rrp->peers->number;
@@ -256,12 +296,60 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
                                ngx_http_upstream_set_round_robin_peer_session;
     r->upstream->peer.save_session =
                                ngx_http_upstream_save_round_robin_peer_session;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    /* a saved session is local to a process, so it cannot be shared */
+
+    if (rrp->peers->shpool) {
+        r->upstream->peer.set_session = ngx_http_upstream_empty_set_session;
+        r->upstream->peer.save_session = ngx_http_upstream_empty_save_session;
+    }
+
+#endif
 #endif
 
     return NGX_OK;
 }
 
 
+/*
+ * a request woken up in the upstream queue starts over with the primary
+ * servers, the state of the previous tries is reused to not allocate
+ * it from the request pool on every wake up
+ */
+
+void
+ngx_http_upstream_reset_round_robin_peer(ngx_peer_connection_t *pc,
+    ngx_http_upstream_srv_conf_t *us, ngx_http_upstream_rr_peer_data_t *rrp)
+{
+    rrp->peers = us->peer.data;
+    rrp->current = 0;
+
+    ngx_memzero(rrp->tried,
+                ngx_http_upstream_rr_tried_size(rrp->peers) * sizeof(uintptr_t));
+
+    pc->tries = rrp->peers->number;
+}
+
+
+/* the peers added at run time fit in the tried bitmap too */
+
+static ngx_uint_t
+ngx_http_upstream_rr_tried_size(ngx_http_upstream_rr_peers_t *peers)
+{
+    ngx_uint_t  n;
+
+    n = peers->max;
+
+    if (peers->next && peers->next->number > n) {
+        n = peers->next->number;
+    }
+
+    return (n + (8 * sizeof(uintptr_t) - 1)) / (8 * sizeof(uintptr_t));
+}
+
+
 ngx_int_t
 ngx_http_upstream_create_round_robin_peer(ngx_http_request_t *r,
     ngx_http_upstream_resolved_t *ur)
@@ -292,6 +380,8 @@ ngx_http_upstream_create_round_robin_peer(ngx_http_request_t *r,
 
     peers->single = (ur->naddrs == 1);
     peers->number = ur->naddrs;
+    peers->max = ur->naddrs;
+    peers->total_weight = ur->naddrs;
     peers->name = &ur->host;
 
     if (ur->sockaddr) {
@@ -339,6 +429,7 @@ ngx_http_upstream_create_round_robin_peer(ngx_http_request_t *r,
 
     rrp->peers = peers;
     rrp->current = 0;
+    rrp->counted = NULL;
 
     if (rrp->peers->number <= 8 * sizeof(uintptr_t)) {
         rrp->tried = &rrp->data;
@@ -374,7 +465,7 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     time_t                         now;
     uintptr_t                      m;
     ngx_int_t                      rc;
-    ngx_uint_t                     i, n;
+    ngx_uint_t                     i, n, busy;
     ngx_connection_t              *c;
     ngx_http_upstream_rr_peer_t   *peer;
     ngx_http_upstream_rr_peers_t  *peers;
@@ -384,7 +475,7 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
 
     now = ngx_time();
 
-    /* ngx_lock_mutex(rrp->peers->mutex); */
+    ngx_http_upstream_rr_peers_lock(rrp->peers);
 
     if (rrp->peers->last_cached) {
 
@@ -393,7 +484,7 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
         c = rrp->peers->cached[rrp->peers->last_cached];
         rrp->peers->last_cached--;
 
-        /* ngx_unlock_mutex(ppr->peers->mutex); */
+        ngx_http_upstream_rr_peers_unlock(rrp->peers);
 
 #if (NGX_THREADS)
         c->read->lock = c->read->own_lock;
@@ -409,9 +500,15 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     pc->cached = 0;
     pc->connection = NULL;
 
+    busy = 0;
+
     if (rrp->peers->single) {
         peer = &rrp->peers->peer[0];
 
+        if (ngx_http_upstream_rr_peer_full(peer)) {
+            goto failed;
+        }
+
     } else {
 
         /* there are several peers */
@@ -425,6 +522,10 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
             for ( ;; ) {
                 rrp->current = ngx_http_upstream_get_peer(rrp->peers);
 
+                if (rrp->current == rrp->peers->number) {
+                    goto failed;
+                }
+
                 ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                                "get rr peer, current: %ui %i",
                                rrp->current,
@@ -436,7 +537,22 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
                 if (!(rrp->tried[n] & m)) {
                     peer = &rrp->peers->peer[rrp->current];
 
-                    if (!peer->down) {
+                    if (ngx_http_upstream_rr_peer_down(peer)) {
+                        peer->current_weight = 0;
+                        rrp->tried[n] |= m;
+                        pc->tries--;
+
+                    } else if (ngx_http_upstream_rr_peer_full(peer)) {
+
+                        /* a busy peer is skipped without using up a try */
+
+                        peer->current_weight = 0;
+
+                        if (++busy >= pc->tries) {
+                            goto failed;
+                        }
+
+                    } else {
 
                         if (peer->max_fails == 0
                             || peer->fails < peer->max_fails)
@@ -450,12 +566,8 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
                         }
 
                         peer->current_weight = 0;
-
-                    } else {
-                        rrp->tried[n] |= m;
+                        pc->tries--;
                     }
-
-                    pc->tries--;
                 }
 
                 if (pc->tries == 0) {
@@ -484,7 +596,22 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
 
                     peer = &rrp->peers->peer[rrp->current];
 
-                    if (!peer->down) {
+                    if (ngx_http_upstream_rr_peer_down(peer)) {
+                        peer->current_weight = 0;
+                        rrp->tried[n] |= m;
+                        pc->tries--;
+
+                    } else if (ngx_http_upstream_rr_peer_full(peer)) {
+
+                        /* a busy peer is skipped without using up a try */
+
+                        peer->current_weight = 0;
+
+                        if (++busy >= pc->tries) {
+                            goto failed;
+                        }
+
+                    } else {
 
                         if (peer->max_fails == 0
                             || peer->fails < peer->max_fails)
@@ -498,12 +625,8 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
                         }
 
                         peer->current_weight = 0;
-
-                    } else {
-                        rrp->tried[n] |= m;
+                        pc->tries--;
                     }
-
-                    pc->tries--;
                 }
 
                 rrp->current++;
@@ -534,7 +657,10 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     pc->socklen = peer->socklen;
     pc->name = &peer->name;
 
-    /* ngx_unlock_mutex(rrp->peers->mutex); */
+    peer->conns++;
+    rrp->counted = peer;
+
+    ngx_http_upstream_rr_peers_unlock(rrp->peers);
 
     if (pc->tries == 1 && rrp->peers->next) {
         pc->tries += rrp->peers->next->number;
@@ -553,7 +679,7 @@ failed:
 
     if (peers->next) {
 
-        /* ngx_unlock_mutex(peers->mutex); */
+        ngx_http_upstream_rr_peers_unlock(peers);
 
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0, "backup servers");
 
@@ -571,16 +697,28 @@ failed:
             return rc;
         }
 
-        /* ngx_lock_mutex(peers->mutex); */
+        ngx_http_upstream_rr_peers_lock(peers);
     }
 
-    /* all peers failed, mark them as live for quick recovery */
+    /*
+     * all peers failed, mark them as live for quick recovery;
+     * this is not done if some peers are just busy with max_conns,
+     * otherwise the failed peers would be used instead of them
+     */
 
     for (i = 0; i < peers->number; i++) {
-        peers->peer[i].fails = 0;
+        if (ngx_http_upstream_rr_peer_full(&peers->peer[i])) {
+            break;
+        }
+    }
+
+    if (i == peers->number) {
+        for (i = 0; i < peers->number; i++) {
+            peers->peer[i].fails = 0;
+        }
     }
 
-    /* ngx_unlock_mutex(peers->mutex); */
+    ngx_http_upstream_rr_peers_unlock(peers);
 
     pc->name = peers->name;
 
@@ -631,16 +769,63 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peers_t *peers)
         }
 
         if (reset++) {
-            return 0;
+
+            /* the servers are down or are slowly started from zero weight */
+
+            for (i = 0; i < peers->number; i++) {
+                if (!ngx_http_upstream_rr_peer_down(&peer[i])
+                    && !ngx_http_upstream_rr_peer_full(&peer[i]))
+                {
+                    return i;
+                }
+            }
+
+            return peers->number;
         }
 
         for (i = 0; i < peers->number; i++) {
-            peer[i].current_weight = peer[i].weight;
+            peer[i].current_weight = ngx_http_upstream_rr_peer_weight(&peer[i]);
         }
     }
 }
 
 
+static ngx_int_t
+ngx_http_upstream_rr_peer_weight(ngx_http_upstream_rr_peer_t *peer)
+{
+#if (NGX_HTTP_UPSTREAM_CHECK)
+    ngx_uint_t  ramp;
+#endif
+
+    /* a peer is taken down at run time with its weight kept */
+
+    if (peer->down) {
+        return 0;
+    }
+
+#if (NGX_HTTP_UPSTREAM_CHECK)
+
+    if (ngx_http_upstream_check_peer_down(peer->check_index)) {
+        return 0;
+    }
+
+    /* a server is slowly started after it has recovered */
+
+    ramp = ngx_http_upstream_check_peer_ramp(peer->check_index);
+
+    if (ramp < 1000) {
+
+        /* the fraction of the weight is rounded randomly */
+
+        return (ngx_int_t) ((peer->weight * ramp + ngx_random() % 1000)
+                            / 1000);
+    }
+#endif
+
+    return peer->weight;
+}
+
+
 void
 ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
     ngx_uint_t state)
@@ -653,6 +838,14 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "free rr peer %ui %ui", pc->tries, state);
 
+    if (rrp->counted) {
+        ngx_http_upstream_rr_peers_lock(rrp->peers);
+        rrp->counted->conns--;
+        ngx_http_upstream_rr_peers_unlock(rrp->peers);
+
+        rrp->counted = NULL;
+    }
+
     if (state == 0 && pc->tries == 0) {
         return;
     }
@@ -669,7 +862,7 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 
         peer = &rrp->peers->peer[rrp->current];
 
-        /* ngx_lock_mutex(rrp->peers->mutex); */
+        ngx_http_upstream_rr_peers_lock(rrp->peers);
 
         peer->fails++;
         peer->accessed = now;
@@ -686,7 +879,7 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
             peer->current_weight = 0;
         }
 
-        /* ngx_unlock_mutex(rrp->peers->mutex); */
+        ngx_http_upstream_rr_peers_unlock(rrp->peers);
     }
 
     rrp->current++;
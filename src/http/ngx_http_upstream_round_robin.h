@@ -28,14 +28,36 @@ typedef struct {
     ngx_uint_t                      max_fails;
     time_t                          fail_timeout;
 
+    ngx_uint_t                      conns;
+    ngx_uint_t                      max_conns;
+
     ngx_uint_t                      down;          /* unsigned  down:1; */
 
+#if (NGX_HTTP_UPSTREAM_CHECK)
+    ngx_uint_t                      check_index;
+#endif
+
 #if (NGX_HTTP_SSL)
     ngx_ssl_session_t              *ssl_session;   /* local to a process */
 #endif
 } ngx_http_upstream_rr_peer_t;
 
 
+#if (NGX_HTTP_UPSTREAM_CHECK)
+
+#define ngx_http_upstream_rr_peer_down(peer)                                  \
+    ((peer)->down || ngx_http_upstream_check_peer_down((peer)->check_index))
+
+#else
+
+#define ngx_http_upstream_rr_peer_down(peer)  (peer)->down
+
+#endif
+
+#define ngx_http_upstream_rr_peer_full(peer)                                  \
+    ((peer)->max_conns && (peer)->conns >= (peer)->max_conns)
+
+
 typedef struct ngx_http_upstream_rr_peers_s  ngx_http_upstream_rr_peers_t;
 
 struct ngx_http_upstream_rr_peers_s {
@@ -43,7 +65,14 @@ struct ngx_http_upstream_rr_peers_s {
     ngx_uint_t                      number;
     ngx_uint_t                      last_cached;
 
+    /* the number of peers the array has room for */
+    ngx_uint_t                      max;
+    ngx_uint_t                      total_weight;
+
  /* ngx_mutex_t                    *mutex; */
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_slab_pool_t                *shpool;
+#endif
     ngx_connection_t              **cached;
 
     ngx_str_t                      *name;
@@ -54,11 +83,38 @@ struct ngx_http_upstream_rr_peers_s {
 };
 
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+#define ngx_http_upstream_rr_peers_lock(peers)                                \
+    do {                                                                      \
+        if ((peers)->shpool) {                                                \
+            ngx_shmtx_lock(&(peers)->shpool->mutex);                          \
+        }                                                                     \
+    } while (0)
+
+#define ngx_http_upstream_rr_peers_unlock(peers)                              \
+    do {                                                                      \
+        if ((peers)->shpool) {                                                \
+            ngx_shmtx_unlock(&(peers)->shpool->mutex);                        \
+        }                                                                     \
+    } while (0)
+
+#else
+
+#define ngx_http_upstream_rr_peers_lock(peers)
+#define ngx_http_upstream_rr_peers_unlock(peers)
+
+#endif
+
+
 typedef struct {
     ngx_http_upstream_rr_peers_t   *peers;
     ngx_uint_t                      current;
     uintptr_t                      *tried;
     uintptr_t                       data;
+
+    /* the peer whose conns were incremented by peer.get() */
+    ngx_http_upstream_rr_peer_t    *counted;
 } ngx_http_upstream_rr_peer_data_t;
 
 
@@ -66,6 +122,8 @@ ngx_int_t ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
     ngx_http_upstream_srv_conf_t *us);
 ngx_int_t ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
     ngx_http_upstream_srv_conf_t *us);
+void ngx_http_upstream_reset_round_robin_peer(ngx_peer_connection_t *pc,
+    ngx_http_upstream_srv_conf_t *us, ngx_http_upstream_rr_peer_data_t *rrp);
 ngx_int_t ngx_http_upstream_create_round_robin_peer(ngx_http_request_t *r,
     ngx_http_upstream_resolved_t *ur);
 ngx_int_t ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc,
@@ -13,6 +13,10 @@ ngx_uint_t  ngx_pagesize;
 ngx_uint_t  ngx_pagesize_shift;
 ngx_uint_t  ngx_cacheline_size;
 
+#if (NGX_HAVE_HUGE_PAGES)
+size_t      ngx_huge_pagesize;
+#endif
+
 
 void *
 ngx_alloc(size_t size, ngx_log_t *log)
@@ -88,3 +92,64 @@ ngx_memalign(size_t alignment, size_t size, ngx_log_t *log)
 }
 
 #endif
+
+
+#if (NGX_HAVE_HUGE_PAGES)
+
+/*
+ * allocates a large private array that lives as long as the process,
+ * the memory is never freed
+ */
+
+void *
+ngx_huge_alloc(size_t size, ngx_uint_t huge_pages, ngx_log_t *log)
+{
+    void    *p;
+    size_t   n;
+
+    if (huge_pages == NGX_HUGE_PAGES_OFF || size < ngx_huge_pagesize) {
+        return ngx_alloc(size, log);
+    }
+
+    n = ngx_align(size, ngx_huge_pagesize);
+
+    p = mmap(NULL, n, PROT_READ|PROT_WRITE,
+             MAP_ANON|MAP_PRIVATE|MAP_HUGETLB, -1, 0);
+
+    if (p != MAP_FAILED) {
+        ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                      "%uz bytes allocated in huge pages", size);
+        return p;
+    }
+
+    if (huge_pages == NGX_HUGE_PAGES_ON) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      "mmap(MAP_ANON|MAP_PRIVATE|MAP_HUGETLB, %uz) failed", n);
+        return NULL;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, log, ngx_errno,
+                   "mmap(MAP_HUGETLB, %uz) failed, trying %uz bytes "
+                   "of transparent huge pages", n, size);
+
+    /* the huge page aligned memory lets the kernel use whole huge pages */
+
+    p = ngx_memalign(ngx_huge_pagesize, n, log);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    if (madvise(p, n, MADV_HUGEPAGE) == -1) {
+        ngx_log_error(NGX_LOG_WARN, log, ngx_errno,
+                      "madvise(MADV_HUGEPAGE, %uz) failed, "
+                      "using normal pages", n);
+        return p;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "transparent huge pages advised for %uz bytes", size);
+
+    return p;
+}
+
+#endif
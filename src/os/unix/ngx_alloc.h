@@ -37,9 +37,23 @@ void *ngx_memalign(size_t alignment, size_t size, ngx_log_t *log);
 #endif
 
 
+#if (NGX_HAVE_HUGE_PAGES)
+
+void *ngx_huge_alloc(size_t size, ngx_uint_t huge_pages, ngx_log_t *log);
+
+#else
+
+#define ngx_huge_alloc(size, huge_pages, log)  ngx_alloc(size, log)
+
+#endif
+
+
 extern ngx_uint_t  ngx_pagesize;
 extern ngx_uint_t  ngx_pagesize_shift;
 extern ngx_uint_t  ngx_cacheline_size;
+#if (NGX_HAVE_HUGE_PAGES)
+extern size_t      ngx_huge_pagesize;
+#endif
 
 
 #endif /* _NGX_ALLOC_H_INCLUDED_ */
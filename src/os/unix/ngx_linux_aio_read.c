@@ -82,6 +82,27 @@ ngx_file_aio_read(ngx_file_t *file, u_char *buf, size_t size, off_t offset,
         return NGX_ERROR;
     }
 
+#if (NGX_HAVE_IOURING)
+
+    if (ngx_event_flags & NGX_USE_IOURING_EVENT) {
+
+        /* the read is completed by the io_uring event module */
+
+        ev->handler = ngx_file_aio_event_handler;
+
+        if (ngx_iouring_aio_read(ev, file->fd, buf, size, offset) == NGX_OK) {
+            ev->active = 1;
+            ev->ready = 0;
+            ev->complete = 0;
+
+            return NGX_AGAIN;
+        }
+
+        return ngx_read_file(file, buf, size, offset);
+    }
+
+#endif
+
     ngx_memzero(&aio->aiocb, sizeof(struct iocb));
 
     aio->aiocb.aio_data = (uint64_t) (uintptr_t) ev;
@@ -77,7 +77,7 @@ extern ssize_t sendfile(int s, int fd, int32_t *offset, size_t size);
 #endif
 
 
-#if (NGX_HAVE_POLL || NGX_HAVE_RTSIG)
+#if (NGX_HAVE_POLL || NGX_HAVE_RTSIG || NGX_HAVE_IOURING)
 #include <poll.h>
 #endif
 
@@ -94,6 +94,34 @@ typedef struct iocb  ngx_aiocb_t;
 #endif
 
 
+#if (NGX_HAVE_IOURING)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+
+#if (NGX_THREAD_POOL)
+#include <sys/syscall.h>
+#endif
+
+
+#if (NGX_HAVE_FUTEX)
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+
+#if (NGX_HAVE_NUMA)
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+
+#if (NGX_HAVE_DLADDR)
+#include <dlfcn.h>
+#endif
+
+
 #define NGX_LISTEN_BACKLOG        511
 
 
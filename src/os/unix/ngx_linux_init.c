@@ -15,6 +15,11 @@ u_char  ngx_linux_kern_osrelease[50];
 int     ngx_linux_rtsig_max;
 
 
+#if (NGX_HAVE_HUGE_PAGES)
+static void ngx_linux_huge_pagesize(ngx_log_t *log);
+#endif
+
+
 static ngx_os_io_t ngx_linux_io = {
     ngx_unix_recv,
     ngx_readv_chain,
@@ -72,6 +77,10 @@ ngx_os_specific_init(ngx_log_t *log)
     }
 #endif
 
+#if (NGX_HAVE_HUGE_PAGES)
+    ngx_linux_huge_pagesize(log);
+#endif
+
     ngx_os_io = ngx_linux_io;
 
     return NGX_OK;
@@ -89,3 +98,71 @@ ngx_os_specific_status(ngx_log_t *log)
                   ngx_linux_rtsig_max);
 #endif
 }
+
+
+#if (NGX_HAVE_HUGE_PAGES)
+
+/* the default huge page size used by MAP_HUGETLB */
+
+static void
+ngx_linux_huge_pagesize(ngx_log_t *log)
+{
+    u_char     *p, *last;
+    size_t      size;
+    ssize_t     n;
+    ngx_fd_t    fd;
+    ngx_int_t   kb;
+    u_char      buf[4096];
+
+    ngx_huge_pagesize = 2 * 1024 * 1024;
+
+    fd = ngx_open_file("/proc/meminfo", NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        return;
+    }
+
+    n = ngx_read_fd(fd, buf, sizeof(buf) - 1);
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"/proc/meminfo\" failed");
+    }
+
+    if (n <= 0) {
+        return;
+    }
+
+    buf[n] = '\0';
+
+    p = (u_char *) ngx_strstr(buf, "Hugepagesize:");
+    if (p == NULL) {
+        return;
+    }
+
+    p += sizeof("Hugepagesize:") - 1;
+
+    while (*p == ' ') {
+        p++;
+    }
+
+    last = p;
+
+    while (*last >= '0' && *last <= '9') {
+        last++;
+    }
+
+    kb = ngx_atoi(p, last - p);
+
+    if (kb > 0) {
+        size = (size_t) kb * 1024;
+
+        /* ngx_align() requires a power of two */
+
+        if ((size & (size - 1)) == 0) {
+            ngx_huge_pagesize = size;
+        }
+    }
+}
+
+#endif
@@ -29,10 +29,12 @@ static ngx_thread_value_t ngx_worker_thread_cycle(void *data);
 #endif
 static void ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data);
 static void ngx_cache_manager_process_handler(ngx_event_t *ev);
+static void ngx_save_pathes(ngx_cycle_t *cycle, ngx_uint_t clean);
 static void ngx_cache_loader_process_handler(ngx_event_t *ev);
 
 
 ngx_uint_t    ngx_process;
+ngx_uint_t    ngx_worker;
 ngx_pid_t     ngx_pid;
 ngx_uint_t    ngx_threaded;
 
@@ -62,7 +64,6 @@ ngx_int_t              ngx_threads_n;
 #endif
 
 
-u_long         cpu_affinity;
 static u_char  master_process[] = "master process";
 
 
@@ -430,11 +431,9 @@ ngx_start_worker_processes(ngx_cycle_t *cycle, ngx_int_t n, ngx_int_t type)
 
     for (i = 0; i < n; i++) {
 
-        cpu_affinity = ngx_get_cpu_affinity(i);
-
 		//封装fork 系统调用
-        ngx_spawn_process(cycle, ngx_worker_process_cycle, NULL,
-                          "worker process", type);
+        ngx_spawn_process(cycle, ngx_worker_process_cycle,
+                          (void *) (intptr_t) i, "worker process", type);
 
         ch.pid = ngx_processes[ngx_process_slot].pid;
         ch.slot = ngx_process_slot;
@@ -790,6 +789,15 @@ ngx_master_process_exit(ngx_cycle_t *cycle)
 
     ngx_delete_pidfile(cycle);
 
+    /*
+     * the paths are saved as clean only here, after a graceful shutdown,
+     * when no process can change the cache directories anymore
+     */
+
+    if (ngx_quit && !ngx_terminate) {
+        ngx_save_pathes(cycle, 1);
+    }
+
     ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "exit");
 
     for (i = 0; ngx_modules[i]; i++) {
@@ -833,6 +841,7 @@ ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
     ngx_connection_t  *c;
 
     ngx_process = NGX_PROCESS_WORKER;
+    ngx_worker = (intptr_t) data;
 
     ngx_worker_process_init(cycle, 1);
 
@@ -900,8 +909,7 @@ ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
                 }
             }
 
-            if (ngx_event_timer_rbtree.root == ngx_event_timer_rbtree.sentinel)
-            {
+            if (ngx_event_timer_empty()) {
                 ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "exiting");
 
                 ngx_worker_process_exit(cycle);
@@ -951,6 +959,12 @@ ngx_worker_process_init(ngx_cycle_t *cycle, ngx_uint_t priority)
     struct rlimit     rlmt;
     ngx_core_conf_t  *ccf;
     ngx_listening_t  *ls;
+#if (NGX_HAVE_CPU_AFFINITY)
+    ngx_cpuset_t     *cpu_affinity;
+#endif
+#if (NGX_HAVE_NUMA)
+    ngx_int_t         node;
+#endif
 
     if (ngx_set_environment(cycle, NULL) == NULL) {
         /* fatal */
@@ -1023,19 +1037,29 @@ ngx_worker_process_init(ngx_cycle_t *cycle, ngx_uint_t priority)
         }
     }
 
-#if (NGX_HAVE_SCHED_SETAFFINITY)
+#if (NGX_HAVE_CPU_AFFINITY)
+
+    cpu_affinity = priority ? ngx_get_cpu_affinity(ngx_worker) : NULL;
 
     if (cpu_affinity) {
-        ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
-                      "sched_setaffinity(0x%08Xl)", cpu_affinity);
+        ngx_setaffinity(cpu_affinity, cycle->log);
 
-        if (sched_setaffinity(0, sizeof(cpu_affinity),
-                              (cpu_set_t *) &cpu_affinity)
-            == -1)
-        {
-            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
-                          "sched_setaffinity(0x%08Xl) failed", cpu_affinity);
+#if (NGX_HAVE_NUMA)
+
+        /*
+         * a worker bound to the CPUs of one node allocates its memory,
+         * including connections and events, from this node
+         */
+
+        if (ngx_numa_init(cycle->log) == NGX_OK && ngx_numa_n > 1) {
+            node = ngx_numa_node(cpu_affinity);
+
+            if (node != NGX_ERROR) {
+                ngx_numa_set_local(node, cycle->log);
+            }
         }
+
+#endif
     }
 
 #endif
@@ -1444,6 +1468,11 @@ ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data)
 
         if (ngx_terminate || ngx_quit) {
             ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "exiting");
+
+            if (ngx_quit && ctx == &ngx_cache_manager_ctx) {
+                ngx_save_pathes(cycle, 0);
+            }
+
             exit(0);
         }
 
@@ -1487,6 +1516,22 @@ ngx_cache_manager_process_handler(ngx_event_t *ev)
 }
 
 
+static void
+ngx_save_pathes(ngx_cycle_t *cycle, ngx_uint_t clean)
+{
+    ngx_uint_t    i;
+    ngx_path_t  **path;
+
+    path = cycle->pathes.elts;
+    for (i = 0; i < cycle->pathes.nelts; i++) {
+
+        if (path[i]->saver) {
+            path[i]->saver(path[i]->data, clean);
+        }
+    }
+}
+
+
 static void
 ngx_cache_loader_process_handler(ngx_event_t *ev)
 {
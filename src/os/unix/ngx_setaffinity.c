@@ -0,0 +1,244 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#if (NGX_HAVE_SCHED_SETAFFINITY)
+
+void
+ngx_setaffinity(ngx_cpuset_t *cpu_affinity, ngx_log_t *log)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, cpu_affinity)) {
+            ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                          "sched_setaffinity(): using cpu #%ui", i);
+        }
+    }
+
+    if (sched_setaffinity(0, sizeof(cpu_set_t), cpu_affinity) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "sched_setaffinity() failed");
+    }
+}
+
+#endif
+
+
+#if (NGX_HAVE_NUMA)
+
+#define NGX_NUMA_MASK_LEN  (NGX_NUMA_MAX_NODES / (8 * sizeof(unsigned long)))
+
+
+static ngx_int_t ngx_numa_parse_cpulist(u_char *p, u_char *last,
+    ngx_cpuset_t *cpus);
+static void ngx_numa_mask(uint64_t nodes, unsigned long *mask);
+
+
+ngx_uint_t    ngx_numa_n;
+uint64_t      ngx_numa_nodes;
+ngx_cpuset_t  ngx_numa_cpus[NGX_NUMA_MAX_NODES];
+
+
+ngx_int_t
+ngx_numa_init(ngx_log_t *log)
+{
+    u_char             buf[NGX_MAX_ERROR_STR];
+    ssize_t            n;
+    ngx_fd_t           fd;
+    ngx_uint_t         node;
+    static ngx_uint_t  done;
+    u_char             path[sizeof("/sys/devices/system/node/node/cpulist")
+                            + NGX_INT_T_LEN];
+
+    if (done) {
+        return ngx_numa_n ? NGX_OK : NGX_DECLINED;
+    }
+
+    done = 1;
+
+    for (node = 0; node < NGX_NUMA_MAX_NODES; node++) {
+
+        ngx_sprintf(path, "/sys/devices/system/node/node%ui/cpulist%Z", node);
+
+        fd = ngx_open_file(path, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+        if (fd == NGX_INVALID_FILE) {
+            continue;
+        }
+
+        n = ngx_read_fd(fd, buf, sizeof(buf));
+
+        if (n == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          ngx_read_fd_n " \"%s\" failed", path);
+        }
+
+        if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", path);
+        }
+
+        if (n <= 0) {
+            continue;
+        }
+
+        if (ngx_numa_parse_cpulist(buf, buf + n, &ngx_numa_cpus[node])
+            != NGX_OK)
+        {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "invalid CPU list in \"%s\"", path);
+            continue;
+        }
+
+        /* nodes without CPUs have only memory */
+
+        if (CPU_COUNT(&ngx_numa_cpus[node]) == 0) {
+            continue;
+        }
+
+        ngx_numa_nodes |= (uint64_t) 1 << node;
+        ngx_numa_n++;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "numa nodes: %ui, mask: %016uxL", ngx_numa_n, ngx_numa_nodes);
+
+    return ngx_numa_n ? NGX_OK : NGX_DECLINED;
+}
+
+
+ngx_int_t
+ngx_numa_node(ngx_cpuset_t *cpu_affinity)
+{
+    ngx_uint_t    node;
+    ngx_cpuset_t  cpus;
+
+    for (node = 0; node < NGX_NUMA_MAX_NODES; node++) {
+
+        if (!(ngx_numa_nodes & ((uint64_t) 1 << node))) {
+            continue;
+        }
+
+        CPU_AND(&cpus, cpu_affinity, &ngx_numa_cpus[node]);
+
+        if (CPU_EQUAL(&cpus, cpu_affinity)) {
+            return node;
+        }
+    }
+
+    return NGX_ERROR;
+}
+
+
+void
+ngx_numa_set_local(ngx_uint_t node, ngx_log_t *log)
+{
+    unsigned long  mask[NGX_NUMA_MASK_LEN];
+
+    ngx_numa_mask((uint64_t) 1 << node, mask);
+
+    /*
+     * memory is taken from the local node while it has free pages,
+     * the other nodes are used as a fallback
+     */
+
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask,
+                NGX_NUMA_MAX_NODES + 1)
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "set_mempolicy(MPOL_PREFERRED, %ui) failed", node);
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "set_mempolicy(): using memory of node #%ui", node);
+}
+
+
+void
+ngx_numa_interleave(u_char *addr, size_t size, ngx_log_t *log)
+{
+    unsigned long  mask[NGX_NUMA_MASK_LEN];
+
+    ngx_numa_mask(ngx_numa_nodes, mask);
+
+    if (syscall(SYS_mbind, addr, size, MPOL_INTERLEAVE, mask,
+                NGX_NUMA_MAX_NODES + 1, 0)
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "mbind(%p, %uz, MPOL_INTERLEAVE) failed", addr, size);
+    }
+}
+
+
+static ngx_int_t
+ngx_numa_parse_cpulist(u_char *p, u_char *last, ngx_cpuset_t *cpus)
+{
+    u_char     *start;
+    ngx_int_t   from, to;
+
+    CPU_ZERO(cpus);
+
+    while (p < last && *p != LF) {
+
+        for (start = p; p < last && *p >= '0' && *p <= '9'; p++) {
+            /* void */
+        }
+
+        from = ngx_atoi(start, p - start);
+
+        if (from == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        to = from;
+
+        if (p < last && *p == '-') {
+
+            for (start = ++p; p < last && *p >= '0' && *p <= '9'; p++) {
+                /* void */
+            }
+
+            to = ngx_atoi(start, p - start);
+
+            if (to == NGX_ERROR || to < from) {
+                return NGX_ERROR;
+            }
+        }
+
+        for ( /* void */ ; from <= to && from < CPU_SETSIZE; from++) {
+            CPU_SET(from, cpus);
+        }
+
+        if (p < last && *p == ',') {
+            p++;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_numa_mask(uint64_t nodes, unsigned long *mask)
+{
+    ngx_uint_t  i, bits;
+
+    bits = 8 * sizeof(unsigned long);
+
+    for (i = 0; i < NGX_NUMA_MASK_LEN; i++) {
+        mask[i] = (unsigned long) (nodes >> (i * bits));
+    }
+}
+
+#endif
@@ -0,0 +1,47 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_SETAFFINITY_H_INCLUDED_
+#define _NGX_SETAFFINITY_H_INCLUDED_
+
+
+#if (NGX_HAVE_SCHED_SETAFFINITY)
+
+#define NGX_HAVE_CPU_AFFINITY 1
+
+typedef cpu_set_t  ngx_cpuset_t;
+
+void ngx_setaffinity(ngx_cpuset_t *cpu_affinity, ngx_log_t *log);
+
+#else
+
+#define ngx_setaffinity(cpu_affinity, log)
+
+typedef uint64_t   ngx_cpuset_t;
+
+#endif
+
+
+#if (NGX_HAVE_NUMA)
+
+#define NGX_NUMA_MAX_NODES  64
+
+/*NUMA拓扑：ngx_numa_cpus[n]是节点n上的CPU集合，ngx_numa_nodes是有CPU的节点位图*/
+
+ngx_int_t ngx_numa_init(ngx_log_t *log);
+ngx_int_t ngx_numa_node(ngx_cpuset_t *cpu_affinity);
+void ngx_numa_set_local(ngx_uint_t node, ngx_log_t *log);
+void ngx_numa_interleave(u_char *addr, size_t size, ngx_log_t *log);
+
+extern ngx_uint_t    ngx_numa_n;
+extern uint64_t      ngx_numa_nodes;
+extern ngx_cpuset_t  ngx_numa_cpus[NGX_NUMA_MAX_NODES];
+
+#endif
+
+
+#endif /* _NGX_SETAFFINITY_H_INCLUDED_ */
@@ -15,6 +15,42 @@
 ngx_int_t
 ngx_shm_alloc(ngx_shm_t *shm)
 {
+    shm->huge = 0;
+
+#if (NGX_HAVE_HUGE_PAGES)
+
+    if (shm->huge_pages != NGX_HUGE_PAGES_OFF) {
+
+        shm->addr = (u_char *) mmap(NULL,
+                                    ngx_align(shm->size, ngx_huge_pagesize),
+                                    PROT_READ|PROT_WRITE,
+                                    MAP_ANON|MAP_SHARED|MAP_HUGETLB, -1, 0);
+
+        if (shm->addr != MAP_FAILED) {
+            shm->huge = 1;
+
+            ngx_log_error(NGX_LOG_NOTICE, shm->log, 0,
+                          "shared memory zone \"%V\" uses huge pages",
+                          &shm->name);
+            return NGX_OK;
+        }
+
+        if (shm->huge_pages == NGX_HUGE_PAGES_ON) {
+            ngx_log_error(NGX_LOG_EMERG, shm->log, ngx_errno,
+                          "mmap(MAP_ANON|MAP_SHARED|MAP_HUGETLB, %uz) failed "
+                          "for shared memory zone \"%V\"",
+                          shm->size, &shm->name);
+            return NGX_ERROR;
+        }
+
+        ngx_log_error(NGX_LOG_WARN, shm->log, ngx_errno,
+                      "mmap(MAP_ANON|MAP_SHARED|MAP_HUGETLB, %uz) failed "
+                      "for shared memory zone \"%V\", using normal pages",
+                      shm->size, &shm->name);
+    }
+
+#endif
+
     shm->addr = (u_char *) mmap(NULL, shm->size,
                                 PROT_READ|PROT_WRITE,
                                 MAP_ANON|MAP_SHARED, -1, 0);
@@ -25,6 +61,20 @@ ngx_shm_alloc(ngx_shm_t *shm)
         return NGX_ERROR;
     }
 
+#if (NGX_HAVE_HUGE_PAGES)
+
+    /* the kernel may still back the zone by transparent huge pages */
+
+    if (shm->huge_pages != NGX_HUGE_PAGES_OFF
+        && shm->size >= ngx_huge_pagesize
+        && madvise(shm->addr, shm->size, MADV_HUGEPAGE) == -1)
+    {
+        ngx_log_error(NGX_LOG_INFO, shm->log, ngx_errno,
+                      "madvise(MADV_HUGEPAGE, %uz) failed", shm->size);
+    }
+
+#endif
+
     return NGX_OK;
 }
 
@@ -32,9 +82,21 @@ ngx_shm_alloc(ngx_shm_t *shm)
 void
 ngx_shm_free(ngx_shm_t *shm)
 {
-    if (munmap((void *) shm->addr, shm->size) == -1) {
+    size_t  size;
+
+    size = shm->size;
+
+#if (NGX_HAVE_HUGE_PAGES)
+
+    if (shm->huge) {
+        size = ngx_align(size, ngx_huge_pagesize);
+    }
+
+#endif
+
+    if (munmap((void *) shm->addr, size) == -1) {
         ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
-                      "munmap(%p, %uz) failed", shm->addr, shm->size);
+                      "munmap(%p, %uz) failed", shm->addr, size);
     }
 }
 
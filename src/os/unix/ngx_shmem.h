@@ -16,12 +16,20 @@
 /*--------nginx 共享内存------lgf*/
 
 
+/*huge_pages配置项的取值*/
+#define NGX_HUGE_PAGES_OFF  0
+#define NGX_HUGE_PAGES_TRY  1
+#define NGX_HUGE_PAGES_ON   2
+
+
 typedef struct {
     u_char      *addr; //指向共享内存的起始地址
     size_t       size; //共享内存的长度
     ngx_str_t    name; //共享内存的名称
     ngx_log_t   *log; //日志对象
     ngx_uint_t   exists;   /* unsigned  exists:1;  表示共享内存是否已经分配过的标志位，为1时表示已经存在*/
+    ngx_uint_t   huge_pages; /* 是否尝试用大页分配，取值为NGX_HUGE_PAGES_* */
+    ngx_uint_t   huge;     /* unsigned  huge:1;  为1时表示实际通过MAP_HUGETLB拿到了大页 */
 } ngx_shm_t;
 
 /*操作ngx_shm_t结构体的方法有以下两个：ngx_shm_alloc用于分配新的共享内存，而ngx_shm_free用于释放已经存在的共享内存 ------lgf*/
@@ -114,3 +114,37 @@ ngx_tcp_push(ngx_socket_t s)
 }
 
 #endif
+
+
+#if (NGX_HAVE_TCP_INFO)
+
+/*
+ * for a listening socket Linux reports the current length of the accept
+ * queue in tcpi_unacked and the backlog in tcpi_sacked
+ */
+
+ngx_int_t
+ngx_tcp_accept_queue(ngx_socket_t s, ngx_uint_t *queue, ngx_uint_t *backlog)
+{
+    socklen_t        len;
+    struct tcp_info  ti;
+
+    len = sizeof(struct tcp_info);
+
+    if (getsockopt(s, IPPROTO_TCP, TCP_INFO, &ti, &len) == -1) {
+        return NGX_ERROR;
+    }
+
+    /* the same as SO_ACCEPTCONN, but without an additional system call */
+
+    if (ti.tcpi_state != TCP_LISTEN) {
+        return NGX_DECLINED;
+    }
+
+    *queue = ti.tcpi_unacked;
+    *backlog = ti.tcpi_sacked;
+
+    return NGX_OK;
+}
+
+#endif
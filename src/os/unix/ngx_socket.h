@@ -54,6 +54,15 @@ int ngx_tcp_push(ngx_socket_t s);
 #endif
 
 
+#if (NGX_HAVE_TCP_INFO)
+
+ngx_int_t ngx_tcp_accept_queue(ngx_socket_t s, ngx_uint_t *queue,
+    ngx_uint_t *backlog);
+#define ngx_tcp_accept_queue_n  "getsockopt(TCP_INFO)"
+
+#endif
+
+
 #define ngx_shutdown_socket    shutdown
 #define ngx_shutdown_socket_n  "shutdown()"
 
@@ -125,6 +125,31 @@ ngx_int_t ngx_cond_signal(ngx_cond_t *cv);
 #endif
 
 
+#if (NGX_THREAD_POOL)
+
+#include <pthread.h>
+
+/*线程池使用的互斥锁和条件变量，与上面旧的多线程实现无关*/
+
+typedef pthread_mutex_t  ngx_thread_mutex_t;
+
+ngx_int_t ngx_thread_mutex_create(ngx_thread_mutex_t *mtx, ngx_log_t *log);
+ngx_int_t ngx_thread_mutex_destroy(ngx_thread_mutex_t *mtx, ngx_log_t *log);
+ngx_int_t ngx_thread_mutex_lock(ngx_thread_mutex_t *mtx, ngx_log_t *log);
+ngx_int_t ngx_thread_mutex_unlock(ngx_thread_mutex_t *mtx, ngx_log_t *log);
+
+
+typedef pthread_cond_t  ngx_thread_cond_t;
+
+ngx_int_t ngx_thread_cond_create(ngx_thread_cond_t *cond, ngx_log_t *log);
+ngx_int_t ngx_thread_cond_destroy(ngx_thread_cond_t *cond, ngx_log_t *log);
+ngx_int_t ngx_thread_cond_signal(ngx_thread_cond_t *cond, ngx_log_t *log);
+ngx_int_t ngx_thread_cond_wait(ngx_thread_cond_t *cond,
+    ngx_thread_mutex_t *mtx, ngx_log_t *log);
+
+#endif
+
+
 #endif /* _NGX_THREAD_H_INCLUDED_ */
 
 